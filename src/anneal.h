@@ -26,6 +26,7 @@
 #endif
 
 #include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include <boost/lambda/lambda.hpp>
@@ -40,8 +41,15 @@
 
 #include <vigra/diff2d.hxx>
 #include <vigra/iteratoradapter.hxx>
+#include <vigra/sized_int.hxx>
 
+#include "common.h"
 #include "masktypedefs.h"
+#include "muopt.h"
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
 
 #ifdef HAVE_LIBGLEW
 #include "gpu.h"
@@ -62,7 +70,8 @@ public:
     typedef typename vigra::NumericTraits<CostImagePixelType>::Promote CostImagePromoteType;
 
     GDAConfiguration(const CostImage* const d, Segment* v, VisualizeImage* const vi) :
-        costImage(d), visualizeStateSpaceImage(vi) {
+        costImage(d), visualizeStateSpaceImage(vi),
+        gdaLanes(parameter::as_unsigned("gda-lanes", 8U)) {
         kMax = 1;
         distanceWeight = 1.0;
         mismatchWeight = 1.0;
@@ -306,6 +315,43 @@ public:
     }
 
 protected:
+    // Calculate the scaled energies E of all states of the point at
+    // index and store them stride elements apart.
+    void calculateStateEnergies(int index, int* E, int stride) const {
+        const int mf_size = static_cast<int>(mfEstimates.size());
+        const std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
+        const std::vector<int>* stateDistances = pointStateDistances[index];
+        const unsigned int localK = stateSpace->size();
+
+        const int lastIndex = index == 0 ? mf_size - 1 : index - 1;
+        const unsigned int nextIndex = (index + 1) % mf_size;
+        const vigra::Point2D lastPointEstimate = mfEstimates[lastIndex];
+        const bool lastPointInCostImage = costImage->isInside(lastPointEstimate);
+        const vigra::Point2D nextPointEstimate = mfEstimates[nextIndex];
+        const bool nextPointInCostImage = costImage->isInside(nextPointEstimate);
+
+        // Calculate E values.
+        // exp_a scaling factor is part of the Schraudolph approximation.
+        // for all e_i, e_j, in E: -700 < e_j-e_i < 700
+        const double exp_a = 1512775.0 / tCurrent; // = (1048576 / M_LN2) / tCurrent;
+        for (unsigned int i = 0; i < localK; ++i) {
+            const vigra::Point2D currentPoint = (*stateSpace)[i];
+            const int distanceCost = (*stateDistances)[i];
+            int mismatchCost = 0;
+            if (lastPointInCostImage) {
+                mismatchCost += costImageCost(lastPointEstimate, currentPoint);
+            }
+            if (nextPointInCostImage) {
+                mismatchCost += costImageCost(currentPoint, nextPointEstimate);
+            }
+
+            const double cost =
+                distanceWeight * static_cast<double>(distanceCost) +
+                mismatchWeight * static_cast<double>(mismatchCost);
+            E[i * stride] = vigra::NumericTraits<int>::fromRealPromote(cost * exp_a);
+        }
+    }
+
     void calculateStateProbabilitiesCPU() {
         const int mf_size = static_cast<int>(mfEstimates.size());
 
@@ -313,7 +359,11 @@ protected:
 #pragma omp parallel
 #endif
         {
+            // Per-thread scratch arrays, one array per quantity, so
+            // that the pairwise update below runs over contiguous
+            // memory instead of chasing the probability vectors.
             int* E = new int[kMax];
+            double* P = new double[kMax];
             double* Pi = new double[kMax];
 
 #ifdef OPENMP
@@ -321,44 +371,18 @@ protected:
 #endif
             for (int index = 0; index < mf_size; ++index) {
                 // Skip updating points that have already converged.
-                convergedPointsLock.set();
+                // Only iterate() changes the flags, so there is no
+                // need for a lock here.
                 if (convergedPoints[index]) {
-                    convergedPointsLock.unset();
                     continue;
                 }
-                convergedPointsLock.unset();
 
-                const std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
                 std::vector<double>* stateProbabilities = pointStateProbabilities[index];
-                const std::vector<int>* stateDistances = pointStateDistances[index];
-                const unsigned int localK = stateSpace->size();
-
-                const int lastIndex = index == 0 ? mf_size - 1 : index - 1;
-                const unsigned int nextIndex = (index + 1) % mf_size;
-                const vigra::Point2D lastPointEstimate = mfEstimates[lastIndex];
-                const bool lastPointInCostImage = costImage->isInside(lastPointEstimate);
-                const vigra::Point2D nextPointEstimate = mfEstimates[nextIndex];
-                const bool nextPointInCostImage = costImage->isInside(nextPointEstimate);
-
-                // Calculate E values.
-                // exp_a scaling factor is part of the Schraudolph approximation.
-                // for all e_i, e_j, in E: -700 < e_j-e_i < 700
-                const double exp_a = 1512775.0 / tCurrent; // = (1048576 / M_LN2) / tCurrent;
-                for (unsigned int i = 0; i < localK; ++i) {
-                    const vigra::Point2D currentPoint = (*stateSpace)[i];
-                    const int distanceCost = (*stateDistances)[i];
-                    int mismatchCost = 0;
-                    if (lastPointInCostImage) {
-                        mismatchCost += costImageCost(lastPointEstimate, currentPoint);
-                    }
-                    if (nextPointInCostImage) {
-                        mismatchCost += costImageCost(currentPoint, nextPointEstimate);
-                    }
+                const unsigned int localK = stateProbabilities->size();
 
-                    const double cost =
-                        distanceWeight * static_cast<double>(distanceCost) +
-                        mismatchWeight * static_cast<double>(mismatchCost);
-                    E[i] = vigra::NumericTraits<int>::fromRealPromote(cost * exp_a);
+                calculateStateEnergies(index, E, 1);
+                for (unsigned int i = 0; i < localK; ++i) {
+                    P[i] = (*stateProbabilities)[i];
                     Pi[i] = 0.0;
                 }
 
@@ -380,11 +404,11 @@ protected:
                 // An = 1 / (1 + exp( (E[j] - E[i]) / T )
                 // pi[j]' = 1/K * sum_(0)_(k-1) An(i,j) * (pi[i] + pi[j])
                 for (unsigned int j = 0; j < localK; ++j) {
-                    const double piTj = (*stateProbabilities)[j];
+                    const double piTj = P[j];
                     Pi[j] += piTj;
                     const int ej = E[j];
                     for (unsigned int i = j + 1; i < localK; ++i) {
-                        const double piT = (*stateProbabilities)[i] + piTj;
+                        const double piT = P[i] + piTj;
                         eco.n.hi = (ej - E[i]) + (0x3ff00000 - 60801);
                         // FIXME eco.n.hi is overflowing into NaN range!
                         double piTAn = piT / (1.0 + eco.d);
@@ -406,10 +430,233 @@ protected:
             }
 
             delete [] E;
+            delete [] P;
             delete [] Pi;
         } // omp parallel
     }
 
+    // Schraudolph's approximation of exp(x) for the scaled energy
+    // difference x = E[j] - E[i].  In contrast to the union in
+    // calculateStateProbabilitiesCPU() we clamp the exponent to
+    // finite doubles.  Thus the quotients in
+    // calculateStateProbabilitiesBatched() never become NaNs; they
+    // approach 0 or piT like the NaN repair does.  The bit cast via
+    // memcpy() does not keep compilers from vectorizing the caller.
+    static double fastExp(int deltaE) {
+        const int bias = 0x3ff00000 - 60801;
+        const int lowest = 0x00100000 - bias;
+        const int highest = 0x7fe00000 - bias;
+        const int clampedDeltaE = std::min(std::max(deltaE, lowest), highest);
+        const vigra::UInt64 bits =
+            static_cast<vigra::UInt64>(static_cast<vigra::UInt32>(clampedDeltaE + bias)) << 32;
+        double result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    class LargerStateSpace
+    {
+    public:
+        LargerStateSpace(const std::vector<std::vector<vigra::Point2D>*>* someStateSpaces) :
+            stateSpaces(someStateSpaces) {}
+
+        bool operator()(int i, int j) const {
+            return (*stateSpaces)[i]->size() > (*stateSpaces)[j]->size();
+        }
+
+    private:
+        const std::vector<std::vector<vigra::Point2D>*>* stateSpaces;
+    };
+
+    // Triangular sweep of calculateStateProbabilitiesBatched() over
+    // the first batchK states of all lanes of a batch.
+    //     An = 1 / (1 + exp( (E[j] - E[i]) / T )
+    //     pi[j]' = 1/K * sum_(0)_(k-1) An(i,j) * (pi[i] + pi[j])
+    static void sweepBatch(const int* E, const double* P, const double* M, double* Pi,
+                           double* sum, int lanes, unsigned int batchK) {
+        for (unsigned int j = 0; j < batchK; ++j) {
+            const int* E_j = E + j * lanes;
+            const double* P_j = P + j * lanes;
+            double* Pi_j = Pi + j * lanes;
+
+            for (int l = 0; l < lanes; ++l) {
+                sum[l] = Pi_j[l] + P_j[l];
+            }
+
+            for (unsigned int i = j + 1; i < batchK; ++i) {
+                const int* E_i = E + i * lanes;
+                const double* P_i = P + i * lanes;
+                const double* M_i = M + i * lanes;
+                double* Pi_i = Pi + i * lanes;
+
+                for (int l = 0; l < lanes; ++l) {
+                    const double piT = P_i[l] + P_j[l];
+                    const double piTAn = M_i[l] * (piT / (1.0 + fastExp(E_j[l] - E_i[l])));
+                    sum[l] += piTAn;
+                    Pi_i[l] += M_i[l] * piT - piTAn;
+                }
+            }
+
+            for (int l = 0; l < lanes; ++l) {
+                Pi_j[l] = sum[l];
+            }
+        }
+    }
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+    // AVX2 version of sweepBatch(), four lanes per step.  It performs
+    // the same operations in the same order, including fastExp()'s
+    // clamp and bit cast, so its results equal those of the scalar
+    // sweep.
+    TARGET_AVX2 static void sweepBatchAVX2(const int* E, const double* P, const double* M, double* Pi,
+                                           double* sum, int lanes, unsigned int batchK) {
+        const __m128i bias = _mm_set1_epi32(0x3ff00000 - 60801);
+        const __m128i lowest = _mm_set1_epi32(0x00100000 - (0x3ff00000 - 60801));
+        const __m128i highest = _mm_set1_epi32(0x7fe00000 - (0x3ff00000 - 60801));
+        const __m256d one = _mm256_set1_pd(1.0);
+        const int vectorLanes = lanes & ~3;
+
+        for (unsigned int j = 0; j < batchK; ++j) {
+            const int* E_j = E + j * lanes;
+            const double* P_j = P + j * lanes;
+            double* Pi_j = Pi + j * lanes;
+
+            for (int l = 0; l < lanes; ++l) {
+                sum[l] = Pi_j[l] + P_j[l];
+            }
+
+            for (unsigned int i = j + 1; i < batchK; ++i) {
+                const int* E_i = E + i * lanes;
+                const double* P_i = P + i * lanes;
+                const double* M_i = M + i * lanes;
+                double* Pi_i = Pi + i * lanes;
+
+                int l = 0;
+                for (; l < vectorLanes; l += 4) {
+                    const __m128i deltaE =
+                        _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(E_j + l)),
+                                      _mm_loadu_si128(reinterpret_cast<const __m128i*>(E_i + l)));
+                    const __m128i exponent =
+                        _mm_add_epi32(_mm_min_epi32(_mm_max_epi32(deltaE, lowest), highest), bias);
+                    const __m256d e =
+                        _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_cvtepu32_epi64(exponent), 32));
+                    const __m256d m = _mm256_loadu_pd(M_i + l);
+                    const __m256d piT = _mm256_add_pd(_mm256_loadu_pd(P_i + l), _mm256_loadu_pd(P_j + l));
+                    const __m256d piTAn = _mm256_mul_pd(m, _mm256_div_pd(piT, _mm256_add_pd(one, e)));
+                    _mm256_storeu_pd(sum + l, _mm256_add_pd(_mm256_loadu_pd(sum + l), piTAn));
+                    _mm256_storeu_pd(Pi_i + l,
+                                     _mm256_add_pd(_mm256_loadu_pd(Pi_i + l),
+                                                   _mm256_sub_pd(_mm256_mul_pd(m, piT), piTAn)));
+                }
+                for (; l < lanes; ++l) {
+                    const double piT = P_i[l] + P_j[l];
+                    const double piTAn = M_i[l] * (piT / (1.0 + fastExp(E_j[l] - E_i[l])));
+                    sum[l] += piTAn;
+                    Pi_i[l] += M_i[l] * piT - piTAn;
+                }
+            }
+
+            for (int l = 0; l < lanes; ++l) {
+                Pi_j[l] = sum[l];
+            }
+        }
+    }
+#endif
+
+    // Same update as calculateStateProbabilitiesCPU(), but for
+    // batches of gdaLanes points.  Like the GPU path packs four
+    // points into each texel, the scratch arrays interleave the states
+    // of all points of a batch as [state][lane].  So the innermost
+    // loop runs across the points of a batch without dependencies or
+    // branches.  On x86 CPUs with AVX2 sweepBatchAVX2() processes four
+    // lanes per instruction; elsewhere the portable sweepBatch()
+    // runs.  The mask M blanks out states beyond a point's state
+    // space.
+    void calculateStateProbabilitiesBatched() {
+        const int lanes = static_cast<int>(gdaLanes);
+        const int mf_size = static_cast<int>(mfEstimates.size());
+
+        std::vector<int> pendingPoints;
+        for (int index = 0; index < mf_size; ++index) {
+            if (!convergedPoints[index]) {
+                pendingPoints.push_back(index);
+            }
+        }
+
+        // Batch points of similar state-space sizes, so that few
+        // lanes idle.
+        std::stable_sort(pendingPoints.begin(), pendingPoints.end(), LargerStateSpace(&pointStateSpaces));
+
+        const int numberOfPendingPoints = static_cast<int>(pendingPoints.size());
+        const int numberOfBatches = (numberOfPendingPoints + lanes - 1) / lanes;
+#ifdef HAVE_X86_SIMD_DISPATCH
+        const bool useAVX2 = muopt::cpu_supports_avx2();
+#endif
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+        {
+            const size_t scratchSize = static_cast<size_t>(kMax) * static_cast<size_t>(lanes);
+            int* E = new int[scratchSize];
+            double* P = new double[scratchSize];
+            double* Pi = new double[scratchSize];
+            double* M = new double[scratchSize];
+            double* sum = new double[lanes];
+
+#ifdef OPENMP
+#pragma omp for nowait schedule(guided)
+#endif
+            for (int batch = 0; batch < numberOfBatches; ++batch) {
+                const int firstPoint = batch * lanes;
+                const int batchSize = std::min(lanes, numberOfPendingPoints - firstPoint);
+                const unsigned int batchK = pointStateSpaces[pendingPoints[firstPoint]]->size();
+
+                std::fill(E, E + scratchSize, 0);
+                std::fill(P, P + scratchSize, 0.0);
+                std::fill(Pi, Pi + scratchSize, 0.0);
+                std::fill(M, M + scratchSize, 0.0);
+
+                for (int l = 0; l < batchSize; ++l) {
+                    const int index = pendingPoints[firstPoint + l];
+                    const std::vector<double>* stateProbabilities = pointStateProbabilities[index];
+                    const unsigned int localK = stateProbabilities->size();
+
+                    calculateStateEnergies(index, E + l, lanes);
+                    for (unsigned int i = 0; i < localK; ++i) {
+                        P[i * lanes + l] = (*stateProbabilities)[i];
+                        M[i * lanes + l] = 1.0;
+                    }
+                }
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+                if (useAVX2) {
+                    sweepBatchAVX2(E, P, M, Pi, sum, lanes, batchK);
+                } else {
+                    sweepBatch(E, P, M, Pi, sum, lanes, batchK);
+                }
+#else
+                sweepBatch(E, P, M, Pi, sum, lanes, batchK);
+#endif
+
+                for (int l = 0; l < batchSize; ++l) {
+                    std::vector<double>* stateProbabilities = pointStateProbabilities[pendingPoints[firstPoint + l]];
+                    const unsigned int localK = stateProbabilities->size();
+
+                    for (unsigned int i = 0; i < localK; ++i) {
+                        (*stateProbabilities)[i] = Pi[i * lanes + l] / localK;
+                    }
+                }
+            }
+
+            delete [] E;
+            delete [] P;
+            delete [] Pi;
+            delete [] M;
+            delete [] sum;
+        } // omp parallel
+    }
+
 #ifdef HAVE_LIBGLEW
     void calculateStateProbabilitiesGPU() {
         const unsigned int mf_size = mfEstimates.size();
@@ -500,12 +747,14 @@ protected:
 #ifdef HAVE_LIBGLEW
         if (UseGPU) {
             calculateStateProbabilitiesGPU();
+            return;
+        }
+#endif
+        if (gdaLanes >= 2) {
+            calculateStateProbabilitiesBatched();
         } else {
             calculateStateProbabilitiesCPU();
         }
-#else
-        calculateStateProbabilitiesCPU();
-#endif
     }
 
    void iterate() {
@@ -522,12 +771,9 @@ protected:
 #pragma omp for nowait schedule(guided)
 #endif
             for (int index = 0; index < static_cast<int>(pointStateSpaces.size()); ++index) {
-                convergedPointsLock.set();
                 if (convergedPoints[index]) {
-                    convergedPointsLock.unset();
                     continue;
                 }
-                convergedPointsLock.unset();
 
                 std::vector<vigra::Point2D>* stateSpace = pointStateSpaces[index];
                 std::vector<double>* stateProbabilities = pointStateProbabilities[index];
@@ -557,26 +803,27 @@ protected:
 
                 // Sanity check
                 if (!costImage->isInside(newEstimate)) {
-                    cerrLock.set();
-                    std::cerr << command
-                              << ": warning: new mean field estimate outside cost image"
-                              << std::endl;
-                    for (unsigned int state = 0; state < localK; ++state) {
+#ifdef OPENMP
+#pragma omp critical
+#endif
+                    {
+                        std::cerr << command
+                                  << ": warning: new mean field estimate outside cost image"
+                                  << std::endl;
+                        for (unsigned int state = 0; state < localK; ++state) {
+                            std::cerr << command
+                                      << ": info:    state " << (*stateSpace)[state]
+                                      << " weight = "
+                                      << (*stateProbabilities)[state]
+                                      << std::endl;
+                        }
                         std::cerr << command
-                                  << ": info:    state " << (*stateSpace)[state]
-                                  << " weight = "
-                                  << (*stateProbabilities)[state]
+                                  << ": info:    new estimate = " << newEstimate
                                   << std::endl;
                     }
-                    std::cerr << command
-                              << ": info:    new estimate = " << newEstimate
-                              << std::endl;
-                    cerrLock.unset();
 
                     // Skip this point from now on.
-                    convergedPointsLock.set();
                     convergedPoints[index] = true;
-                    convergedPointsLock.unset();
                     continue;
                 }
 
@@ -610,17 +857,16 @@ protected:
 
                 localK = stateSpace->size();
                 if (localK < 2) {
-                    convergedPointsLock.set();
                     convergedPoints[index] = true;
-                    convergedPointsLock.unset();
                 }
 
                 kmax_local = std::max(kmax_local, stateProbabilities->size());
             }
 
-            kMaxLock.set();
+#ifdef OPENMP
+#pragma omp critical
+#endif
             kMax = std::max(kMax, static_cast<unsigned int>(kmax_local));
-            kMaxLock.unset();
         } // omp parallel
     }
 
@@ -683,9 +929,12 @@ protected:
 
     std::vector<std::vector<int>*> pointStateDistances;
 
-    // Flags indicate which points have converged
-    std::vector<bool> convergedPoints;
-    omp::lock convergedPointsLock;
+    // Flags indicate which points have converged.  We deliberately
+    // avoid the bit-packed std::vector<bool>: with one byte per point
+    // the thread that updates a point can set its flag without
+    // disturbing the flags of its neighbors, so that no lock is
+    // needed.
+    std::vector<unsigned char> convergedPoints;
 
     // Initial Temperature
     double tInitial;
@@ -707,7 +956,6 @@ protected:
 
     // Largest state space over all points
     unsigned int kMax;
-    omp::lock kMaxLock;
 
     // Weight factors for the distance of a point from the initial
     // seam line and the total mismatch accumulated along the seam
@@ -715,7 +963,10 @@ protected:
     double distanceWeight;;
     double mismatchWeight;
 
-    omp::lock cerrLock;
+    // Number of points calculateStateProbabilitiesBatched() updates
+    // side by side; values below 2 select
+    // calculateStateProbabilitiesCPU()
+    const unsigned int gdaLanes;
 };
 
 
@@ -240,23 +240,40 @@ import(const vigra::ImageImportInfo& info,
  *  Uses a greedy heuristic.
  *  Removes used images from given list of ImageImportInfos.
  *  Returns an ImageImportInfo for the temporary file.
- *  memory xsection = 2 * (ImageType*inputUnion + AlphaType*inputUnion)
+ *
+ *  The alpha channel always covers the whole inputUnion.  The image
+ *  itself only covers imageWindow, which is an _output_ parameter
+ *  relative to the upper left corner of inputUnion.  If we load one
+ *  image at a time the window is the footprint of the image file,
+ *  otherwise it is all of inputUnion.  Pixels outside of imageWindow
+ *  are never assigned by assemble and thus are considered zero.
+ *
+ *  memory xsection = 2 * (ImageType*imageWindow + AlphaType*inputUnion)
  */
 template <typename ImageType, typename AlphaType>
 std::pair<ImageType*, AlphaType*>
-assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& inputUnion, vigra::Rect2D& bb)
+assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& inputUnion, vigra::Rect2D& bb,
+         vigra::Rect2D& imageWindow, bool restrictToFootprint = true)
 {
     typedef typename AlphaType::traverser AlphaIteratorType;
     typedef typename AlphaType::Accessor AlphaAccessor;
 
     // No more images to assemble?
     if (imageInfoList.empty()) {
+        imageWindow = vigra::Rect2D();
         return std::pair<ImageType*, AlphaType*>(static_cast<ImageType*>(NULL),
                                                  static_cast<AlphaType*>(NULL));
     }
 
+    if (OneAtATime && restrictToFootprint) {
+        imageWindow = vigra::Rect2D(imageInfoList.front()->getPosition() - inputUnion.upperLeft(),
+                                    imageInfoList.front()->size());
+    } else {
+        imageWindow = vigra::Rect2D(inputUnion.size());
+    }
+
     // Create an image to assemble input images into.
-    ImageType* image = new ImageType(inputUnion.size());
+    ImageType* image = new ImageType(imageWindow.size());
     AlphaType* imageA = new AlphaType(inputUnion.size());
 
     if (Verbose >= VERBOSE_ASSEMBLE_MESSAGES) {
@@ -277,7 +294,7 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
 
     const vigra::Diff2D imagePos = imageInfoList.front()->getPosition();
     import(*imageInfoList.front(),
-           vigra::destIter(image->upperLeft() + imagePos - inputUnion.upperLeft()),
+           vigra::destIter(image->upperLeft() + imagePos - inputUnion.upperLeft() - imageWindow.upperLeft()),
            vigra::destIter(imageA->upperLeft() + imagePos - inputUnion.upperLeft()));
     imageInfoList.erase(imageInfoList.begin());
 
@@ -330,7 +347,8 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
                 const vigra::Diff2D srcPos = info->getPosition();
                 vigra::copyImageIf(srcImageRange(*src),
                                    maskImage(*srcA),
-                                   vigra::destIter(image->upperLeft() - inputUnion.upperLeft() + srcPos));
+                                   vigra::destIter(image->upperLeft() - inputUnion.upperLeft() + srcPos -
+                                                   imageWindow.upperLeft()));
                 vigra::copyImageIf(srcImageRange(*srcA),
                                    maskImage(*srcA),
                                    vigra::destIter(imageA->upperLeft() - inputUnion.upperLeft() + srcPos));
@@ -357,7 +375,7 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
 
     // Calculate bounding box of image.
     vigra::FindBoundingRectangle unionRect;
-    vigra::inspectImageIf(srcIterRange(vigra::Diff2D(), vigra::Diff2D() + image->size()),
+    vigra::inspectImageIf(srcIterRange(vigra::Diff2D(), vigra::Diff2D() + imageA->size()),
                           srcImage(*imageA), unionRect);
     bb = unionRect();
 
@@ -371,6 +389,18 @@ assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& input
     return std::pair<ImageType*, AlphaType*>(image, imageA);
 }
 
+
+/** Assemble images into an image that covers all of inputUnion.
+ *  memory xsection = 2 * (ImageType*inputUnion + AlphaType*inputUnion)
+ */
+template <typename ImageType, typename AlphaType>
+std::pair<ImageType*, AlphaType*>
+assemble(std::list<vigra::ImageImportInfo*>& imageInfoList, vigra::Rect2D& inputUnion, vigra::Rect2D& bb)
+{
+    vigra::Rect2D imageWindow;
+    return assemble<ImageType, AlphaType>(imageInfoList, inputUnion, bb, imageWindow, false);
+}
+
 } // namespace enblend
 
 #endif /* __ASSEMBLE_H__ */
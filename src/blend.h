@@ -24,12 +24,23 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <vector>
 
+#include <boost/static_assert.hpp>
+
 #include <vigra/combineimages.hxx>
 #include <vigra/numerictraits.hxx>
+#include <vigra/rgbvalue.hxx>
 
 #include "fixmath.h"
+#include "muopt.h"
+#include "pyramid.h"
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
 
 
 namespace enblend {
@@ -75,6 +86,336 @@ protected:
 };
 
 
+/** Layout of a pyramid pixel as seen by BlendRowKernel.
+ *
+ *  Fixed-point pyramid pixels -- scalars or RGB triples of Int16 or
+ *  Int32 -- are blended component by component in integer
+ *  arithmetic; all other pixel types go through
+ *  CartesianBlendFunctor.
+ */
+template <typename ImagePixelType>
+struct BlendRowTraits
+{
+    typedef vigra::VigraFalseType isFixedPoint;
+    typedef ImagePixelType ComponentType;
+    enum {components = 1};
+};
+
+template <>
+struct BlendRowTraits<vigra::Int16>
+{
+    typedef vigra::VigraTrueType isFixedPoint;
+    typedef vigra::Int16 ComponentType;
+    enum {components = 1};
+};
+
+template <>
+struct BlendRowTraits<vigra::Int32>
+{
+    typedef vigra::VigraTrueType isFixedPoint;
+    typedef vigra::Int32 ComponentType;
+    enum {components = 1};
+};
+
+template <typename ComponentPixelType>
+struct BlendRowTraits<vigra::RGBValue<ComponentPixelType, 0, 1, 2> >
+{
+    typedef typename BlendRowTraits<ComponentPixelType>::isFixedPoint isFixedPoint;
+    typedef ComponentPixelType ComponentType;
+    enum {components = 3};
+};
+
+
+// Number of fraction bits of the fixed-point blend coefficients
+#define BLEND_COEFFICIENT_FRACTION_BITS 30
+
+// Number of pixels whose blend coefficients BlendRowKernel computes
+// in one go
+#define BLEND_ROW_CHUNK 64
+
+
+/** Blend n fixed-point components of white into black.  For each i
+ *  it computes
+ *
+ *      black[i] <= black[i] + round((white[i] - black[i]) * coefficient[i])
+ *
+ *  where coefficient[i] in [0, 1] carries
+ *  BLEND_COEFFICIENT_FRACTION_BITS fraction bits.
+ */
+template <typename ComponentType>
+inline void
+blendComponents(const vigra::Int32* coefficient, const ComponentType* white, ComponentType* black, int n)
+{
+    const vigra::Int64 half = vigra::Int64(1) << (BLEND_COEFFICIENT_FRACTION_BITS - 1);
+
+    for (int i = 0; i < n; ++i) {
+        const vigra::Int64 difference = static_cast<vigra::Int64>(white[i]) - static_cast<vigra::Int64>(black[i]);
+        black[i] = static_cast<ComponentType>(black[i] +
+                                              ((difference * coefficient[i] + half) >> BLEND_COEFFICIENT_FRACTION_BITS));
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+
+// The SIMD kernels compute the differences white - black in 32-bit
+// lanes.  This is exact for the pyramid types of
+// EnblendNumericTraits, whose Int32 components use no more than 24
+// bits.  The 64-bit products are shifted logically, which leaves
+// the same lower 32 bits as the arithmetic shift of the scalar code,
+// so all kernels give identical results.
+
+inline __m128i
+blendEpi32SSE2(__m128i w, __m128i b, __m128i c)
+{
+    const __m128i half = _mm_set1_epi64x(vigra::Int64(1) << (BLEND_COEFFICIENT_FRACTION_BITS - 1));
+    const __m128i low = _mm_set1_epi64x(0xffffffffLL);
+    const __m128i d = _mm_sub_epi32(w, b);
+    // SSE2 only has an unsigned 32x32->64 multiply.  Where d is
+    // negative it yields d * c + 2^32 * c, so subtract c << 32.
+    const __m128i cn = _mm_and_si128(c, _mm_srai_epi32(d, 31));
+
+    __m128i even = _mm_mul_epu32(d, c);
+    even = _mm_sub_epi64(even, _mm_slli_epi64(cn, 32));
+    even = _mm_srli_epi64(_mm_add_epi64(even, half), BLEND_COEFFICIENT_FRACTION_BITS);
+
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(d, 32), _mm_srli_epi64(c, 32));
+    odd = _mm_sub_epi64(odd, _mm_slli_epi64(_mm_srli_epi64(cn, 32), 32));
+    odd = _mm_srli_epi64(_mm_add_epi64(odd, half), BLEND_COEFFICIENT_FRACTION_BITS);
+
+    return _mm_add_epi32(b, _mm_or_si128(_mm_and_si128(even, low), _mm_slli_epi64(odd, 32)));
+}
+
+
+TARGET_AVX2 inline __m256i
+blendEpi32AVX2(__m256i w, __m256i b, __m256i c)
+{
+    const __m256i half = _mm256_set1_epi64x(vigra::Int64(1) << (BLEND_COEFFICIENT_FRACTION_BITS - 1));
+    const __m256i d = _mm256_sub_epi32(w, b);
+
+    __m256i even = _mm256_mul_epi32(d, c);
+    even = _mm256_srli_epi64(_mm256_add_epi64(even, half), BLEND_COEFFICIENT_FRACTION_BITS);
+
+    __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(d, 32), _mm256_srli_epi64(c, 32));
+    odd = _mm256_srli_epi64(_mm256_add_epi64(odd, half), BLEND_COEFFICIENT_FRACTION_BITS);
+
+    return _mm256_add_epi32(b, _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa));
+}
+
+
+inline void
+blendComponentsSSE2(const vigra::Int32* coefficient, const vigra::Int32* white, vigra::Int32* black, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficient + i));
+        const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(white + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(black + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(black + i), blendEpi32SSE2(w, b, c));
+    }
+    blendComponents<vigra::Int32>(coefficient + i, white + i, black + i, n - i);
+}
+
+
+// Int16 components are widened to 32 bits, where their difference
+// fits, and packed again.  The blended values lie between black and
+// white, so packing never saturates.
+inline void
+blendComponentsSSE2(const vigra::Int32* coefficient, const vigra::Int16* white, vigra::Int16* black, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficient + i));
+        const __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficient + i + 4));
+        const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(white + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(black + i));
+        // Sign-extend by unpacking into the upper halves and shifting back.
+        const __m128i w0 = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+        const __m128i w1 = _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16);
+        const __m128i b0 = _mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16);
+        const __m128i b1 = _mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(black + i),
+                         _mm_packs_epi32(blendEpi32SSE2(w0, b0, c0), blendEpi32SSE2(w1, b1, c1)));
+    }
+    blendComponents<vigra::Int16>(coefficient + i, white + i, black + i, n - i);
+}
+
+
+TARGET_AVX2 inline void
+blendComponentsAVX2(const vigra::Int32* coefficient, const vigra::Int32* white, vigra::Int32* black, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefficient + i));
+        const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(white + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(black + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(black + i), blendEpi32AVX2(w, b, c));
+    }
+    blendComponentsSSE2(coefficient + i, white + i, black + i, n - i);
+}
+
+
+TARGET_AVX2 inline void
+blendComponentsAVX2(const vigra::Int32* coefficient, const vigra::Int16* white, vigra::Int16* black, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i c0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefficient + i));
+        const __m256i c1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(coefficient + i + 8));
+        const __m128i* const w = reinterpret_cast<const __m128i*>(white + i);
+        const __m128i* const b = reinterpret_cast<const __m128i*>(black + i);
+        const __m256i r0 = blendEpi32AVX2(_mm256_cvtepi16_epi32(_mm_loadu_si128(w)),
+                                          _mm256_cvtepi16_epi32(_mm_loadu_si128(b)),
+                                          c0);
+        const __m256i r1 = blendEpi32AVX2(_mm256_cvtepi16_epi32(_mm_loadu_si128(w + 1)),
+                                          _mm256_cvtepi16_epi32(_mm_loadu_si128(b + 1)),
+                                          c1);
+        // _mm256_packs_epi32 packs within 128-bit lanes; restore the order.
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(black + i),
+                            _mm256_permute4x64_epi64(_mm256_packs_epi32(r0, r1), 0xd8));
+    }
+    blendComponentsSSE2(coefficient + i, white + i, black + i, n - i);
+}
+
+
+// The fixed-point pyramid types get explicit SSE2 and AVX2 kernels,
+// selected by the capabilities of the CPU we are running on.
+inline void
+blendComponents(const vigra::Int32* coefficient, const vigra::Int32* white, vigra::Int32* black, int n)
+{
+    if (muopt::cpu_supports_avx2()) {
+        blendComponentsAVX2(coefficient, white, black, n);
+    } else {
+        blendComponentsSSE2(coefficient, white, black, n);
+    }
+}
+
+
+inline void
+blendComponents(const vigra::Int32* coefficient, const vigra::Int16* white, vigra::Int16* black, int n)
+{
+    if (muopt::cpu_supports_avx2()) {
+        blendComponentsAVX2(coefficient, white, black, n);
+    } else {
+        blendComponentsSSE2(coefficient, white, black, n);
+    }
+}
+
+#endif // HAVE_X86_SIMD_DISPATCH
+
+
+/** Blend one row of a white pyramid level into the same row of a
+ *  black pyramid level.
+ *
+ *  For fixed-point pyramids with an integral mask pyramid, the mask
+ *  values are turned into blend coefficients with
+ *  BLEND_COEFFICIENT_FRACTION_BITS fraction bits, chunk by chunk, and
+ *  blendComponents() updates each component with a single integer
+ *  multiply-add instead of the floating-point CartesianBlendFunctor.
+ *  The result differs from CartesianBlendFunctor only where the
+ *  latter rounds a value that lies within 1/64 of halfway between two
+ *  representable values.
+ */
+template <typename MaskPixelType, typename ImagePixelType>
+class BlendRowKernel {
+public:
+    typedef BlendRowTraits<ImagePixelType> Traits;
+    typedef typename Traits::ComponentType ComponentType;
+
+    BlendRowKernel(MaskPixelType w) :
+        functor(w),
+        coefficientScale(static_cast<double>(vigra::Int32(1) << BLEND_COEFFICIENT_FRACTION_BITS) /
+                         vigra::NumericTraits<MaskPixelType>::toRealPromote(w)) {}
+
+    void operator()(const MaskPixelType* mask, const ImagePixelType* white, ImagePixelType* black, int width) const {
+        typedef typename Traits::isFixedPoint ImageIsFixedPoint;
+        typedef typename vigra::NumericTraits<MaskPixelType>::isIntegral MaskIsIntegral;
+
+        blendRow(mask, white, black, width, ImageIsFixedPoint(), MaskIsIntegral());
+    }
+
+private:
+    BOOST_STATIC_ASSERT(sizeof(ImagePixelType) == Traits::components * sizeof(ComponentType));
+
+    void blendRow(const MaskPixelType* mask, const ImagePixelType* white, ImagePixelType* black, int width,
+                  vigra::VigraTrueType, vigra::VigraTrueType) const {
+        const vigra::Int32 one = vigra::Int32(1) << BLEND_COEFFICIENT_FRACTION_BITS;
+        const ComponentType* const w = reinterpret_cast<const ComponentType*>(white);
+        ComponentType* const b = reinterpret_cast<ComponentType*>(black);
+        vigra::Int32 coefficient[BLEND_ROW_CHUNK * Traits::components];
+
+        for (int x0 = 0; x0 < width; x0 += BLEND_ROW_CHUNK) {
+            const int n = std::min(width - x0, BLEND_ROW_CHUNK);
+
+            for (int x = 0; x < n; ++x) {
+                // A coefficient of 0 or one reproduces bP or wP exactly.
+                const vigra::Int32 c =
+                    std::min(one,
+                             std::max(vigra::Int32(0),
+                                      static_cast<vigra::Int32>(static_cast<double>(mask[x0 + x]) * coefficientScale +
+                                                                0.5)));
+                for (int k = 0; k < Traits::components; ++k) {
+                    coefficient[x * Traits::components + k] = c;
+                }
+            }
+
+            blendComponents(coefficient,
+                            w + x0 * Traits::components, b + x0 * Traits::components,
+                            n * Traits::components);
+        }
+    }
+
+    template <typename ImageIsFixedPoint, typename MaskIsIntegral>
+    void blendRow(const MaskPixelType* mask, const ImagePixelType* white, ImagePixelType* black, int width,
+                  ImageIsFixedPoint, MaskIsIntegral) const {
+        for (int x = 0; x < width; ++x) {
+            black[x] = functor(mask[x], white[x], black[x]);
+        }
+    }
+
+    CartesianBlendFunctor<MaskPixelType> functor;
+    double coefficientScale;
+};
+
+
+/** Blend numLevels levels of the white pyramid into the black
+ *  pyramid using the mask pyramid.
+ *
+ *  All rows of all given levels form a single pool of tasks, which
+ *  one flat parallel loop works off.  Each task reads and writes one
+ *  contiguous row of each level.
+ */
+template <typename MaskPyramidType, typename ImagePyramidType>
+void
+blendPyramidLevels(MaskPyramidType* const* maskLevels,
+                   ImagePyramidType* const* whiteLevels,
+                   ImagePyramidType* const* blackLevels,
+                   unsigned int numLevels,
+                   typename MaskPyramidType::value_type maskPyramidWhiteValue)
+{
+    typedef BlendRowKernel<typename MaskPyramidType::value_type, typename ImagePyramidType::value_type> KernelType;
+
+    // firstRow[l] is the index of the first task of level l.
+    std::vector<int> firstRow(numLevels + 1U, 0);
+    for (unsigned int l = 0; l < numLevels; l++) {
+        firstRow[l + 1U] = firstRow[l] + maskLevels[l]->height();
+    }
+    const int numberOfRows = firstRow[numLevels];
+    const KernelType kernel(maskPyramidWhiteValue);
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(guided)
+#endif
+    for (int task = 0; task < numberOfRows; ++task) {
+        const unsigned int l =
+            static_cast<unsigned int>(std::upper_bound(firstRow.begin(), firstRow.end(), task) - firstRow.begin()) - 1U;
+        const int y = task - firstRow[l];
+
+        kernel((*maskLevels[l])[y], (*whiteLevels[l])[y], (*blackLevels[l])[y], maskLevels[l]->width());
+    }
+}
+
+
 /** Blend black and white pyramids using mask pyramid.
  */
 template <typename MaskPyramidType, typename ImagePyramidType>
@@ -89,33 +430,179 @@ blend(std::vector<MaskPyramidType*>* maskGP,
         std::cerr.flush();
     }
 
-#ifdef OPENMP
-    omp::scoped_nested(true);
-#pragma omp parallel
-    {
-#pragma omp single nowait
-        {
-#endif
-            for (unsigned int layer = 0; layer < maskGP->size(); layer++) {
-                if (Verbose >= VERBOSE_BLEND_MESSAGES) {
-                    std::cerr << " l" << layer;
-                    std::cerr.flush();
-                }
+    if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+        for (unsigned int layer = 0; layer < maskGP->size(); layer++) {
+            std::cerr << " l" << layer;
+        }
+        std::cerr.flush();
+    }
 
-                combineThreeImagesMP(srcImageRange(*((*maskGP)[layer])),
-                                     srcImage(*((*whiteLP)[layer])),
-                                     srcImage(*((*blackLP)[layer])),
-                                     destImage(*((*blackLP)[layer])),
-                                     CartesianBlendFunctor<typename MaskPyramidType::value_type>(maskPyramidWhiteValue));
+    // All levels are independent of each other, so they share one
+    // pool of row tasks.
+    if (!maskGP->empty()) {
+        blendPyramidLevels(&(*maskGP)[0], &(*whiteLP)[0], &(*blackLP)[0],
+                           static_cast<unsigned int>(maskGP->size()),
+                           maskPyramidWhiteValue);
+    }
+
+    if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+        std::cerr << std::endl;
+    }
+}
+
+
+/** Blend a white and a black image with the help of the mask
+ *  pyramid maskGP and return the Laplacian pyramid of the result.
+ *  The white image is passed as level 0 of its Gaussian pyramid,
+ *  whiteGP, so that the caller can release the white image before
+ *  the pyramids are built.  blendLaplacianPyramids() takes ownership
+ *  of whiteGP.
+ *
+ *  This is a fused version of laplacianPyramid() for the white
+ *  image, laplacianPyramid() for the black image, and blend().  The
+ *  Gaussian pyramids of both images are reduced together level by
+ *  level.  As soon as the next coarser level is known, the current
+ *  level of either pyramid is turned into its Laplacian, the two
+ *  are blended into the black level, and the white level is
+ *  released.  Thus, only a single full image pyramid -- the result
+ *  -- ever exists plus two levels of the white Gaussian pyramid.
+ *
+ *  The result is identical to building both Laplacian pyramids
+ *  first and blending them afterwards.
+ */
+template <typename SrcImageType, typename AlphaImageType,
+          typename MaskPyramidType, typename PyramidImageType,
+          int PyramidIntegerBits, int PyramidFractionBits,
+          typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType>
+std::vector<PyramidImageType*>*
+blendLaplacianPyramids(unsigned int numLevels,
+                       bool wraparound,
+                       std::vector<MaskPyramidType*>* maskGP,
+                       typename MaskPyramidType::value_type maskPyramidWhiteValue,
+                       PyramidImageType* whiteGP,
+                       typename AlphaImageType::const_traverser white_alpha_upperleft,
+                       typename AlphaImageType::ConstAccessor waa,
+                       typename SrcImageType::const_traverser black_upperleft,
+                       typename SrcImageType::ConstAccessor ba,
+                       typename AlphaImageType::const_traverser black_alpha_upperleft,
+                       typename AlphaImageType::ConstAccessor baa)
+{
+    vigra_precondition(maskGP->size() == numLevels,
+                       "blendLaplacianPyramids: mask pyramid has wrong number of levels");
+
+    std::vector<PyramidImageType*>* lp = new std::vector<PyramidImageType*>();
+
+    // Size of pyramid level 0
+    int w = whiteGP->width();
+    int h = whiteGP->height();
+
+    // Pyramid level 0 of the black image
+    PyramidImageType* blackGP = new PyramidImageType(w, h);
+    copyToPyramidImage<SrcImageType, PyramidImageType, PyramidIntegerBits, PyramidFractionBits>
+        (black_upperleft, black_upperleft + vigra::Diff2D(w, h), ba, blackGP->upperLeft(), blackGP->accessor());
+
+    if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+        std::cerr << command << ": info: blending layers:             ";
+        std::cerr.flush();
+    }
+
+    AlphaImageType* whiteA = NULL;
+    AlphaImageType* blackA = NULL;
+    for (unsigned int l = 0; l < numLevels; l++) {
+        if (Verbose >= VERBOSE_BLEND_MESSAGES) {
+            std::cerr << " l" << l;
+            std::cerr.flush();
+        }
+
+        PyramidImageType* nextWhiteGP = NULL;
+        PyramidImageType* nextBlackGP = NULL;
+
+        if (l + 1 < numLevels) {
+            // Size of next level
+            w = (w + 1) >> 1;
+            h = (h + 1) >> 1;
+
+            nextWhiteGP = new PyramidImageType(w, h);
+            nextBlackGP = new PyramidImageType(w, h);
+            AlphaImageType* nextWhiteA = new AlphaImageType(w, h);
+            AlphaImageType* nextBlackA = new AlphaImageType(w, h);
+
+            if (whiteA == NULL) {
+                reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                    (wraparound,
+                     srcImageRange(*whiteGP), maskIter(white_alpha_upperleft, waa),
+                     destImageRange(*nextWhiteGP), destImageRange(*nextWhiteA));
+                reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                    (wraparound,
+                     srcImageRange(*blackGP), maskIter(black_alpha_upperleft, baa),
+                     destImageRange(*nextBlackGP), destImageRange(*nextBlackA));
+            } else {
+                reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                    (wraparound,
+                     srcImageRange(*whiteGP), maskImage(*whiteA),
+                     destImageRange(*nextWhiteGP), destImageRange(*nextWhiteA));
+                reduce<SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+                    (wraparound,
+                     srcImageRange(*blackGP), maskImage(*blackA),
+                     destImageRange(*nextBlackGP), destImageRange(*nextBlackA));
             }
-#ifdef OPENMP
-        } // omp single
-    } // omp parallel
-#endif
+
+            delete whiteA;
+            whiteA = nextWhiteA;
+            delete blackA;
+            blackA = nextBlackA;
+
+            // Turn the current Gaussian levels into Laplacian levels.
+            expand<SKIPSMImagePixelType>(false, wraparound,
+                                         srcImageRange(*nextWhiteGP), destImageRange(*whiteGP));
+            expand<SKIPSMImagePixelType>(false, wraparound,
+                                         srcImageRange(*nextBlackGP), destImageRange(*blackGP));
+        }
+
+        blendPyramidLevels(&(*maskGP)[l], &whiteGP, &blackGP, 1U, maskPyramidWhiteValue);
+
+        delete whiteGP;
+        lp->push_back(blackGP);
+
+        whiteGP = nextWhiteGP;
+        blackGP = nextBlackGP;
+    }
+
+    delete whiteA;
+    delete blackA;
 
     if (Verbose >= VERBOSE_BLEND_MESSAGES) {
         std::cerr << std::endl;
     }
+
+    return lp;
+}
+
+
+// Version using argument object factories.
+template <typename SrcImageType, typename AlphaImageType,
+          typename MaskPyramidType, typename PyramidImageType,
+          int PyramidIntegerBits, int PyramidFractionBits,
+          typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType>
+inline std::vector<PyramidImageType*>*
+blendLaplacianPyramids(unsigned int numLevels,
+                       bool wraparound,
+                       std::vector<MaskPyramidType*>* maskGP,
+                       typename MaskPyramidType::value_type maskPyramidWhiteValue,
+                       PyramidImageType* whiteGP,
+                       vigra::pair<typename AlphaImageType::const_traverser, typename AlphaImageType::ConstAccessor> whiteAlpha,
+                       vigra::pair<typename SrcImageType::const_traverser, typename SrcImageType::ConstAccessor> black,
+                       vigra::pair<typename AlphaImageType::const_traverser, typename AlphaImageType::ConstAccessor> blackAlpha)
+{
+    return blendLaplacianPyramids<SrcImageType, AlphaImageType, MaskPyramidType, PyramidImageType,
+                                  PyramidIntegerBits, PyramidFractionBits,
+                                  SKIPSMImagePixelType, SKIPSMAlphaPixelType>
+        (numLevels, wraparound,
+         maskGP, maskPyramidWhiteValue,
+         whiteGP,
+         whiteAlpha.first, whiteAlpha.second,
+         black.first, black.second,
+         blackAlpha.first, blackAlpha.second);
 }
 
 } // namespace enblend
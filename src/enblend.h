@@ -78,6 +78,16 @@ void enblendMain(const FileNameList& anInputFileNameList,
     std::list<vigra::ImageImportInfo*> imageInfoList(anImageInfoList);
 
     // Create the initial black image.
+    //
+    // Unlike the white image the black image covers all of
+    // anInputUnion, because it accumulates the result of every blend
+    // and is written out as a whole by checkpoint().  A row of it is
+    // final only when no later image reaches it, including the
+    // filterHalfWidth(MAX_PYRAMID_LEVELS) border of that image's
+    // roiBB.  In a horizontal panorama every image spans nearly all
+    // rows, so rows become final only after the last blend, and
+    // streaming finished strips to the output file would not lower
+    // the peak memory.  Therefore we do not stream the black image.
     vigra::Rect2D blackBB;
     std::pair<ImageType*, AlphaType*> blackPair =
         assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, blackBB);
@@ -105,19 +115,27 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
     const unsigned numberOfImages = imageInfoList.size();
 
+    // The NFT scratch images are freed after each mask, and when
+    // an exception leaves enblendMain().
+    NearestFeatureWorkspaceScope nftWorkspaceScope;
+
     // Main blending loop.
     unsigned m = 0;
     FileNameList::const_iterator inputFileNameIterator(anInputFileNameList.begin());
     while (!imageInfoList.empty()) {
-        // Create the white image.
+        // Create the white image.  Its pixel data only covers
+        // whiteWindow, i.e. the footprint of the white image on the
+        // canvas, whereas its alpha channel covers all of anInputUnion.
         vigra::Rect2D whiteBB;
+        vigra::Rect2D whiteWindow;
         std::pair<ImageType*, AlphaType*> whitePair =
-            assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, whiteBB);
+            assemble<ImageType, AlphaType>(imageInfoList, anInputUnion, whiteBB, whiteWindow);
 
         // mem usage before = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
-        // mem xsection = OneAtATime: anInputUnion*imageValueType + anInputUnion*AlphaValueType
+        // mem xsection = OneAtATime: whiteWindow*imageValueType + anInputUnion*AlphaValueType
         //                !OneAtATime: 2*anInputUnion*imageValueType + 2*anInputUnion*AlphaValueType
-        // mem usage after = 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+        // mem usage after = anInputUnion*ImageValueType + whiteWindow*ImageValueType
+        //                   + 2*anInputUnion*AlphaValueType
 
 #ifdef CACHE_IMAGES
         if (Verbose >= VERBOSE_CFI_MESSAGES) {
@@ -178,8 +196,8 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
             // Copy white image into black image verbatim.
             vigra::copyImageIf(srcImageRange(*(whitePair.first)),
-                               maskImage(*(whitePair.second)),
-                               destImage(*(blackPair.first)));
+                               vigra_ext::apply(whiteWindow, maskImage(*(whitePair.second))),
+                               vigra_ext::apply(whiteWindow, destImage(*(blackPair.first))));
             vigra::copyImageIf(srcImageRange(*(whitePair.second)),
                                maskImage(*(whitePair.second)),
                                destImage(*(blackPair.second)));
@@ -258,12 +276,16 @@ void enblendMain(const FileNameList& anInputFileNameList,
             uBB.width() == anInputUnion.width();
 
         MaskType* mask =
-            createMask<ImageType, AlphaType, MaskType>(whitePair.first, blackPair.first,
+            createMask<ImageType, AlphaType, MaskType>(whitePair.first, whiteWindow, blackPair.first,
                                                        whitePair.second, blackPair.second,
                                                        uBB, iBB, wraparoundForMask,
                                                        numberOfImages,
                                                        inputFileNameIterator, m);
 
+        // The NFT buffers are no longer needed; free them before the
+        // pyramids get built.
+        releaseNearestFeatureWorkspaces();
+
         // Calculate bounding box of seam line.
         vigra::Rect2D mBB;
         maskBounds(mask, uBB, mBB);
@@ -304,7 +326,7 @@ void enblendMain(const FileNameList& anInputFileNameList,
         }
 
         // mem usage here = MaskType*ubb +
-        //                  2*anInputUnion*ImageValueType +
+        //                  anInputUnion*ImageValueType + whiteWindow*ImageValueType +
         //                  2*anInputUnion*AlphaValueType
 
 #ifdef CACHE_IMAGES
@@ -333,10 +355,20 @@ void enblendMain(const FileNameList& anInputFileNameList,
             WrapAround != OpenBoundaries &&
             roiBB.width() == anInputUnion.width();
 
+        // Part of uBB where the white image carries pixel data, once
+        // relative to the canvas, once relative to whiteWindow, and
+        // once relative to uBB.  Copying with the mask can be
+        // restricted to this part, for the white image is zero outside.
+        const vigra::Rect2D uwBB = uBB & whiteWindow;
+        vigra::Rect2D uwBB_white = uwBB;
+        uwBB_white.moveBy(-whiteWindow.upperLeft());
+        vigra::Rect2D uwBB_uBB = uwBB;
+        uwBB_uBB.moveBy(-uBB.upperLeft());
+
         if (StopAfterMaskGeneration) {
-            vigra::copyImageIf(vigra_ext::apply(uBB, srcImageRange(*(whitePair.first))),
-                               maskImage(*mask),
-                               vigra_ext::apply(uBB, destImage(*(blackPair.first))));
+            vigra::copyImageIf(vigra_ext::apply(uwBB_white, srcImageRange(*(whitePair.first))),
+                               vigra_ext::apply(uwBB_uBB, maskImage(*mask)),
+                               vigra_ext::apply(uwBB, destImage(*(blackPair.first))));
             vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
                                vigra_ext::apply(whiteBB, maskImage(*(whitePair.second))),
                                vigra::NumericTraits<AlphaPixelType>::max());
@@ -353,17 +385,20 @@ void enblendMain(const FileNameList& anInputFileNameList,
 
         // Estimate memory requirements for this blend iteration
         if (Verbose >= VERBOSE_MEMORY_ESTIMATION_MESSAGES) {
-            // Maximum utilization is when all three pyramids have been built
-            // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
-            //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
-            // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
+            // Maximum utilization is when the first level of the
+            // blended pyramid is being built.  The white rgb data
+            // has been released by then.
+            // mem xsection = 2 * (4 * roiBB.width() * SKIPSMImagePixelType
+            //                     + 4 * roiBB.width() * SKIPSMAlphaPixelType)
+            // mem usage peak = anInputUnion*ImageValueType
+            //      + 2*anInputUnion*AlphaValueType
             //      + (4/3)*roiBB*MaskPyramidType
-            //      + 2*(4/3)*roiBB*ImagePyramidType
+            //      + (5/2)*roiBB*ImagePyramidType
             long long bytes =
                 anInputUnion.area() * (sizeof(ImagePixelType) + 2 * sizeof(AlphaPixelType))
-                + (4/3) * roiBB.area() * (sizeof(MaskPyramidPixelType)
-                                          + 2 * sizeof(ImagePyramidPixelType))
-                + (4 * roiBB.width()) * (sizeof(SKIPSMImagePixelType)
+                + (4/3) * roiBB.area() * sizeof(MaskPyramidPixelType)
+                + (5 * roiBB.area() * sizeof(ImagePyramidPixelType)) / 2
+                + (8 * roiBB.width()) * (sizeof(SKIPSMImagePixelType)
                                          + sizeof(SKIPSMAlphaPixelType));
 
             std::cerr << command << ": info: estimated space required for this blend step: "
@@ -420,77 +455,94 @@ void enblendMain(const FileNameList& anInputFileNameList,
         // These are pixels where the white image contributes outside of the ROI.
         // We cannot modify black image inside the ROI yet because we haven't built the
         // black pyramid.
-        vigra::copyImageIf(vigra_ext::apply(uBB, srcImageRange(*(whitePair.first))),
-                           maskImage(*mask),
-                           vigra_ext::apply(uBB, destImage(*(blackPair.first))));
+        vigra::copyImageIf(vigra_ext::apply(uwBB_white, srcImageRange(*(whitePair.first))),
+                           vigra_ext::apply(uwBB_uBB, maskImage(*mask)),
+                           vigra_ext::apply(uwBB, destImage(*(blackPair.first))));
 
         // We no longer need the mask.
         delete mask;
-        // mem usage after = 2*anInputUnion*ImageValueType +
+        // mem usage after = anInputUnion*ImageValueType + whiteWindow*ImageValueType +
         //                   2*anInputUnion*AlphaValueType +
         //                   (4/3)*roiBB*MaskPyramidType
 
-        // Build Laplacian pyramid from white image.
-        std::vector<ImagePyramidType*>* whiteLP =
-            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
-                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
-                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>("whiteGP",
-                                                                         numLevels, wraparoundForBlend,
-                                                                         vigra_ext::apply(roiBB, srcImageRange(*(whitePair.first))),
-                                                                         vigra_ext::apply(roiBB, maskImage(*(whitePair.second))));
-
-#ifdef CACHE_IMAGES
-        if (Verbose >= VERBOSE_CFI_MESSAGES) {
-            vigra_ext::CachedFileImageDirector& v = vigra_ext::CachedFileImageDirector::v();
-            std::cerr << command
-                      << ": info: image cache statistics after calculating white pyramid\n";
-            v.printStats(std::cerr, command + ": info:     blackImage", blackPair.first);
-            v.printStats(std::cerr, command + ": info:     blackAlpha", blackPair.second);
-            v.printStats(std::cerr, command + ": info:     whiteImage", whitePair.first);
-            v.printStats(std::cerr, command + ": info:     whiteAlpha", whitePair.second);
-            for (unsigned int i = 0; i < maskGP->size(); i++) {
-                v.printStats(std::cerr, command + ": info:     maskGP", i, (*maskGP)[i]);
-            }
-            for (unsigned int i = 0; i < whiteLP->size(); i++) {
-                v.printStats(std::cerr, command + ": info:     whiteLP", i, (*whiteLP)[i]);
+        // Materialize the white image's pixels inside the ROI only.
+        // If the ROI is entirely covered by whiteWindow, we do not
+        // need a copy at all.  Otherwise the parts of the ROI outside
+        // of whiteWindow are zero.
+        ImageType* whiteROI = NULL;
+        vigra::Rect2D roiBB_white = roiBB;
+        roiBB_white.moveBy(-whiteWindow.upperLeft());
+        if ((roiBB & whiteWindow) != roiBB) {
+            whiteROI = new ImageType(roiBB.size());
+            const vigra::Rect2D rwBB = roiBB & whiteWindow;
+            if (!rwBB.isEmpty()) {
+                vigra::Rect2D rwBB_white = rwBB;
+                rwBB_white.moveBy(-whiteWindow.upperLeft());
+                vigra::Rect2D rwBB_roiBB = rwBB;
+                rwBB_roiBB.moveBy(-roiBB.upperLeft());
+                vigra::copyImage(vigra_ext::apply(rwBB_white, srcImageRange(*(whitePair.first))),
+                                 vigra_ext::apply(rwBB_roiBB, destImage(*whiteROI)));
             }
-            v.printStats(std::cerr, command + ": info: ");
-            v.resetCacheMisses();
+            delete whitePair.first;
+            whitePair.first = whiteROI;
+            roiBB_white = vigra::Rect2D(roiBB.size());
         }
-#endif
-        // mem usage after = 2*anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //                   + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
-        // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
-        //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
+        // mem usage after = anInputUnion*ImageValueType + min(whiteWindow, roiBB)*ImageValueType +
+        //                   2*anInputUnion*AlphaValueType +
+        //                   (4/3)*roiBB*MaskPyramidType
+
+        // Convert the white image to level 0 of its Gaussian pyramid
+        // right away so that we can release the white rgb data before
+        // the pyramids are built.
+        ImagePyramidType* whiteGP = new ImagePyramidType(roiBB.size());
+        copyToPyramidImage<ImageType, ImagePyramidType, ImagePyramidIntegerBits, ImagePyramidFractionBits>
+            (vigra_ext::apply(roiBB_white, srcImageRange(*(whitePair.first))), destImage(*whiteGP));
 
         // We no longer need the white rgb data.
         delete whitePair.first;
-        // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //                   + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
-
-        // Build Laplacian pyramid from black image.
+        whitePair.first = NULL;
+        // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType +
+        //                   (4/3)*roiBB*MaskPyramidType + roiBB*ImagePyramidType
+
+        // Build the Laplacian pyramids of the white and the black
+        // image and blend them level by level.  Only the blended
+        // pyramid survives; it lives in the buffers of the black
+        // pyramid.
+        ConvertScalarToPyramidFunctor<MaskPixelType, MaskPyramidPixelType, MaskPyramidIntegerBits, MaskPyramidFractionBits> whiteMask;
         std::vector<ImagePyramidType*>* blackLP =
-            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
-                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
-                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>("blackGP",
-                                                                         numLevels, wraparoundForBlend,
-                                                                         vigra_ext::apply(roiBB, srcImageRange(*(blackPair.first))),
-                                                                         vigra_ext::apply(roiBB, maskImage(*(blackPair.second))));
+            blendLaplacianPyramids<ImageType, AlphaType, MaskPyramidType, ImagePyramidType,
+                                   ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                                   SKIPSMImagePixelType, SKIPSMAlphaPixelType>(numLevels, wraparoundForBlend,
+                                                                               maskGP,
+                                                                               whiteMask(vigra::NumericTraits<MaskPixelType>::max()),
+                                                                               whiteGP,
+                                                                               vigra_ext::apply(roiBB, maskImage(*(whitePair.second))),
+                                                                               vigra_ext::apply(roiBB, srcImage(*(blackPair.first))),
+                                                                               vigra_ext::apply(roiBB, maskImage(*(blackPair.second))));
+
+        // Peak memory xsection is here!
+        // mem xsection = 2 * (4 * roiBB.width() * SKIPSMImagePixelType
+        //                     + 4 * roiBB.width() * SKIPSMAlphaPixelType)
+        // mem usage peak = anInputUnion*ImageValueType
+        //      + 2*anInputUnion*AlphaValueType
+        //      + (4/3)*roiBB*MaskPyramidType
+        //      + (5/2)*roiBB*ImagePyramidType
+        // mem usage after = anInputUnion*ImageValueType
+        //      + 2*anInputUnion*AlphaValueType
+        //      + (4/3)*roiBB*MaskPyramidType
+        //      + (4/3)*roiBB*ImagePyramidType
 
 #ifdef CACHE_IMAGES
         if (Verbose >= VERBOSE_CFI_MESSAGES) {
             vigra_ext::CachedFileImageDirector& v = vigra_ext::CachedFileImageDirector::v();
             std::cerr << command
-                      << ": info: image cache statistics after calculating black pyramid\n";
+                      << ": info: image cache statistics after blending pyramids\n";
             v.printStats(std::cerr, command + ": info:     blackImage", blackPair.first);
             v.printStats(std::cerr, command + ": info:     blackAlpha", blackPair.second);
             v.printStats(std::cerr, command + ": info:     whiteAlpha", whitePair.second);
             for (unsigned int i = 0; i < maskGP->size(); i++) {
                 v.printStats(std::cerr, command + ": info:     maskGP", i, (*maskGP)[i]);
             }
-            for (unsigned int i = 0; i < whiteLP->size(); i++) {
-                v.printStats(std::cerr, command + ": info:     whiteLP", i, (*whiteLP)[i]);
-            }
             for (unsigned int i = 0; i < blackLP->size(); i++) {
                 v.printStats(std::cerr, command + ": info:     blackLP", i, (*blackLP)[i]);
             }
@@ -499,17 +551,6 @@ void enblendMain(const FileNameList& anInputFileNameList,
         }
 #endif
 
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(blackLP, "enblend_black_lp");
-#endif
-
-        // Peak memory xsection is here!
-        // mem xsection = 4 * roiBB.width() * SKIPSMImagePixelType
-        //                + 4 * roiBB.width() * SKIPSMAlphaPixelType
-        // mem usage after = anInputUnion*ImageValueType + 2*anInputUnion*AlphaValueType
-        //      + (4/3)*roiBB*MaskPyramidType
-        //      + 2*(4/3)*roiBB*ImagePyramidType
-
         // Make the black image alpha equal to the union of the
         // white and black alpha channels.
         vigra::initImageIf(vigra_ext::apply(whiteBB, destImageRange(*(blackPair.second))),
@@ -520,31 +561,7 @@ void enblendMain(const FileNameList& anInputFileNameList,
         delete whitePair.second;
 
         // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType
-        //      + (4/3)*roiBB*MaskPyramidType + 2*(4/3)*roiBB*ImagePyramidType
-
-        // Blend pyramids
-        ConvertScalarToPyramidFunctor<MaskPixelType, MaskPyramidPixelType, MaskPyramidIntegerBits, MaskPyramidFractionBits> whiteMask;
-        blend(maskGP, whiteLP, blackLP, whiteMask(vigra::NumericTraits<MaskPixelType>::max()));
-#ifdef CACHE_IMAGES
-        if (Verbose >= VERBOSE_CFI_MESSAGES) {
-            vigra_ext::CachedFileImageDirector& v = vigra_ext::CachedFileImageDirector::v();
-            std::cerr << command
-                      << ": info: image cache statistics after blending pyramids\n";
-            v.printStats(std::cerr, command + ": info:     blackImage", blackPair.first);
-            v.printStats(std::cerr, command + ": info:     blackAlpha", blackPair.second);
-            for (unsigned int i = 0; i < maskGP->size(); i++) {
-                v.printStats(std::cerr, command + ": info:     maskGP", i, (*maskGP)[i]);
-            }
-            for (unsigned int i = 0; i < whiteLP->size(); i++) {
-                v.printStats(std::cerr, command + ": info:     whiteLP", i, (*whiteLP)[i]);
-            }
-            for (unsigned int i = 0; i < blackLP->size(); i++) {
-                v.printStats(std::cerr, command + ": info:     blackLP", i, (*blackLP)[i]);
-            }
-            v.printStats(std::cerr, command + ": info: ");
-            v.resetCacheMisses();
-        }
-#endif
+        //      + (4/3)*roiBB*MaskPyramidType + (4/3)*roiBB*ImagePyramidType
 
         // delete mask pyramid
 #ifdef DEBUG_EXPORT_PYRAMID
@@ -555,17 +572,6 @@ void enblendMain(const FileNameList& anInputFileNameList,
         }
         delete maskGP;
 
-        // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType + 2*(4/3)*roiBB*ImagePyramidType
-
-        // delete white pyramid
-#ifdef DEBUG_EXPORT_PYRAMID
-        exportPyramid<SKIPSMImagePixelType, ImagePyramidType>(whiteLP, "enblend_white_lp");
-#endif
-        for (unsigned int i = 0; i < whiteLP->size(); i++) {
-            delete (*whiteLP)[i];
-        }
-        delete whiteLP;
-
         // mem usage after = anInputUnion*ImageValueType + anInputUnion*AlphaValueType + (4/3)*roiBB*ImagePyramidType
 
 #ifdef DEBUG_EXPORT_PYRAMID
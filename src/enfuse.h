@@ -24,10 +24,16 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <list>
 #include <map>
+#include <vector>
 
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
@@ -55,6 +61,11 @@
 #include "mga.h"
 
 
+// Default memory budget in MB for the weighted pyramids of images
+// fused concurrently; see numberOfConcurrentFusions().
+#define DEFAULT_FUSION_MEMORY_LIMIT 1024U
+
+
 using boost::lambda::_1;
 using boost::lambda::_2;
 using boost::lambda::bind;
@@ -73,164 +84,196 @@ static inline double gaussDistribution(double x, double mu, double sigma)
 }
 
 
-// Keep sum and sum-of-squares together for improved CPU-cache locality.
-template <typename T>
-struct ScratchPad {
-    ScratchPad() : sum(T()), sumSqr(T()), n(size_t()) {}
+/** Load row y of a masked source image for localStdDevIf(): each
+ *  masked pixel contributes its value and a count of one, every
+ *  other pixel nothing.
+ */
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor>
+inline void
+loadMaskedRow(SrcIterator src_ul, SrcAccessor src_acc,
+              MaskIterator mask_ul, MaskAccessor mask_acc,
+              int y, int width,
+              double* value, double* count)
+{
+    typename SrcIterator::row_iterator src(src_ul + vigra::Diff2D(0, y));
+    typename MaskIterator::row_iterator mask(mask_ul + vigra::Diff2D(0, y));
 
-    T sum;
-    T sumSqr;
-    size_t n;
-};
+    for (int x = 0; x < width; ++x, ++src, ++mask) {
+        if (mask_acc(mask)) {
+            value[x] = static_cast<double>(src_acc(src));
+            count[x] = 1.0;
+        } else {
+            value[x] = 0.0;
+            count[x] = 0.0;
+        }
+    }
+}
 
 
-template <class SrcIterator, class SrcAccessor,
-          class MaskIterator, class MaskAccessor,
-          class DestIterator, class DestAccessor>
-void localStdDevIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
-                   MaskIterator mask_ul, MaskAccessor mask_acc,
-                   DestIterator dest_ul, DestAccessor dest_acc,
-                   vigra::Size2D size)
+/** Load row y for localStdDevIf() from a color source that is read
+ *  through a grayscale projector.  The whole row is projected into
+ *  the value buffer first, so that the projector is resolved once
+ *  per row instead of once per pixel, and no grayscale copy of the
+ *  image is needed.
+ */
+template <class SrcIterator, typename InputType, typename ResultType,
+          class MaskIterator, class MaskAccessor>
+inline void
+loadMaskedRow(SrcIterator src_ul, const MultiGrayscaleAccessor<InputType, ResultType>& src_acc,
+              MaskIterator mask_ul, MaskAccessor mask_acc,
+              int y, int width,
+              double* value, double* count)
 {
-    typedef typename vigra::NumericTraits<typename SrcAccessor::value_type>::RealPromote SrcSumType;
-    typedef vigra::NumericTraits<typename DestAccessor::value_type> DestTraits;
-    typedef typename SrcIterator::PixelType SrcPixelType;
-    typedef typename SrcIterator::row_iterator SrcRowIterator;
-    typedef typename MaskIterator::row_iterator MaskRowIterator;
-    typedef typename DestIterator::PixelType DestPixelType;
-    typedef ScratchPad<SrcSumType> ScratchPadType;
-    typedef std::vector<ScratchPadType> ScratchPadArray;
-    typedef typename ScratchPadArray::iterator ScratchPadArrayIterator;
-
-    vigra_precondition(size.x > 1 && size.y > 1,
-                       "localStdDevIf(): window for local variance must be at least 2x2");
-    vigra_precondition(src_lr.x - src_ul.x >= size.x &&
-                       src_lr.y - src_ul.y >= size.y,
-                       "localStdDevIf(): window larger than image");
+    typename SrcIterator::row_iterator src(src_ul + vigra::Diff2D(0, y));
+    typename MaskIterator::row_iterator mask(mask_ul + vigra::Diff2D(0, y));
 
-    const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
-    ScratchPadArray scratchPad(imageSize.x + 1);
+    src_acc.projectRow(src, src + width, vigra::StandardConstValueAccessor<InputType>(),
+                       value, vigra::StandardValueAccessor<double>());
 
-    const vigra::Diff2D border(size.x / 2, size.y / 2);
-    const vigra::Diff2D nextUpperRight(size.x / 2 + 1, -size.y / 2);
+    for (int x = 0; x < width; ++x, ++mask) {
+        if (mask_acc(mask)) {
+            count[x] = 1.0;
+        } else {
+            value[x] = 0.0;
+            count[x] = 0.0;
+        }
+    }
+}
 
-    SrcIterator const srcEnd(src_lr - border);
-    SrcIterator const srcEndXm1(srcEnd - vigra::Diff2D(1, 0));
 
-    // For each row in the source image...
-#ifdef OPENMP
-#pragma omp parallel for firstprivate (scratchPad)
-#endif
-    for (int row = 0; row < imageSize.y - 2 * border.y; ++row)
-    {
-        SrcIterator srcRow(src_ul + border + vigra::Diff2D(0, row));
-        MaskIterator maskRow(mask_ul + border + vigra::Diff2D(0, row));
-        DestIterator destRow(dest_ul + border + vigra::Diff2D(0, row));
-
-        // Row's running values
-        SrcSumType sum = vigra::NumericTraits<SrcSumType>::zero();
-        SrcSumType sumSqr = vigra::NumericTraits<SrcSumType>::zero();
-        size_t n = 0;
-
-        SrcIterator const windowSrcUpperLeft(srcRow - border);
-        SrcIterator const windowSrcLowerRight(srcRow + border);
-        SrcIterator windowSrc;
-        MaskIterator const windowMaskUpperLeft(maskRow - border);
-        MaskIterator windowMask;
-        ScratchPadArrayIterator spCol;
-
-        // Initialize running-sums of this row
-        for (windowSrc = windowSrcUpperLeft, windowMask = windowMaskUpperLeft,
-                 spCol = scratchPad.begin();
-             windowSrc.x <= windowSrcLowerRight.x;
-             ++windowSrc.x, ++windowMask.x, ++spCol)
-        {
-            SrcSumType sumInit = vigra::NumericTraits<SrcSumType>::zero();
-            SrcSumType sumSqrInit = vigra::NumericTraits<SrcSumType>::zero();
-            size_t nInit = 0;
+/** Compute the local standard deviation of rows [row_begin, row_end)
+ *  of the interior of the image; see localStdDevIf().
+ *
+ *  We keep the sums of x, x^2, and the number of masked pixels of
+ *  each column over the window's rows.  Moving down one row adds the
+ *  entering row and subtracts the leaving one, which is a
+ *  branch-free, vectorizable loop across the row.  Sliding the window
+ *  along the row then adds one column sum and subtracts another.
+ *  Thus, the cost per pixel does not depend on the window size.
+ */
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          class DestIterator, class DestAccessor>
+void localStdDevBand(SrcIterator src_ul, SrcAccessor src_acc,
+                     MaskIterator mask_ul, MaskAccessor mask_acc,
+                     DestIterator dest_ul, DestAccessor dest_acc,
+                     int width, vigra::Diff2D border,
+                     int row_begin, int row_end)
+{
+    typedef vigra::NumericTraits<typename DestAccessor::value_type> DestTraits;
 
-            for (windowSrc.y = windowSrcUpperLeft.y, windowMask.y = windowMaskUpperLeft.y;
-                 windowSrc.y <= windowSrcLowerRight.y;
-                 ++windowSrc.y, ++windowMask.y)
-            {
-                if (mask_acc(windowMask))
-                {
-                    const SrcSumType value = src_acc(windowSrc);
-                    sumInit += value;
-                    sumSqrInit += square(value);
-                    ++nInit;
-                }
-            }
+    std::vector<double> columnSum(width, 0.0);
+    std::vector<double> columnSumSqr(width, 0.0);
+    std::vector<double> columnN(width, 0.0);
+    std::vector<double> enteringValue(width);
+    std::vector<double> enteringN(width);
+    std::vector<double> leavingValue(width);
+    std::vector<double> leavingN(width);
+
+    // Output row r has the source rows r to r + 2 * border.y in its
+    // window.
+    for (int y = row_begin; y < row_begin + 2 * border.y; ++y) {
+        loadMaskedRow(src_ul, src_acc, mask_ul, mask_acc, y, width, &enteringValue[0], &enteringN[0]);
+        for (int x = 0; x < width; ++x) {
+            columnSum[x] += enteringValue[x];
+            columnSumSqr[x] += enteringValue[x] * enteringValue[x];
+            columnN[x] += enteringN[x];
+        }
+    }
 
-            // Set scratch pad's column-wise values
-            spCol->sum = sumInit;
-            spCol->sumSqr = sumSqrInit;
-            spCol->n = nInit;
+    for (int row = row_begin; row < row_end; ++row) {
+        loadMaskedRow(src_ul, src_acc, mask_ul, mask_acc, row + 2 * border.y, width,
+                      &enteringValue[0], &enteringN[0]);
+        if (row == row_begin) {
+            std::fill(leavingValue.begin(), leavingValue.end(), 0.0);
+            std::fill(leavingN.begin(), leavingN.end(), 0.0);
+        } else {
+            loadMaskedRow(src_ul, src_acc, mask_ul, mask_acc, row - 1, width,
+                          &leavingValue[0], &leavingN[0]);
+        }
 
-            // Update totals
-            sum += sumInit;
-            sumSqr += sumSqrInit;
-            n += nInit;
+        for (int x = 0; x < width; ++x) {
+            columnSum[x] += enteringValue[x] - leavingValue[x];
+            columnSumSqr[x] += enteringValue[x] * enteringValue[x] - leavingValue[x] * leavingValue[x];
+            columnN[x] += enteringN[x] - leavingN[x];
         }
 
-        // Write one row of results
-        SrcIterator srcCol(srcRow);
-        MaskIterator maskCol(maskRow);
-        DestIterator destCol(destRow);
-        ScratchPadArrayIterator old(scratchPad.begin());
-        ScratchPadArrayIterator next(scratchPad.begin() + size.x);
+        // Window sums of the first output pixel of this row
+        double sum = 0.0;
+        double sumSqr = 0.0;
+        double n = 0.0;
+        for (int x = 0; x <= 2 * border.x; ++x) {
+            sum += columnSum[x];
+            sumSqr += columnSumSqr[x];
+            n += columnN[x];
+        }
 
-        while (true)
-        {
-            // Compute standard deviation
-            if (mask_acc(maskCol))
-            {
-                const SrcSumType result =
-                    n <= 1 ?
-                    vigra::NumericTraits<SrcSumType>::zero() :
-                    sqrt((sumSqr - square(sum) / n) / (n - 1));
+        MaskIterator maskCol(mask_ul + border + vigra::Diff2D(0, row));
+        DestIterator destCol(dest_ul + border + vigra::Diff2D(0, row));
+        const int lastColumn = width - 2 * border.x - 1;
+
+        for (int column = 0; ; ++column, ++maskCol.x, ++destCol.x) {
+            if (mask_acc(maskCol)) {
+                // Rounding may drive the variance slightly negative
+                // for constant windows of non-integral values.
+                const double result =
+                    n <= 1.0 ?
+                    0.0 :
+                    sqrt(std::max(0.0, (sumSqr - square(sum) / n) / (n - 1.0)));
                 dest_acc.set(DestTraits::fromRealPromote(result), destCol);
             }
-            if (srcCol.x == srcEndXm1.x)
-            {
+            if (column == lastColumn) {
                 break;
             }
 
-            // Compute auxilliary values of next column
-            SrcSumType sumInit = vigra::NumericTraits<SrcSumType>::zero();
-            SrcSumType sumSqrInit = vigra::NumericTraits<SrcSumType>::zero();
-            size_t nInit = 0;
+            sum += columnSum[column + 2 * border.x + 1] - columnSum[column];
+            sumSqr += columnSumSqr[column + 2 * border.x + 1] - columnSumSqr[column];
+            n += columnN[column + 2 * border.x + 1] - columnN[column];
+        }
+    }
+}
 
-            for (windowSrc = srcCol + nextUpperRight, windowMask = maskCol + nextUpperRight;
-                 windowSrc.y <= windowSrcLowerRight.y;
-                 ++windowSrc.y, ++windowMask.y)
-            {
-                if (mask_acc(windowMask))
-                {
-                    const SrcSumType value = src_acc(windowSrc);
-                    sumInit += value;
-                    sumSqrInit += square(value);
-                    ++nInit;
-                }
-            }
 
-            // Set sums of next column
-            next->sum = sumInit;
-            next->sumSqr = sumSqrInit;
-            next->n = nInit;
+/** Compute the standard deviation of all masked pixels in a window
+ *  of (size.x / 2) * 2 + 1 times (size.y / 2) * 2 + 1 pixels around
+ *  each masked pixel of the image's interior.  The cost per pixel
+ *  is constant, whatever the size of the window.
+ */
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          class DestIterator, class DestAccessor>
+void localStdDevIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
+                   MaskIterator mask_ul, MaskAccessor mask_acc,
+                   DestIterator dest_ul, DestAccessor dest_acc,
+                   vigra::Size2D size)
+{
+    vigra_precondition(size.x > 1 && size.y > 1,
+                       "localStdDevIf(): window for local variance must be at least 2x2");
+    vigra_precondition(src_lr.x - src_ul.x >= size.x &&
+                       src_lr.y - src_ul.y >= size.y,
+                       "localStdDevIf(): window larger than image");
 
-            // Update totals
-            sum += sumInit - old->sum;
-            sumSqr += sumSqrInit - old->sumSqr;
-            n += nInit - old->n;
+    const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
+    const vigra::Diff2D border(size.x / 2, size.y / 2);
 
-            // Advance to next column
-            ++srcCol.x;
-            ++maskCol.x;
-            ++destCol.x;
-            ++old;
-            ++next;
-        }
+    if (imageSize.x <= 2 * border.x || imageSize.y <= 2 * border.y) {
+        return;
+    }
+
+    // Each band primes its column sums with the rows of one window,
+    // so bands should be considerably taller than the window.
+    const int rows = imageSize.y - 2 * border.y;
+    const int minimumBandHeight = std::max(MIN_PYRAMID_BAND_HEIGHT, 4 * (2 * border.y + 1));
+    const int bands = std::max(1, std::min(numberOfPyramidBands(rows), rows / minimumBandHeight));
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static) if (bands > 1)
+#endif
+    for (int band = 0; band < bands; ++band) {
+        localStdDevBand(src_ul, src_acc, mask_ul, mask_acc, dest_ul, dest_acc,
+                        imageSize.x, border,
+                        band * rows / bands, (band + 1) * rows / bands);
     }
 }
 
@@ -297,6 +340,10 @@ public:
         }
     }
 
+    static size_t precomputedEntropySize() {return precomputedSize;}
+    static double precomputedLogOf(size_t i) {return precomputedLog[i];}
+    static double precomputedEntropyOf(size_t i) {return precomputedEntropy[i];}
+
     Histogram& operator=(const Histogram& other) {
         if (this != &other)
         {
@@ -471,13 +518,186 @@ private:
 };
 
 
+/** Number of bins of a FlatHistogram for pixels with the given
+ *  channel type.  Only 8- and 16-bit integral channels get a flat
+ *  histogram; the latter are quantized to 4096 bins.
+ */
+template <typename KeyType>
+struct FlatHistogramTraits
+{
+    typedef vigra::VigraFalseType isFlat;
+    enum {shift = 0, bins = 1};
+};
+
+template <>
+struct FlatHistogramTraits<vigra::Int8>
+{
+    typedef vigra::VigraTrueType isFlat;
+    enum {shift = 0, bins = 256};
+};
+
+template <>
+struct FlatHistogramTraits<vigra::UInt8>
+{
+    typedef vigra::VigraTrueType isFlat;
+    enum {shift = 0, bins = 256};
+};
+
+template <>
+struct FlatHistogramTraits<vigra::Int16>
+{
+    typedef vigra::VigraTrueType isFlat;
+    enum {shift = 4, bins = 4096};
+};
+
+template <>
+struct FlatHistogramTraits<vigra::UInt16>
+{
+    typedef vigra::VigraTrueType isFlat;
+    enum {shift = 4, bins = 4096};
+};
+
+
+/** Histogram with a fixed array of bins per channel.
+ *
+ *  Inserting or erasing a pixel costs a constant amount of time.
+ *  Instead of walking all bins, entropy() uses the sum of
+ *  precomputedEntropy over the bins, which every insertion and
+ *  erasure updates, together with the number of occupied bins.  It
+ *  shares the precomputed tables of Histogram, which must cover the
+ *  largest number of pixels ever inserted.
+ */
+template <typename InputPixelType, typename ResultPixelType>
+class FlatHistogram
+{
+    enum {GRAY = 0, CHANNELS = 3};
+
+public:
+    typedef Histogram<InputPixelType, ResultPixelType> TablesType;
+    typedef vigra::NumericTraits<InputPixelType> InputPixelTraits;
+    typedef typename InputPixelTraits::ValueType KeyType;
+    typedef typename InputPixelTraits::isScalar pixelIsScalar;
+    typedef unsigned DataType;
+    typedef vigra::NumericTraits<ResultPixelType> ResultPixelTraits;
+    typedef typename ResultPixelTraits::ValueType ResultType;
+    typedef FlatHistogramTraits<KeyType> BinTraits;
+
+    FlatHistogram() : count(CHANNELS * BinTraits::bins) {clear();}
+
+    void clear() {
+        std::fill(count.begin(), count.end(), DataType());
+        for (int channel = 0; channel < CHANNELS; ++channel) {
+            totalCount[channel] = DataType();
+            occupiedBins[channel] = DataType();
+            entropySum[channel] = 0.0;
+        }
+    }
+
+    void insert(const InputPixelType& x) {insertFun(x, pixelIsScalar());}
+    void erase(const InputPixelType& x) {eraseFun(x, pixelIsScalar());}
+
+    ResultPixelType entropy() const {return entropyFun(pixelIsScalar());}
+
+protected:
+    static int bin(KeyType key) {
+        return (static_cast<int>(key) - static_cast<int>(vigra::NumericTraits<KeyType>::min())) >> BinTraits::shift;
+    }
+
+    void insertInChannel(int channel, KeyType key) {
+        DataType& c = count[channel * BinTraits::bins + bin(key)];
+        entropySum[channel] += TablesType::precomputedEntropyOf(c + 1U) - TablesType::precomputedEntropyOf(c);
+        if (c == 0U) {
+            ++occupiedBins[channel];
+        }
+        ++c;
+        ++totalCount[channel];
+    }
+
+    void eraseInChannel(int channel, KeyType key) {
+        DataType& c = count[channel * BinTraits::bins + bin(key)];
+        assert(c != 0U);
+        entropySum[channel] += TablesType::precomputedEntropyOf(c - 1U) - TablesType::precomputedEntropyOf(c);
+        --c;
+        if (c == 0U) {
+            --occupiedBins[channel];
+        }
+        --totalCount[channel];
+    }
+
+    double entropyOfChannel(int channel) const {
+        const DataType total = totalCount[channel];
+        const DataType bins = occupiedBins[channel];
+        if (total == 0 || bins <= 1)
+        {
+            return 0.0;
+        }
+
+        // With size = precomputedEntropySize() the sum of
+        // precomputedEntropy over all bins is
+        //     E = 1/size * sum(c * log(c)) - total/size * log(size),
+        // which we convert to sum(p * log(p)) for p = c/total.
+        // entropySum accumulates differences of table entries, so
+        // the result may differ from the direct summation of
+        // Histogram in the last bits, which can change the rounded
+        // ResultPixelType by one unit.
+        const size_t size = TablesType::precomputedEntropySize();
+        const double e =
+            total == size ?
+            entropySum[channel] :
+            (static_cast<double>(size) * entropySum[channel] +
+             static_cast<double>(total) * TablesType::precomputedLogOf(size)) / static_cast<double>(total) -
+            TablesType::precomputedLogOf(total);
+
+        return -e / TablesType::precomputedLogOf(bins);
+    }
+
+    // Grayscale
+    void insertFun(const InputPixelType& x, vigra::VigraTrueType) {insertInChannel(GRAY, x);}
+    void eraseFun(const InputPixelType& x, vigra::VigraTrueType) {eraseInChannel(GRAY, x);}
+
+    ResultPixelType entropyFun(vigra::VigraTrueType) const {
+        const double max = static_cast<double>(vigra::NumericTraits<KeyType>::max());
+        return ResultPixelType(ResultPixelTraits::fromRealPromote(entropyOfChannel(GRAY) * max));
+    }
+
+    // RGB
+    void insertFun(const InputPixelType& x, vigra::VigraFalseType) {
+        for (int channel = 0; channel < CHANNELS; ++channel) {
+            insertInChannel(channel, x[channel]);
+        }
+    }
+
+    void eraseFun(const InputPixelType& x, vigra::VigraFalseType) {
+        for (int channel = 0; channel < CHANNELS; ++channel) {
+            eraseInChannel(channel, x[channel]);
+        }
+    }
+
+    ResultPixelType entropyFun(vigra::VigraFalseType) const {
+        const double max = static_cast<double>(vigra::NumericTraits<KeyType>::max());
+        return ResultPixelType(vigra::NumericTraits<ResultType>::fromRealPromote(entropyOfChannel(0) * max),
+                               vigra::NumericTraits<ResultType>::fromRealPromote(entropyOfChannel(1) * max),
+                               vigra::NumericTraits<ResultType>::fromRealPromote(entropyOfChannel(2) * max));
+    }
+
+private:
+    std::vector<DataType> count;
+    DataType totalCount[CHANNELS];
+    DataType occupiedBins[CHANNELS];
+    double entropySum[CHANNELS];
+};
+
+
+// General pixel types: sliding histograms of rows, which are merged
+// into the histogram of the window.
 template <class SrcIterator, class SrcAccessor,
           class MaskIterator, class MaskAccessor,
           class DestIterator, class DestAccessor>
 void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
                     MaskIterator mask_ul, MaskAccessor mask_acc,
                     DestIterator dest_ul, DestAccessor dest_acc,
-                    vigra::Size2D size)
+                    vigra::Size2D size,
+                    vigra::VigraFalseType)
 {
     typedef vigra::NumericTraits<typename DestAccessor::value_type> DestTraits;
     typedef typename SrcIterator::PixelType SrcPixelType;
@@ -493,9 +713,9 @@ void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
     const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
     ScratchPadType* const scratchPad = new ScratchPadType[imageSize.y + 1];
 
-    ScratchPadType::setPrecomputedEntropySize(size.x * size.y);
-
     const vigra::Diff2D border(size.x / 2, size.y / 2);
+    ScratchPadType::setPrecomputedEntropySize((2 * border.x + 1) * (2 * border.y + 1));
+
     const vigra::Diff2D deltaX(size.x / 2, 0);
     const vigra::Diff2D deltaXp1(size.x / 2 + 1, 0);
     const vigra::Diff2D deltaY(0, size.y / 2);
@@ -585,6 +805,123 @@ void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
 }
 
 
+// 8- and 16-bit pixel types: each row slides its own flat histogram
+// of the whole window along, so rows are independent of each other
+// and we process them in parallel.
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          class DestIterator, class DestAccessor>
+void localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
+                    MaskIterator mask_ul, MaskAccessor mask_acc,
+                    DestIterator dest_ul, DestAccessor dest_acc,
+                    vigra::Size2D size,
+                    vigra::VigraTrueType)
+{
+    typedef typename SrcIterator::PixelType SrcPixelType;
+    typedef typename DestIterator::PixelType DestPixelType;
+    typedef FlatHistogram<SrcPixelType, DestPixelType> HistogramType;
+
+    vigra_precondition(src_lr.x - src_ul.x >= size.x &&
+                       src_lr.y - src_ul.y >= size.y,
+                       "localEntropyIf(): window larger than image");
+
+    const typename SrcIterator::difference_type imageSize = src_lr - src_ul;
+    const vigra::Diff2D border(size.x / 2, size.y / 2);
+    const vigra::Diff2D deltaX(border.x, 0);
+    const vigra::Diff2D deltaXp1(border.x + 1, 0);
+
+    if (imageSize.x <= 2 * border.x)
+    {
+        return;
+    }
+
+    HistogramType::TablesType::setPrecomputedEntropySize((2 * border.x + 1) * (2 * border.y + 1));
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+    {
+        HistogramType hist;
+
+#ifdef OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int y = border.y; y < imageSize.y - border.y; ++y)
+        {
+            // Initialize the window of the first pixel of this row.
+            hist.clear();
+            for (int dy = -border.y; dy <= border.y; ++dy)
+            {
+                SrcIterator src(src_ul + vigra::Diff2D(0, y + dy));
+                MaskIterator mask(mask_ul + vigra::Diff2D(0, y + dy));
+                for (int x = 0; x <= 2 * border.x; ++x, ++src.x, ++mask.x)
+                {
+                    if (mask_acc(mask))
+                    {
+                        hist.insert(src_acc(src));
+                    }
+                }
+            }
+
+            SrcIterator srcCol(src_ul + vigra::Diff2D(border.x, y - border.y));
+            MaskIterator maskCol(mask_ul + vigra::Diff2D(border.x, y - border.y));
+            MaskIterator maskCenter(mask_ul + vigra::Diff2D(border.x, y));
+            DestIterator destCol(dest_ul + vigra::Diff2D(border.x, y));
+            const int lastX = imageSize.x - border.x - 1;
+
+            for (int x = border.x; ; ++x, ++srcCol.x, ++maskCol.x, ++maskCenter.x, ++destCol.x)
+            {
+                if (mask_acc(maskCenter))
+                {
+                    dest_acc.set(hist.entropy(), destCol);
+                }
+                if (x == lastX)
+                {
+                    break;
+                }
+
+                // Slide the window one column to the right.
+                SrcIterator src(srcCol);
+                MaskIterator mask(maskCol);
+                for (int dy = -border.y; dy <= border.y; ++dy, ++src.y, ++mask.y)
+                {
+                    if (mask_acc(mask - deltaX))
+                    {
+                        hist.erase(src_acc(src - deltaX)); // remove oldest column
+                    }
+                    if (mask_acc(mask + deltaXp1))
+                    {
+                        hist.insert(src_acc(src + deltaXp1)); // add next column
+                    }
+                }
+            }
+        }
+    } // omp parallel
+
+    HistogramType::TablesType::setPrecomputedEntropySize(0);
+}
+
+
+template <class SrcIterator, class SrcAccessor,
+          class MaskIterator, class MaskAccessor,
+          class DestIterator, class DestAccessor>
+inline void
+localEntropyIf(SrcIterator src_ul, SrcIterator src_lr, SrcAccessor src_acc,
+               MaskIterator mask_ul, MaskAccessor mask_acc,
+               DestIterator dest_ul, DestAccessor dest_acc,
+               vigra::Size2D size)
+{
+    typedef typename vigra::NumericTraits<typename SrcIterator::PixelType>::ValueType KeyType;
+    typedef typename FlatHistogramTraits<KeyType>::isFlat HistogramIsFlat;
+
+    localEntropyIf(src_ul, src_lr, src_acc,
+                   mask_ul, mask_acc,
+                   dest_ul, dest_acc,
+                   size,
+                   HistogramIsFlat());
+}
+
+
 template <typename SrcIterator, typename SrcAccessor,
           typename MaskIterator, typename MaskAccessor,
           typename DestIterator, typename DestAccessor>
@@ -639,40 +976,119 @@ protected:
 };
 
 
+/** Exposure weights of all gray levels of a ValueType that has at
+ *  most EnblendNumericTraits::ImagePixelComponentLevels values, so
+ *  that the exposure functors need no exp() per pixel.  Gray levels
+ *  outside of [lower, upper] get zero weight.
+ */
+template <typename ValueType, typename ResultType>
+class ExposureLookupTable
+{
+public:
+    enum {levels = EnblendNumericTraits<ValueType>::ImagePixelComponentLevels};
+
+    ExposureLookupTable(double weight, double mu, double sigma, double lower, double upper) :
+        table(levels)
+    {
+        const double minimum = static_cast<double>(vigra::NumericTraits<ValueType>::min());
+        const double b = vigra::NumericTraits<ValueType>::max() * mu;
+        const double c = vigra::NumericTraits<ValueType>::max() * sigma;
+
+        for (int i = 0; i < levels; ++i) {
+            const double x = minimum + static_cast<double>(i);
+            table[i] =
+                x >= lower && x <= upper ?
+                vigra::NumericTraits<ResultType>::fromRealPromote(weight * gaussDistribution(x, b, c)) :
+                ResultType();
+        }
+    }
+
+    ResultType operator[](ValueType x) const {
+        return table[static_cast<int>(x) - static_cast<int>(vigra::NumericTraits<ValueType>::min())];
+    }
+
+private:
+    std::vector<ResultType> table;
+};
+
+
+// Select the lookup-table path of the exposure functors at compile
+// time.
+template <typename ValueType>
+struct HasExposureLookupTable
+{
+    typedef typename LookupTableSelector<EnblendNumericTraits<ValueType>::ImagePixelComponentLevels>::type type;
+};
+
+
 template <typename InputType, typename InputAccessor, typename ResultType>
 class ExposureFunctor {
 public:
     typedef ResultType result_type;
+    typedef typename InputAccessor::value_type GrayType;
 
     ExposureFunctor(double w, double m, double s, InputAccessor a) :
-        weight(w), mu(m), sigma(s), acc(a) {}
+        weight(w), mu(m), sigma(s), acc(a),
+        lookupTable(w, m, s,
+                    -std::numeric_limits<double>::max(), std::numeric_limits<double>::max()) {}
 
     inline ResultType operator()(const InputType& a) const {
         typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
         return f(a, srcIsScalar());
     }
 
+    // Number of rows of gray levels that projectRow() fills
+    enum {grayRows = 1};
+
+    // Project the row [first, last) to the gray levels the weights
+    // depend on.
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa, GrayType* gray) const {
+        acc.projectRow(first, last, sa, gray, vigra::StandardValueAccessor<GrayType>());
+    }
+
+    // Weight of pixel x of a row of the given width that
+    // projectRow() has projected into gray
+    inline ResultType rowWeight(const GrayType* gray, int x, int) const {
+        return g(gray[x], hasLookupTable());
+    }
+
 protected:
+    typedef typename HasExposureLookupTable<GrayType>::type hasLookupTable;
+
     // grayscale
     template <typename T>
     inline ResultType f(const T& a, vigra::VigraTrueType) const {
-        typedef typename vigra::NumericTraits<T>::RealPromote RealType;
-        const RealType ra = vigra::NumericTraits<T>::toRealPromote(a);
-        const double b = vigra::NumericTraits<T>::max() * mu;
-        const double c = vigra::NumericTraits<T>::max() * sigma;
-        return vigra::NumericTraits<ResultType>::fromRealPromote(weight * gaussDistribution(ra, b, c));
+        return g(a, hasLookupTable());
     }
 
     // RGB
     template <typename T>
     inline ResultType f(const T& a, vigra::VigraFalseType) const {
-        return f(acc.operator()(a), vigra::VigraTrueType());
+        return g(acc.operator()(a), hasLookupTable());
+    }
+
+    // gray level, tabulated
+    template <typename T>
+    inline ResultType g(const T& a, vigra::VigraTrueType) const {
+        return lookupTable[a];
+    }
+
+    // gray level, computed
+    template <typename T>
+    inline ResultType g(const T& a, vigra::VigraFalseType) const {
+        typedef typename vigra::NumericTraits<T>::RealPromote RealType;
+        const RealType ra = vigra::NumericTraits<T>::toRealPromote(a);
+        const double b = vigra::NumericTraits<T>::max() * mu;
+        const double c = vigra::NumericTraits<T>::max() * sigma;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(weight * gaussDistribution(ra, b, c));
     }
 
     const double weight;
     const double mu;
     const double sigma;
     InputAccessor acc;
+    const ExposureLookupTable<GrayType, ResultType> lookupTable;
 };
 
 
@@ -680,6 +1096,7 @@ template <typename InputType, typename InputAccessor, typename ResultType>
 class CutoffExposureFunctor {
 public:
     typedef ResultType result_type;
+    typedef typename InputAccessor::value_type GrayType;
 
     CutoffExposureFunctor(double w, double m, double s, InputAccessor a,
                           const AlternativePercentage& lc, const AlternativePercentage& uc,
@@ -687,7 +1104,12 @@ public:
         weight(w), mu(m), sigma(s), acc(a),
         lower_cutoff(lc.instantiate<typename InputAccessor::value_type>()),
         upper_cutoff(uc.instantiate<typename InputAccessor::value_type>()),
-        lower_acc(lca), upper_acc(uca)
+        lower_acc(lca), upper_acc(uca),
+        // Grayscale images apply the cutoffs to the very gray level
+        // the weight depends on, so the table includes them.
+        lookupTable(w, m, s,
+                    vigra::NumericTraits<InputType>::isScalar::asBool ? lower_cutoff : -std::numeric_limits<double>::max(),
+                    vigra::NumericTraits<InputType>::isScalar::asBool ? upper_cutoff : std::numeric_limits<double>::max())
     {
         typedef typename InputAccessor::value_type value_type;
 
@@ -709,10 +1131,77 @@ public:
         return f(a, srcIsScalar());
     }
 
+    // Number of rows of gray levels that projectRow() fills: the
+    // weight's projection and, for RGB, the lower and upper cutoff
+    // projections
+    enum {grayRows = 3};
+
+    // Project the row [first, last) to the gray levels the weights
+    // and the cutoffs depend on.
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa, GrayType* gray) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        projectRow(first, last, sa, gray, srcIsScalar());
+    }
+
+    // Weight of pixel x of a row of the given width that
+    // projectRow() has projected into gray
+    inline ResultType rowWeight(const GrayType* gray, int x, int width) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        return rowWeight(gray, x, width, srcIsScalar());
+    }
+
 protected:
+    typedef typename HasExposureLookupTable<GrayType>::type hasLookupTable;
+
+    // grayscale
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa, GrayType* gray,
+                    vigra::VigraTrueType) const {
+        acc.projectRow(first, last, sa, gray, vigra::StandardValueAccessor<GrayType>());
+    }
+
+    // RGB
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa, GrayType* gray,
+                    vigra::VigraFalseType) const {
+        const int width = static_cast<int>(last - first);
+        acc.projectRow(first, last, sa, gray, vigra::StandardValueAccessor<GrayType>());
+        lower_acc.projectRow(first, last, sa, gray + width, vigra::StandardValueAccessor<GrayType>());
+        upper_acc.projectRow(first, last, sa, gray + 2 * width, vigra::StandardValueAccessor<GrayType>());
+    }
+
+    // grayscale
+    inline ResultType rowWeight(const GrayType* gray, int x, int, vigra::VigraTrueType) const {
+        return g(gray[x], hasLookupTable());
+    }
+
+    // RGB
+    inline ResultType rowWeight(const GrayType* gray, int x, int width, vigra::VigraFalseType) const {
+        typedef vigra::NumericTraits<GrayType> GrayTraits;
+        if (GrayTraits::toRealPromote(gray[width + x]) >= lower_cutoff &&
+            GrayTraits::toRealPromote(gray[2 * width + x]) <= upper_cutoff) {
+            return h(gray[x], hasLookupTable());
+        } else {
+            return ResultType();
+        }
+    }
+
     // grayscale
     template <typename T>
     inline ResultType f(const T& a, vigra::VigraTrueType) const {
+        return g(a, hasLookupTable());
+    }
+
+    // grayscale, tabulated
+    template <typename T>
+    inline ResultType g(const T& a, vigra::VigraTrueType) const {
+        return lookupTable[a];
+    }
+
+    // grayscale, computed
+    template <typename T>
+    inline ResultType g(const T& a, vigra::VigraFalseType) const {
         typedef typename vigra::NumericTraits<T>::RealPromote RealType;
         const RealType ra = vigra::NumericTraits<T>::toRealPromote(a);
         if (ra >= lower_cutoff && ra <= upper_cutoff) {
@@ -729,18 +1218,31 @@ protected:
     inline ResultType f(const T& a, vigra::VigraFalseType) const {
         typedef typename T::value_type ValueType;
         typedef typename vigra::NumericTraits<ValueType>::RealPromote RealType;
-        const RealType ra = vigra::NumericTraits<ValueType>::toRealPromote(acc.operator()(a));
         const RealType lower_ra = vigra::NumericTraits<ValueType>::toRealPromote(lower_acc.operator()(a));
         const RealType upper_ra = vigra::NumericTraits<ValueType>::toRealPromote(upper_acc.operator()(a));
         if (lower_ra >= lower_cutoff && upper_ra <= upper_cutoff) {
-            const double b = vigra::NumericTraits<ValueType>::max() * mu;
-            const double c = vigra::NumericTraits<ValueType>::max() * sigma;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(weight * gaussDistribution(ra, b, c));
+            return h(acc.operator()(a), hasLookupTable());
         } else {
             return ResultType();
         }
     }
 
+    // RGB weight without cutoffs, tabulated
+    template <typename T>
+    inline ResultType h(const T& a, vigra::VigraTrueType) const {
+        return lookupTable[a];
+    }
+
+    // RGB weight without cutoffs, computed
+    template <typename T>
+    inline ResultType h(const T& a, vigra::VigraFalseType) const {
+        typedef typename vigra::NumericTraits<T>::RealPromote RealType;
+        const RealType ra = vigra::NumericTraits<T>::toRealPromote(a);
+        const double b = vigra::NumericTraits<T>::max() * mu;
+        const double c = vigra::NumericTraits<T>::max() * sigma;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(weight * gaussDistribution(ra, b, c));
+    }
+
     const double weight;
     const double mu;
     const double sigma;
@@ -749,6 +1251,7 @@ protected:
     const double upper_cutoff;
     InputAccessor lower_acc;
     InputAccessor upper_acc;
+    const ExposureLookupTable<GrayType, ResultType> lookupTable;
 };
 
 
@@ -756,15 +1259,60 @@ template <typename InputType, typename ResultType>
 class SaturationFunctor {
 public:
     typedef ResultType result_type;
+    typedef typename vigra::NumericTraits<InputType>::ValueType GrayType;
 
-    SaturationFunctor(double w) : weight(w) {}
+    SaturationFunctor(double w) : weight(w), max_acc("value"), min_acc("anti-value") {}
 
     inline ResultType operator()(const InputType& a) const {
         typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
         return f(a, srcIsScalar());
     }
 
+    // Number of rows of gray levels that projectRow() fills: the
+    // maximum and the minimum channel of each pixel
+    enum {grayRows = 2};
+
+    // Project the row [first, last) to the gray levels the
+    // saturation depends on.
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa, GrayType* gray) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        projectRow(first, last, sa, gray, srcIsScalar());
+    }
+
+    // Saturation weight of pixel x of a row of the given width that
+    // projectRow() has projected into gray
+    inline ResultType rowWeight(const GrayType* gray, int x, int width) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        return rowWeight(gray, x, width, srcIsScalar());
+    }
+
 protected:
+    typedef MultiGrayscaleAccessor<InputType, GrayType> GrayAccessor;
+
+    // grayscale
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator, SrcIterator, SrcAccessor, GrayType*, vigra::VigraTrueType) const {}
+
+    // RGB
+    template <typename SrcIterator, typename SrcAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa, GrayType* gray,
+                    vigra::VigraFalseType) const {
+        max_acc.projectRow(first, last, sa, gray, vigra::StandardValueAccessor<GrayType>());
+        min_acc.projectRow(first, last, sa, gray + static_cast<int>(last - first),
+                           vigra::StandardValueAccessor<GrayType>());
+    }
+
+    // grayscale
+    inline ResultType rowWeight(const GrayType*, int, int, vigra::VigraTrueType) const {
+        return vigra::NumericTraits<ResultType>::zero();
+    }
+
+    // RGB
+    inline ResultType rowWeight(const GrayType* gray, int x, int width, vigra::VigraFalseType) const {
+        return saturationWeight(gray[x], gray[width + x]);
+    }
+
     // grayscale
     template <typename T>
     inline ResultType f(const T& a, vigra::VigraTrueType) const {
@@ -774,12 +1322,17 @@ protected:
     // RGB
     template <typename T>
     inline ResultType f(const T& a, vigra::VigraFalseType) const {
-        typedef typename T::value_type value_type;
+        return saturationWeight(std::max(a.red(), std::max(a.green(), a.blue())),
+                                std::min(a.red(), std::min(a.green(), a.blue())));
+    }
+
+    // Saturation weight of a pixel with the largest channel max and
+    // the smallest channel min
+    inline ResultType saturationWeight(GrayType max, GrayType min) const {
+        typedef GrayType value_type;
         typedef vigra::NumericTraits<value_type> value_traits;
         typedef vigra::NumericTraits<ResultType> result_traits;
 
-        const value_type max = std::max(a.red(), std::max(a.green(), a.blue()));
-        const value_type min = std::min(a.red(), std::min(a.green(), a.blue()));
         if (max == min)
         {
             return result_traits::zero();
@@ -801,6 +1354,8 @@ protected:
     }
 
     const double weight;
+    GrayAccessor max_acc;
+    GrayAccessor min_acc;
 };
 
 
@@ -985,6 +1540,212 @@ private:
 };
 
 
+/** Keep the weight masks on disk between the two passes of a
+ *  streaming fusion.  Masks are read back in the order they were
+ *  stored.  Only the bounding box of the non-zero weights is written;
+ *  all weights outside of it are zero again after restoring.
+ */
+template <typename MaskType>
+class WeightSpill
+{
+public:
+    typedef typename MaskType::value_type MaskPixelType;
+
+    WeightSpill() : spillFile(std::tmpfile()), isReading(false)
+    {
+        if (spillFile == NULL) {
+            std::cerr << command
+                      << ": failed to create temporary file for weights: " << strerror(errno)
+                      << std::endl;
+            exit(1);
+        }
+    }
+
+    ~WeightSpill() {fclose(spillFile);}
+
+    void store(const MaskType& mask) {
+        const vigra::Size2D size = mask.size();
+        int left = size.x, top = size.y, right = 0, bottom = 0;
+        for (int y = 0; y < size.y; ++y) {
+            for (int x = 0; x < size.x; ++x) {
+                if (mask(x, y) != MaskPixelType()) {
+                    left = std::min(left, x);
+                    top = std::min(top, y);
+                    right = std::max(right, x + 1);
+                    bottom = std::max(bottom, y + 1);
+                }
+            }
+        }
+        if (left >= right) {
+            left = top = right = bottom = 0;
+        }
+
+        const int bb[4] = {left, top, right, bottom};
+        write(bb, sizeof(bb));
+        std::vector<MaskPixelType> row(right - left);
+        for (int y = top; y < bottom; ++y) {
+            for (int x = left; x < right; ++x) {
+                row[x - left] = mask(x, y);
+            }
+            write(&row[0], row.size() * sizeof(MaskPixelType));
+        }
+    }
+
+    MaskType* restore(const vigra::Size2D& size) {
+        if (!isReading) {
+            fflush(spillFile);
+            rewind(spillFile);
+            isReading = true;
+        }
+
+        int bb[4];
+        read(bb, sizeof(bb));
+        MaskType* mask = new MaskType(size);
+        std::vector<MaskPixelType> row(bb[2] - bb[0]);
+        for (int y = bb[1]; y < bb[3]; ++y) {
+            read(&row[0], row.size() * sizeof(MaskPixelType));
+            for (int x = bb[0]; x < bb[2]; ++x) {
+                (*mask)(x, y) = row[x - bb[0]];
+            }
+        }
+        return mask;
+    }
+
+private:
+    WeightSpill(const WeightSpill&);            // not implemented
+    WeightSpill& operator=(const WeightSpill&); // not implemented
+
+    void write(const void* data, size_t size) {
+        if (fwrite(data, 1, size, spillFile) != size) {
+            std::cerr << command
+                      << ": failed to write weights to temporary file: " << strerror(errno)
+                      << std::endl;
+            exit(1);
+        }
+    }
+
+    void read(void* data, size_t size) {
+        if (fread(data, 1, size, spillFile) != size) {
+            std::cerr << command
+                      << ": failed to read weights from temporary file" << std::endl;
+            exit(1);
+        }
+    }
+
+    FILE* spillFile;
+    bool isReading;
+};
+
+
+/** Compute the exposure, contrast, and saturation weights of an
+ *  image in a single pass.
+ *
+ *  Each row reads every source pixel once, applies all enabled
+ *  criteria (a NULL functor disables its criterion), and writes the
+ *  sum to dest, where the former one-pass-per-criterion code
+ *  re-read the source and read-modify-wrote dest for each of them.
+ *  The exposure and saturation functors first project the whole row
+ *  to the gray levels they need, so that the projectors run once per
+ *  row and can use their vector kernels.
+ *  Without exposure weighting, the other weights are added to the
+ *  current contents of dest.  Contrast uses the precomputed gradient
+ *  image grad.
+ */
+template <typename SrcIterator, typename SrcAccessor,
+          typename MaskIterator, typename MaskAccessor,
+          typename GradImageType,
+          typename DestIterator, typename DestAccessor,
+          typename ExposureFunctorType, typename ContrastFunctorType, typename SaturationFunctorType>
+void
+fusedWeightsIf(SrcIterator src_upperleft, SrcIterator src_lowerright, SrcAccessor src_acc,
+               MaskIterator mask_upperleft, MaskAccessor mask_acc,
+               const GradImageType* grad,
+               DestIterator dest_upperleft, DestAccessor dest_acc,
+               const ExposureFunctorType* exposure,
+               const ContrastFunctorType* contrast,
+               const SaturationFunctorType* saturation)
+{
+    typedef typename DestAccessor::value_type DestPixelType;
+    typedef typename ExposureFunctorType::GrayType ExposureGrayType;
+    typedef typename SaturationFunctorType::GrayType SaturationGrayType;
+
+    if (exposure == NULL && contrast == NULL && saturation == NULL) {
+        return;
+    }
+
+    const vigra::Size2D size(src_lowerright - src_upperleft);
+
+#ifdef OPENMP
+#pragma omp parallel
+#endif
+    {
+        // Gray levels of the current row, projected a whole row at a
+        // time
+        std::vector<ExposureGrayType> exposureGray(ExposureFunctorType::grayRows * size.x);
+        std::vector<SaturationGrayType> saturationGray(SaturationFunctorType::grayRows * size.x);
+
+#ifdef OPENMP
+#pragma omp for schedule(guided)
+#endif
+        for (int y = 0; y < size.y; ++y)
+        {
+            typename SrcIterator::row_iterator s((src_upperleft + vigra::Diff2D(0, y)).rowIterator());
+            typename MaskIterator::row_iterator m((mask_upperleft + vigra::Diff2D(0, y)).rowIterator());
+            typename DestIterator::row_iterator d((dest_upperleft + vigra::Diff2D(0, y)).rowIterator());
+
+            if (exposure)
+            {
+                exposure->projectRow(s, s + size.x, src_acc, &exposureGray[0]);
+            }
+            if (saturation)
+            {
+                saturation->projectRow(s, s + size.x, src_acc, &saturationGray[0]);
+            }
+
+            for (int x = 0; x < size.x; ++x, ++m, ++d)
+            {
+                if (mask_acc(m))
+                {
+                    DestPixelType weight =
+                        exposure ? exposure->rowWeight(&exposureGray[0], x, size.x) : dest_acc(d);
+                    if (contrast)
+                    {
+                        weight = (*contrast)((*grad)(x, y)) + weight;
+                    }
+                    if (saturation)
+                    {
+                        weight = saturation->rowWeight(&saturationGray[0], x, size.x) + weight;
+                    }
+                    dest_acc.set(weight, d);
+                }
+            }
+        }
+    }
+}
+
+
+template <typename SrcIterator, typename SrcAccessor,
+          typename MaskIterator, typename MaskAccessor,
+          typename GradImageType,
+          typename DestIterator, typename DestAccessor,
+          typename ExposureFunctorType, typename ContrastFunctorType, typename SaturationFunctorType>
+inline void
+fusedWeightsIf(vigra::triple<SrcIterator, SrcIterator, SrcAccessor> src,
+               vigra::pair<MaskIterator, MaskAccessor> mask,
+               const GradImageType* grad,
+               vigra::pair<DestIterator, DestAccessor> dest,
+               const ExposureFunctorType* exposure,
+               const ContrastFunctorType* contrast,
+               const SaturationFunctorType* saturation)
+{
+    fusedWeightsIf(src.first, src.second, src.third,
+                   mask.first, mask.second,
+                   grad,
+                   dest.first, dest.second,
+                   exposure, contrast, saturation);
+}
+
+
 template <typename ImageType, typename AlphaType, typename MaskType>
 void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename ImageType::const_traverser, typename ImageType::ConstAccessor> src,
                 vigra::pair<typename AlphaType::const_traverser, typename AlphaType::ConstAccessor> mask,
@@ -996,49 +1757,14 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
 
     const typename ImageType::difference_type imageSize = src.second - src.first;
 
-    // Exposure
-    if (WExposure > 0.0) {
-        typedef MultiGrayscaleAccessor<ImageValueType, ScalarType> MultiGrayAcc;
-        MultiGrayAcc ga(GrayscaleProjector);
-
-        if (ExposureLowerCutoff.is_effective<ScalarType>() ||
-            ExposureUpperCutoff.is_effective<ScalarType>()) {
-            MultiGrayAcc lca(ExposureLowerCutoffGrayscaleProjector.empty() ?
-                             GrayscaleProjector :
-                             ExposureLowerCutoffGrayscaleProjector);
-            MultiGrayAcc uca(ExposureUpperCutoffGrayscaleProjector.empty() ?
-                             ExposureLowerCutoffGrayscaleProjector :
-                             ExposureUpperCutoffGrayscaleProjector);
-            CutoffExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
-                cef(WExposure, WMu, WSigma, ga,
-                    ExposureLowerCutoff, ExposureUpperCutoff, lca, uca);
-#ifdef DEBUG_EXPOSURE
-            std::cout << "+ enfuseMask: cutoff - GrayscaleProjector = <" <<
-                GrayscaleProjector << ">\n" <<
-                "+ enfuseMask:          ExposureLowerCutoffGrayscaleProjector = <" <<
-                ExposureLowerCutoffGrayscaleProjector << ">\n" <<
-                "+ enfuseMask:          ExposureUpperCutoffGrayscaleProjector = <" <<
-                ExposureUpperCutoffGrayscaleProjector << ">\n";
-#endif
-            transformImageIfMP(src, mask, result, cef);
-        } else {
-            ExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
-                ef(WExposure, WMu, WSigma, ga);
-#ifdef DEBUG_EXPOSURE
-            std::cout << "+ enfuseMask: plain - GrayscaleProjector = <" <<
-                GrayscaleProjector << ">\n";
-#endif
-            transformImageIfMP(src, mask, result, ef);
-        }
-    }
+    // Contrast needs a neighborhood of each pixel, so we compute its
+    // gradient image ahead of the fused pass.
+    typedef typename vigra::NumericTraits<ScalarType>::Promote LongScalarType;
+    typedef IMAGETYPE<LongScalarType> GradImage;
 
-    // Contrast
+    GradImage grad;
     if (WContrast > 0.0) {
-        typedef typename vigra::NumericTraits<ScalarType>::Promote LongScalarType;
-        typedef IMAGETYPE<LongScalarType> GradImage;
-        typedef typename GradImage::iterator GradIterator;
-
-        GradImage grad(imageSize);
+        grad.resize(imageSize);
         MultiGrayscaleAccessor<PixelType, LongScalarType> ga(GrayscaleProjector);
 
         if (FilterConfig.edgeScale > 0.0)
@@ -1133,16 +1859,50 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
             std::cout << "+ final grad: min = " << minmax.min << ", max = " << minmax.max << std::endl;
         }
 #endif
-        ContrastFunctor<LongScalarType, ScalarType, MaskValueType> cf(WContrast);
-        combineTwoImagesIfMP(srcImageRange(grad), result, mask, result,
-                             const_parameters(bind(cf, _1) + _2));
     }
 
-    // Saturation
-    if (WSaturation > 0.0) {
-        SaturationFunctor<ImageValueType, MaskValueType> sf(WSaturation);
-        combineTwoImagesIfMP(src, result, mask, result,
-                             const_parameters(bind(sf, _1) + _2));
+    // Exposure, contrast, and saturation
+    typedef MultiGrayscaleAccessor<ImageValueType, ScalarType> MultiGrayAcc;
+    typedef ContrastFunctor<LongScalarType, ScalarType, MaskValueType> ContrastFunctorType;
+    typedef SaturationFunctor<ImageValueType, MaskValueType> SaturationFunctorType;
+
+    MultiGrayAcc ga(GrayscaleProjector);
+    const ContrastFunctorType cf(WContrast);
+    const SaturationFunctorType sf(WSaturation);
+    const ContrastFunctorType* const contrast = WContrast > 0.0 ? &cf : NULL;
+    const SaturationFunctorType* const saturation = WSaturation > 0.0 ? &sf : NULL;
+
+    if (WExposure > 0.0 &&
+        (ExposureLowerCutoff.is_effective<ScalarType>() ||
+         ExposureUpperCutoff.is_effective<ScalarType>())) {
+        MultiGrayAcc lca(ExposureLowerCutoffGrayscaleProjector.empty() ?
+                         GrayscaleProjector :
+                         ExposureLowerCutoffGrayscaleProjector);
+        MultiGrayAcc uca(ExposureUpperCutoffGrayscaleProjector.empty() ?
+                         ExposureLowerCutoffGrayscaleProjector :
+                         ExposureUpperCutoffGrayscaleProjector);
+        CutoffExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
+            cef(WExposure, WMu, WSigma, ga,
+                ExposureLowerCutoff, ExposureUpperCutoff, lca, uca);
+#ifdef DEBUG_EXPOSURE
+        std::cout << "+ enfuseMask: cutoff - GrayscaleProjector = <" <<
+            GrayscaleProjector << ">\n" <<
+            "+ enfuseMask:          ExposureLowerCutoffGrayscaleProjector = <" <<
+            ExposureLowerCutoffGrayscaleProjector << ">\n" <<
+            "+ enfuseMask:          ExposureUpperCutoffGrayscaleProjector = <" <<
+            ExposureUpperCutoffGrayscaleProjector << ">\n";
+#endif
+        fusedWeightsIf(src, mask, &grad, result, &cef, contrast, saturation);
+    } else {
+        ExposureFunctor<ImageValueType, MultiGrayAcc, MaskValueType>
+            ef(WExposure, WMu, WSigma, ga);
+#ifdef DEBUG_EXPOSURE
+        if (WExposure > 0.0) {
+            std::cout << "+ enfuseMask: plain - GrayscaleProjector = <" <<
+                GrayscaleProjector << ">\n";
+        }
+#endif
+        fusedWeightsIf(src, mask, &grad, result, WExposure > 0.0 ? &ef : NULL, contrast, saturation);
     }
 
     // Entropy
@@ -1204,6 +1964,55 @@ void enfuseMask(vigra::triple<typename ImageType::const_traverser, typename Imag
 };
 
 
+/** Compute how many images' weighted Laplacian pyramids we build
+ *  concurrently.  Each entry of a batch keeps resident its input
+ *  image, alpha channel, and weight mask, and while in flight it
+ *  holds its own Laplacian pyramid and Gaussian mask pyramid (about
+ *  4/3 of anImageSize times the sum of both pixel sizes) plus the
+ *  row buffers of the SKIPSM reduce and expand.  The number of images
+ *  is limited by the thread count and by the memory budget
+ *  "fusion-memory-limit" (in MB), which defaults to
+ *  DEFAULT_FUSION_MEMORY_LIMIT.  A budget of zero forces the classic
+ *  one-image-at-a-time loop.
+ *
+ *  Note that large stacks fall back to the sequential loop with the
+ *  default budget: a 16-bit RGB image of 50 megapixels already needs
+ *  about 1.6 GB per batch entry, so the batch size is 1 unless
+ *  "fusion-memory-limit" is raised.
+ */
+template <typename ImagePixelType, typename AlphaPixelType, typename MaskPixelType,
+          typename ImagePyramidPixelType, typename MaskPyramidPixelType,
+          typename SKIPSMImagePixelType, typename SKIPSMMaskPixelType>
+unsigned
+numberOfConcurrentFusions(const vigra::Size2D& anImageSize, unsigned aNumberOfImages)
+{
+#ifdef OPENMP
+    // reduce() keeps five rows of SKIPSM accumulators for the image
+    // and the same for the mask; expand() needs fewer.
+    const double skipsmRows = 5.0;
+    const double area = static_cast<double>(anImageSize.area());
+    const double bytesPerImage =
+        area * static_cast<double>(sizeof(ImagePixelType) + sizeof(AlphaPixelType) + sizeof(MaskPixelType)) +
+        (4.0 / 3.0) * area * static_cast<double>(sizeof(ImagePyramidPixelType) + sizeof(MaskPyramidPixelType)) +
+        skipsmRows * static_cast<double>(anImageSize.x) *
+        static_cast<double>(sizeof(SKIPSMImagePixelType) + sizeof(SKIPSMMaskPixelType));
+    const double budget =
+        1048576.0 * enblend::parameter::as_unsigned("fusion-memory-limit",
+                                                     DEFAULT_FUSION_MEMORY_LIMIT);
+    const unsigned affordable =
+        bytesPerImage > 0.0 ?
+        static_cast<unsigned>(std::min(budget / bytesPerImage, static_cast<double>(aNumberOfImages))) :
+        aNumberOfImages;
+
+    return std::max(1U,
+                    std::min(std::min(static_cast<unsigned>(omp_get_max_threads()), aNumberOfImages),
+                             affordable));
+#else
+    return 1U;
+#endif
+}
+
+
 /** Enfuse's main blending loop. Templatized to handle different image types.
  */
 template <typename ImagePixelType>
@@ -1245,6 +2054,24 @@ void enfuseMain(const FileNameList& anInputFileNameList,
     std::list<vigra::ImageImportInfo*> imageInfoList(anImageInfoList);
     const unsigned numberOfImages = imageInfoList.size();
 
+    // In a streaming fusion we do not keep the input images until all
+    // weights are known.  The first pass only computes the weights and
+    // normImage, spilling each weight mask to disk.  The second pass
+    // re-reads the images one by one and pairs them with their
+    // restored weights.  Hard masks need all weights at once, so they
+    // always take the classic path.
+    const bool streamingFusion =
+        enblend::parameter::as_boolean("streaming-fusion", false) && !UseHardMask;
+    WeightSpill<MaskType>* weightSpill = streamingFusion ? new WeightSpill<MaskType>() : NULL;
+    std::list<vigra::ImageImportInfo*> secondPassInfoList;
+    if (streamingFusion) {
+        secondPassInfoList = anImageInfoList;
+        if (Verbose >= VERBOSE_MASK_MESSAGES) {
+            std::cerr << command
+                      << ": info: streaming fusion; weights are kept in a temporary file" << std::endl;
+        }
+    }
+
     unsigned m = 0;
     FileNameList::const_iterator inputFileNameIterator(anInputFileNameList.begin());
     while (!imageInfoList.empty()) {
@@ -1337,8 +2164,6 @@ void enfuseMain(const FileNameList& anInputFileNameList,
                            destImage(*normImage),
                            Arg1() + Arg2());
 
-        imageList.push_back(vigra::make_triple(imagePair.first, imagePair.second, mask));
-
 #ifdef CACHE_IMAGES
         if (Verbose >= VERBOSE_CFI_MESSAGES) {
             vigra_ext::CachedFileImageDirector& v = vigra_ext::CachedFileImageDirector::v();
@@ -1354,6 +2179,15 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         }
 #endif
 
+        if (streamingFusion) {
+            weightSpill->store(*mask);
+            delete imagePair.first;
+            delete imagePair.second;
+            delete mask;
+        } else {
+            imageList.push_back(vigra::make_triple(imagePair.first, imagePair.second, mask));
+        }
+
         ++m;
         ++inputFileNameIterator;
     }
@@ -1362,7 +2196,7 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         exit(0);
     }
 
-    const int totalImages = imageList.size();
+    const int totalImages = m;
 
     typename EnblendNumericTraits<ImagePixelType>::MaskPixelType maxMaskPixelType =
         vigra::NumericTraits<typename EnblendNumericTraits<ImagePixelType>::MaskPixelType>::max();
@@ -1470,82 +2304,158 @@ void enfuseMain(const FileNameList& anInputFileNameList,
 
     std::vector<ImagePyramidType*> *resultLP = NULL;
 
+    ConvertScalarToPyramidFunctor<typename EnblendNumericTraits<ImagePixelType>::MaskPixelType,
+        MaskPyramidPixelType,
+        MaskPyramidIntegerBits,
+        MaskPyramidFractionBits> maskConvertFunctor;
+    const MaskPyramidPixelType maxMaskPyramidPixelValue = maskConvertFunctor(maxMaskPixelType);
+
+    // Build the weighted Laplacian pyramids of up to batchSize images
+    // at the same time and sum them pairwise before adding the
+    // batch's total to resultLP.  With a batch size of one this is
+    // exactly the classic one-image-at-a-time loop.  A streaming
+    // fusion exists to keep a single input image resident, so it
+    // always runs with a batch size of one.
+    const unsigned batchSize =
+        streamingFusion ?
+        1U :
+        numberOfConcurrentFusions<ImagePixelType, AlphaPixelType, MaskPixelType,
+                                  ImagePyramidPixelType, MaskPyramidPixelType,
+                                  SKIPSMImagePixelType, SKIPSMMaskPixelType>(anInputUnion.size(),
+                                                                             totalImages);
+    if (batchSize > 1 && Verbose >= VERBOSE_PYRAMID_MESSAGES) {
+        std::cerr << command
+                  << ": info: fusing up to " << batchSize << " images concurrently"
+                  << std::endl;
+    }
+
     m = 0;
-    while (!imageList.empty()) {
-        vigra::triple<ImageType*, AlphaType*, MaskType*> imageTriple = imageList.front();
-        imageList.erase(imageList.begin());
-
-        std::ostringstream oss0;
-        oss0 << "imageGP" << m << "_";
-
-        // imageLP is constructed using the image's own alpha channel
-        // as the boundary for extrapolation.
-        std::vector<ImagePyramidType*> *imageLP =
-            laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
-                             ImagePyramidIntegerBits, ImagePyramidFractionBits,
-                             SKIPSMImagePixelType, SKIPSMAlphaPixelType>(
-                                                                         oss0.str().c_str(),
-                                                                         numLevels, WrapAround != OpenBoundaries,
-                                                                         srcImageRange(*(imageTriple.first)),
-                                                                         maskImage(*(imageTriple.second)));
-
-        delete imageTriple.first;
-        delete imageTriple.second;
-
-        //std::ostringstream oss1;
-        //oss1 << "imageLP" << m << "_";
-        //exportPyramid<ImagePyramidType>(imageLP, oss1.str().c_str());
-
-        if (!UseHardMask) {
-            // Normalize the mask coefficients.
-            // Scale to the range expected by the MaskPyramidPixelType.
-            combineTwoImagesMP(srcImageRange(*(imageTriple.third)),
-                               srcImage(*normImage),
-                               destImage(*(imageTriple.third)),
-                               ifThenElse(Arg2() > Param(0.0),
-                                          Param(maxMaskPixelType) * Arg1() / Arg2(),
-                                          Param(maxMaskPixelType / totalImages)));
-        }
-
-        // maskGP is constructed using the union of the input alpha channels
-        // as the boundary for extrapolation.
-        std::vector<MaskPyramidType*> *maskGP =
-            gaussianPyramid<MaskType, AlphaType, MaskPyramidType,
-            MaskPyramidIntegerBits, MaskPyramidFractionBits,
-            SKIPSMMaskPixelType, SKIPSMAlphaPixelType>
-            (numLevels,
-             WrapAround != OpenBoundaries,
-             srcImageRange(*(imageTriple.third)),
-             maskImage(*(outputPair.second)));
-
-        delete imageTriple.third;
-
-        //std::ostringstream oss2;
-        //oss2 << "maskGP" << m << "_";
-        //exportPyramid<MaskPyramidType>(maskGP, oss2.str().c_str());
-
-        ConvertScalarToPyramidFunctor<typename EnblendNumericTraits<ImagePixelType>::MaskPixelType,
-            MaskPyramidPixelType,
-            MaskPyramidIntegerBits,
-            MaskPyramidFractionBits> maskConvertFunctor;
-        MaskPyramidPixelType maxMaskPyramidPixelValue = maskConvertFunctor(maxMaskPixelType);
-
-        for (unsigned int i = 0; i < maskGP->size(); ++i) {
-            // Multiply image lp with the mask gp.
-            combineTwoImagesMP(srcImageRange(*((*imageLP)[i])),
-                               srcImage(*((*maskGP)[i])),
-                               destImage(*((*imageLP)[i])),
-                               ImageMaskMultiplyFunctor<MaskPyramidPixelType>(maxMaskPyramidPixelValue));
-
-            // Done with maskGP.
-            delete (*maskGP)[i];
-        }
-        delete maskGP;
-
-        //std::ostringstream oss3;
-        //oss3 << "multLP" << m << "_";
-        //exportPyramid<ImagePyramidType>(imageLP, oss3.str().c_str());
+    while (!imageList.empty() || !secondPassInfoList.empty()) {
+        std::vector< vigra::triple<ImageType*, AlphaType*, MaskType*> > batch;
+        if (streamingFusion) {
+            // assemble() groups the images exactly as in the first
+            // pass, so the weights come back in the same order.
+            while (!secondPassInfoList.empty() && batch.size() < batchSize) {
+                vigra::Rect2D imageBB;
+                std::pair<ImageType*, AlphaType*> imagePair =
+                    assemble<ImageType, AlphaType>(secondPassInfoList, anInputUnion, imageBB);
+                batch.push_back(vigra::make_triple(imagePair.first, imagePair.second,
+                                                   weightSpill->restore(anInputUnion.size())));
+            }
+        } else {
+            while (!imageList.empty() && batch.size() < batchSize) {
+                batch.push_back(imageList.front());
+                imageList.erase(imageList.begin());
+            }
+        }
+        const int n = static_cast<int>(batch.size());
+        std::vector<std::vector<ImagePyramidType*>*> weightedLP(n);
+        omp::exception_store failure;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) if (n > 1)
+#endif
+        for (int b = 0; b < n; ++b) {
+            try {
+                vigra::triple<ImageType*, AlphaType*, MaskType*> imageTriple = batch[b];
+
+                std::ostringstream oss0;
+                oss0 << "imageGP" << m + b << "_";
+
+                // imageLP is constructed using the image's own alpha channel
+                // as the boundary for extrapolation.
+                std::vector<ImagePyramidType*> *imageLP =
+                    laplacianPyramid<ImageType, AlphaType, ImagePyramidType,
+                                     ImagePyramidIntegerBits, ImagePyramidFractionBits,
+                                     SKIPSMImagePixelType, SKIPSMAlphaPixelType>(
+                                                                                 oss0.str().c_str(),
+                                                                                 numLevels, WrapAround != OpenBoundaries,
+                                                                                 srcImageRange(*(imageTriple.first)),
+                                                                                 maskImage(*(imageTriple.second)));
+
+                delete imageTriple.first;
+                delete imageTriple.second;
+
+                //std::ostringstream oss1;
+                //oss1 << "imageLP" << m + b << "_";
+                //exportPyramid<ImagePyramidType>(imageLP, oss1.str().c_str());
+
+                if (!UseHardMask) {
+                    // Normalize the mask coefficients.
+                    // Scale to the range expected by the MaskPyramidPixelType.
+                    combineTwoImagesMP(srcImageRange(*(imageTriple.third)),
+                                       srcImage(*normImage),
+                                       destImage(*(imageTriple.third)),
+                                       ifThenElse(Arg2() > Param(0.0),
+                                                  Param(maxMaskPixelType) * Arg1() / Arg2(),
+                                                  Param(maxMaskPixelType / totalImages)));
+                }
+
+                // maskGP is constructed using the union of the input alpha channels
+                // as the boundary for extrapolation.
+                std::vector<MaskPyramidType*> *maskGP =
+                    gaussianPyramid<MaskType, AlphaType, MaskPyramidType,
+                    MaskPyramidIntegerBits, MaskPyramidFractionBits,
+                    SKIPSMMaskPixelType, SKIPSMAlphaPixelType>
+                    (numLevels,
+                     WrapAround != OpenBoundaries,
+                     srcImageRange(*(imageTriple.third)),
+                     maskImage(*(outputPair.second)));
+
+                delete imageTriple.third;
+
+                //std::ostringstream oss2;
+                //oss2 << "maskGP" << m + b << "_";
+                //exportPyramid<MaskPyramidType>(maskGP, oss2.str().c_str());
+
+                for (unsigned int i = 0; i < maskGP->size(); ++i) {
+                    // Multiply image lp with the mask gp.
+                    combineTwoImagesMP(srcImageRange(*((*imageLP)[i])),
+                                       srcImage(*((*maskGP)[i])),
+                                       destImage(*((*imageLP)[i])),
+                                       ImageMaskMultiplyFunctor<MaskPyramidPixelType>(maxMaskPyramidPixelValue));
+
+                    // Done with maskGP.
+                    delete (*maskGP)[i];
+                }
+                delete maskGP;
+
+                //std::ostringstream oss3;
+                //oss3 << "multLP" << m + b << "_";
+                //exportPyramid<ImagePyramidType>(imageLP, oss3.str().c_str());
 
+                weightedLP[b] = imageLP;
+            } catch (...) {
+                failure.capture();
+            }
+        }
+        failure.rethrow();
+
+        // Tree-sum the batch into weightedLP[0].  Each pass halves
+        // the number of pyramids and frees the ones added in.
+        for (int stride = 1; stride < n; stride *= 2) {
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) if (n - stride > 2 * stride)
+#endif
+            for (int b = 0; b < n - stride; b += 2 * stride) {
+                try {
+                    std::vector<ImagePyramidType*> *addend = weightedLP[b + stride];
+                    for (unsigned int i = 0; i < addend->size(); ++i) {
+                        combineTwoImagesMP(srcImageRange(*((*addend)[i])),
+                                           srcImage(*((*weightedLP[b])[i])),
+                                           destImage(*((*weightedLP[b])[i])),
+                                           Arg1() + Arg2());
+                        delete (*addend)[i];
+                    }
+                    delete addend;
+                } catch (...) {
+                    failure.capture();
+                }
+            }
+            failure.rethrow();
+        }
+
+        std::vector<ImagePyramidType*> *imageLP = weightedLP[0];
         if (resultLP != NULL) {
             // Add imageLP to resultLP.
             for (unsigned int i = 0; i < imageLP->size(); ++i) {
@@ -1564,9 +2474,10 @@ void enfuseMain(const FileNameList& anInputFileNameList,
         //oss4 << "resultLP" << m << "_";
         //exportPyramid<ImagePyramidType>(resultLP, oss4.str().c_str());
 
-        ++m;
+        m += n;
     }
 
+    delete weightSpill;
     delete normImage;
 
     //exportPyramid<ImagePyramidType>(resultLP, "resultLP");
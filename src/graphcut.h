@@ -29,13 +29,14 @@
 #include <math.h>
 #endif
 
+#include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <utility>
-#include <queue>
+#include <vector>
 
-#include <boost/functional/hash.hpp>
 #include <boost/scoped_ptr.hpp>
-#include <boost/unordered_set.hpp>
 
 #include <vigra/functorexpression.hxx>
 #include <vigra/inspectimage.hxx>
@@ -74,25 +75,13 @@ using namespace vigra::functor;
 
 namespace enblend {
 
-    struct pointHash
-    {
-        std::size_t operator()(const vigra::Point2D& p) const
-        {
-            std::size_t seed = 0;
-
-            boost::hash_combine(seed, p.x);
-            boost::hash_combine(seed, p.y);
-
-            return seed;
-        }
-    };
-
-
     class CheckpointPixels
     {
     public:
+        typedef std::vector<vigra::Point2D> PointList;
+
         CheckpointPixels() {}
-        boost::unordered_set<vigra::Point2D, pointHash> top, bottom;
+        PointList top, bottom;
 
         ~CheckpointPixels()
         {
@@ -104,6 +93,18 @@ namespace enblend {
             top.clear();
             bottom.clear();
         }
+
+        // Each sub-cut only has a single source and a single
+        // destination point, so a linear search beats hashing.
+        bool isTop(const vigra::Point2D& p) const
+        {
+            return std::find(top.begin(), top.end(), p) != top.end();
+        }
+
+        bool isBottom(const vigra::Point2D& p) const
+        {
+            return std::find(bottom.begin(), bottom.end(), p) != bottom.end();
+        }
     };
 
 
@@ -304,40 +305,128 @@ namespace enblend {
     }
 
 
-    template <typename ImageType>
-    class CostComparer
+    // Monotone priority queue of dual-graph points for A_star().
+    // The scores are non-negative and A_star() never pushes a score
+    // smaller than the one it popped last, so a radix heap suffices:
+    // bucket i holds the entries whose score first differs from the
+    // last popped score in bit i - 1.  Neither push nor pop compares
+    // any pixels of the graph image.
+    class RadixPointQueue
     {
     public:
-        CostComparer(const ImageType* image) : img(image) {}
+        typedef unsigned long key_type;
+        typedef std::pair<key_type, vigra::Point2D> value_type;
+
+        RadixPointQueue() : last_(0), size_(0), buckets_(CHAR_BIT * sizeof(key_type) + 1) {}
 
-        bool operator()(const vigra::Point2D& a, const vigra::Point2D& b) const
+        bool empty() const {return size_ == 0;}
+
+        void push(key_type key, const vigra::Point2D& point)
+        {
+            assert(key >= last_);
+            buckets_[bucketIndex(key)].push_back(std::make_pair(key, point));
+            ++size_;
+        }
+
+        // Remove an entry with the smallest score and answer it.
+        value_type pop()
         {
-            if (a == vigra::Point2D(-20, -20)) {
-                return totalScore > (*img)[b];
-            } else if (b == vigra::Point2D(-20, -20)) {
-                return (*img)[a] > totalScore;
+            assert(!empty());
+
+            if (buckets_[0].empty()) {
+                size_t i = 1;
+                while (buckets_[i].empty()) {
+                    ++i;
+                }
+
+                std::vector<value_type>& bucket = buckets_[i];
+                key_type smallest = bucket.front().first;
+                for (std::vector<value_type>::const_iterator e = bucket.begin(); e != bucket.end(); ++e) {
+                    smallest = std::min(smallest, e->first);
+                }
+
+                // All entries of the bucket move to lower buckets,
+                // at least one of them to bucket 0.
+                last_ = smallest;
+                for (std::vector<value_type>::const_iterator e = bucket.begin(); e != bucket.end(); ++e) {
+                    buckets_[bucketIndex(e->first)].push_back(*e);
+                }
+                bucket.clear();
             }
 
-            return (*img)[a] > (*img)[b];
+            const value_type top = buckets_[0].back();
+            buckets_[0].pop_back();
+            --size_;
+
+            return top;
         }
 
-        void setTotalScore(long s)
+    private:
+        size_t bucketIndex(key_type key) const
         {
-            totalScore = s;
+            size_t index = 0;
+            for (key_type difference = key ^ last_; difference != 0; difference >>= 1) {
+                ++index;
+            }
+            return index;
         }
 
-    protected:
-        const ImageType* img;
-        long totalScore;
+        key_type last_;
+        size_t size_;
+        std::vector<std::vector<value_type> > buckets_;
+    };
+
+
+    // Dense set of the points inside of bounds.  Points outside
+    // never are members.
+    class PointBitmap
+    {
+    public:
+        explicit PointBitmap(const vigra::Rect2D& bounds) :
+            bounds_(bounds),
+            bits_(static_cast<size_t>(bounds.width()) * static_cast<size_t>(bounds.height()), false) {}
+
+        bool contains(const vigra::Point2D& p) const
+        {
+            return inside(p) && bits_[index(p)];
+        }
+
+        void insert(const vigra::Point2D& p)
+        {
+            if (inside(p)) {
+                bits_[index(p)] = true;
+            }
+        }
+
+        template <class InputIterator>
+        void insert(InputIterator first, InputIterator last)
+        {
+            for (; first != last; ++first) {
+                insert(*first);
+            }
+        }
+
+    private:
+        bool inside(const vigra::Point2D& p) const
+        {
+            return bounds_.contains(p);
+        }
+
+        size_t index(const vigra::Point2D& p) const
+        {
+            const vigra::Diff2D q(p - bounds_.upperLeft());
+            return static_cast<size_t>(q.y) * static_cast<size_t>(bounds_.width()) + static_cast<size_t>(q.x);
+        }
+
+        const vigra::Rect2D bounds_;
+        std::vector<bool> bits_;
     };
 
 
     struct OutputLabelingFunctor
     {
     public:
-        OutputLabelingFunctor(boost::unordered_set<vigra::Point2D, pointHash>* a_,
-                              boost::unordered_set<vigra::Point2D, pointHash>* b_,
-                              vigra::Point2D offset_) :
+        OutputLabelingFunctor(const PointBitmap* a_, const PointBitmap* b_, vigra::Point2D offset_) :
             left(a_), right(b_), offset(offset_) {}
 
         bool operator()(vigra::Diff2D a2, vigra::Diff2D b2)
@@ -348,13 +437,13 @@ namespace enblend {
             a -= vigra::Point2D(1,1);
             b -= vigra::Point2D(1,1);
             //a-= offset; b-= offset;
-            return !((left->find(a) != left->end() && right->find(b) != right->end()) ||
-                     (right->find(a) != right->end() && left->find(b) != left->end()));
+            return !((left->contains(a) && right->contains(b)) ||
+                     (right->contains(a) && left->contains(b)));
         }
 
     protected:
-        boost::unordered_set<vigra::Point2D, pointHash>* left;
-        boost::unordered_set<vigra::Point2D, pointHash>* right;
+        const PointBitmap* left;
+        const PointBitmap* right;
         vigra::Point2D offset;
     };
 
@@ -362,25 +451,24 @@ namespace enblend {
     struct CutPixelsFunctor
     {
     public:
-        CutPixelsFunctor(boost::unordered_set<vigra::Point2D, pointHash>* a_,
-                              boost::unordered_set<vigra::Point2D, pointHash>* b_) :
+        CutPixelsFunctor(const PointBitmap* a_, const PointBitmap* b_) :
             left(a_), right(b_){}
 
         MaskPixelType operator()(const vigra::Diff2D& pos2, const MaskPixelType& a2) const
         {
             vigra::Point2D pos(pos2);
-            if(left->find(pos) != left->end() && right->find(pos) != right->end())
+            if(left->contains(pos) && right->contains(pos))
                 return 164;
-            else if (left->find(*pos) != left->end())
+            else if (left->contains(pos))
                 return 64;
-            else if (right->find(*pos) != right->end())
+            else if (right->contains(pos))
                 return 255;
             else return 0;
         }
 
     protected:
-        boost::unordered_set<vigra::Point2D, pointHash>* left;
-        boost::unordered_set<vigra::Point2D, pointHash>* right;
+        const PointBitmap* left;
+        const PointBitmap* right;
     };
 
     template<class MaskPixelType>
@@ -457,7 +545,7 @@ namespace enblend {
             list[3] = src(-2, 0);
         }
 
-        if (srcDestPoints->bottom.find(src) != srcDestPoints->bottom.end()) {
+        if (srcDestPoints->isBottom(src)) {
             list[0] = vigra::Point2D(-20, -20);
             list[1] = vigra::Point2D(-20, -20);
             list[2] = vigra::Point2D(-20, -20);
@@ -465,10 +553,10 @@ namespace enblend {
         }
 
         if (check) {
-            if (srcDestPoints->bottom.find(src) != srcDestPoints->bottom.end() ||
-                srcDestPoints->bottom.find(src(1, 0)) != srcDestPoints->bottom.end() ||
-                srcDestPoints->bottom.find(src(1, 1)) != srcDestPoints->bottom.end() ||
-                srcDestPoints->bottom.find(src(0, 1)) != srcDestPoints->bottom.end()) {
+            if (srcDestPoints->isBottom(src) ||
+                srcDestPoints->isBottom(src(1, 0)) ||
+                srcDestPoints->isBottom(src(1, 1)) ||
+                srcDestPoints->isBottom(src(0, 1))) {
                 if (list[1] == vigra::Point2D(-1, -1)) {
                     list[1] = vigra::Point2D(-20, -20);
                 } else if (list[2] == vigra::Point2D(-1, -1)) {
@@ -483,19 +571,23 @@ namespace enblend {
 
     void
     getNeighbourList(CheckpointPixels* srcDestPoints,
-                     boost::unordered_set<vigra::Point2D, pointHash>::iterator* auxList1,
-                     boost::unordered_set<vigra::Point2D, pointHash>::iterator* auxList2)
+                     CheckpointPixels::PointList::const_iterator* auxList1,
+                     CheckpointPixels::PointList::const_iterator* auxList2)
     {
         *auxList1 = srcDestPoints->top.begin();
         *auxList2 = srcDestPoints->top.end();
     }
 
 
+    // Write the path that ends in pt into vec.  The caller owns vec
+    // and may pass the same vector for every sub-cut, so that its
+    // storage is allocated only once.
     template <class ImageType>
-    std::vector<vigra::Point2D>* tracePath(vigra::Point2D pt, ImageType* img, CheckpointPixels* srcDestPoints)
+    void tracePath(vigra::Point2D pt, ImageType* img, CheckpointPixels* srcDestPoints,
+                   std::vector<vigra::Point2D>* vec)
     {
-        std::vector<vigra::Point2D>* vec = new std::vector<vigra::Point2D>;
         vigra::Point2D current = pt;
+        vec->clear();
         vec->push_back(pt);
         do {
             switch ((*img)[current(1, 1)] & BIT_MASK_DIR) {
@@ -518,9 +610,7 @@ namespace enblend {
                 break;
             }
             current = vec->back();
-        } while (srcDestPoints->top.find(current) == srcDestPoints->top.end());
-
-        return vec;
+        } while (!srcDestPoints->isTop(current));
     }
 
 
@@ -558,42 +648,54 @@ namespace enblend {
     }
 
 
+    // Find the cheapest path from srcpt to destpt and store it in
+    // path, which is left empty if there is none.
     template <class ImageType, class GradientImageType, class MaskPixelType>
-    std::vector<vigra::Point2D>*
+    void
     A_star(vigra::Point2D srcpt, vigra::Point2D destpt, ImageType* img,
            GradientImageType* gradientX, GradientImageType* gradientY,
-           vigra::Diff2D bounds, CheckpointPixels* srcDestPoints, boost::unordered_set<vigra::Point2D, pointHash>* visited)
+           vigra::Diff2D bounds, CheckpointPixels* srcDestPoints, const PointBitmap* visited,
+           std::vector<vigra::Point2D>* path)
     {
         MaskPixelType zeroVal = vigra::NumericTraits<MaskPixelType>::zero();
-        typedef std::priority_queue<vigra::Point2D, std::vector<vigra::Point2D>, CostComparer<ImageType> > Queue;
-        CostComparer<ImageType> costcomp(img);
-        Queue* openset = new Queue(costcomp);
+        RadixPointQueue openset;
         long score = 0;
         long totalScore = 0;
         long iterCount = 0;
         int gradientA;
         int gradientB;
         bool scoreIsBetter;
-        bool pushToList;
         bool destOpen = false;
         vigra::Point2D list[4];
         vigra::Point2D current;
         vigra::Point2D neighbour;
         vigra::Point2D destNeighbour;
-        boost::unordered_set<vigra::Point2D, pointHash>::iterator auxListBegin;
-        boost::unordered_set<vigra::Point2D, pointHash>::iterator auxListEnd;
-        openset->push(srcpt);
+        CheckpointPixels::PointList::const_iterator auxListBegin;
+        CheckpointPixels::PointList::const_iterator auxListEnd;
+        openset.push(0, srcpt);
+
+        while (!openset.empty()) {
+            const RadixPointQueue::value_type top = openset.pop();
+            current = top.second;
+
+            // A point enters the queue again with each better score.
+            // Skip the entries that have been superseded since.
+            if (current == vigra::Point2D(-20, -20)) {
+                if (top.first != static_cast<RadixPointQueue::key_type>(totalScore)) {
+                    continue;
+                }
+            } else if (current != vigra::Point2D(-10, -10) &&
+                       top.first != static_cast<RadixPointQueue::key_type>((*img)[current])) {
+                continue;
+            }
 
-        while (!openset->empty()) {
-            current = openset->top();
-            openset->pop();
             iterCount++;
             if (current == destpt) {
 #ifdef DEBUG_GRAPHCUT
                 std::cout << "Graphcut completed after visiting " << iterCount << " nodes" << std::endl;
 #endif
-                delete openset;
-                return tracePath<ImageType>(destNeighbour, img, srcDestPoints);
+                tracePath<ImageType>(destNeighbour, img, srcDestPoints, path);
+                return;
             }
 
             if (current == vigra::Point2D(-10, -10)) {
@@ -606,12 +708,11 @@ namespace enblend {
                 for (int i = 0; i < 4; i++) {
                     score = 0;
                     scoreIsBetter = false;
-                    pushToList = false;
                     neighbour = list[i];
 
                     //visited during an earlier sub-cut, ignore
 
-                    if(visited->find(neighbour) != visited->end()) {
+                    if (visited->contains(neighbour)) {
                         continue;
                     }
 
@@ -640,12 +741,10 @@ namespace enblend {
                         }
 
                         if (neighbour == vigra::Point2D(-20, -20) && !destOpen) {
-                            pushToList = true;
                             destOpen = true;
                             scoreIsBetter = true;
                         } else if (neighbour != vigra::Point2D(-20, -20) &&
                                    ((*img)[neighbour(1, 1)] & BIT_MASK_OPEN) == 0) {
-                            pushToList = true;
                             (*img)[neighbour(1, 1)] += BIT_MASK_OPEN;
                             scoreIsBetter = true;
                         } else if ((neighbour == vigra::Point2D(-20, -20) && score < totalScore) ||
@@ -657,30 +756,25 @@ namespace enblend {
                             if (neighbour == vigra::Point2D(-20, -20)) {
                                 totalScore = score;
                                 destNeighbour = current;
-                                costcomp.setTotalScore(totalScore);
+                                openset.push(totalScore, neighbour);
                             } else {
                                 (*img)[neighbour(1, 1)] &= BIT_MASK_OPEN;
                                 (*img)[neighbour(1, 1)] += i;
                                 (*img)[neighbour(1, 1)] ^= BIT_MASK_OPDIR;
                                 (*img)[neighbour] = score;
-                            }
-
-                            if (pushToList) {
-                                openset->push(neighbour);
+                                openset.push(score, neighbour);
                             }
                         }
                     }
                 }
             } else {
-                for (boost::unordered_set<vigra::Point2D, pointHash>::iterator x = auxListBegin; x != auxListEnd; ++x) {
+                for (CheckpointPixels::PointList::const_iterator x = auxListBegin; x != auxListEnd; ++x) {
                     score = 0;
                     scoreIsBetter = false;
-                    pushToList = false;
                     neighbour = *x;
                     if (neighbour != vigra::Point2D(-1, -1) && (*img)[neighbour(1, 1)] == zeroVal) {
                         score = 0;
                         if (((*img)[neighbour(1, 1)] & BIT_MASK_OPEN) == 0) {
-                            pushToList = true;
                             (*img)[neighbour(1, 1)] += BIT_MASK_OPEN;
                             scoreIsBetter = true;
                         } else if (score < (*img)[neighbour]) {
@@ -690,9 +784,7 @@ namespace enblend {
                         if (scoreIsBetter) {
                             (*img)[neighbour(1, 1)] &= BIT_MASK_OPEN;
                             (*img)[neighbour] = score;
-                            if (pushToList) {
-                                openset->push(neighbour);
-                            }
+                            openset.push(score, neighbour);
                         }
                     }
                 }
@@ -701,8 +793,7 @@ namespace enblend {
 #ifdef DEBUG_GRAPHCUT
         std::cout << "Graphcut failed after visiting " << iterCount << " nodes" << std::endl;
 #endif
-        delete openset;
-        return new std::vector<vigra::Point2D>();
+        path->clear();
     }
 
 
@@ -713,9 +804,7 @@ namespace enblend {
     }
 
 
-    void dividePath(std::vector<vigra::Point2D>* cut,
-                    boost::unordered_set<vigra::Point2D, pointHash>* left,
-                    boost::unordered_set<vigra::Point2D, pointHash>* right,
+    void dividePath(std::vector<vigra::Point2D>* cut, PointBitmap* left, PointBitmap* right,
                     const vigra::Rect2D& iBB)
     {
         vigra::Point2D previous;
@@ -1209,8 +1298,11 @@ namespace enblend {
         typedef vigra::NumericTraits<BasePixelType> BasePixelTraits;
         typedef vigra::NumericTraits<MaskPixelType> MaskPixelTraits;
 
-        boost::unordered_set<vigra::Point2D, pointHash> pixelsLeftOfCut;
-        boost::unordered_set<vigra::Point2D, pointHash> pixelsRightOfCut;
+        // OutputLabelingFunctor queries the points of the labeling
+        // image, which carries a 1-pixel border around iBB.
+        const vigra::Rect2D cutBounds(vigra::Point2D(-1, -1), vigra::Point2D(size + vigra::Diff2D(1, 1)));
+        PointBitmap pixelsLeftOfCut(cutBounds);
+        PointBitmap pixelsRightOfCut(cutBounds);
 
         dividePath(&totalDualPath, &pixelsLeftOfCut, &pixelsRightOfCut, iBB);
 
@@ -1325,7 +1417,7 @@ namespace enblend {
         IMAGETYPE<GradientPixelType> gradientY(size);
         IMAGETYPE<GraphPixelType> graphImg(size + size + vigra::Diff2D(1, 1));
 
-        std::vector<vigra::Point2D>* dualPath = NULL;
+        std::vector<vigra::Point2D> dualPath;
         std::vector<vigra::Point2D> totalDualPath;
         vigra::Point2D intermediatePoint;
         boost::scoped_ptr<CheckpointPixels> srcDestPoints(new CheckpointPixels());
@@ -1426,7 +1518,7 @@ namespace enblend {
 #endif
 
         // a set of points to keep visited points for subsequent graph-cut runs
-        boost::unordered_set<vigra::Point2D, pointHash> visited;
+        PointBitmap visited((vigra::Rect2D(vigra::Size2D(graphsize))));
 
         // find optimal cuts in dual graph
         for (std::vector<vigra::Point2D>::iterator i = intermediatePointList->begin();
@@ -1438,21 +1530,21 @@ namespace enblend {
             }
 
             srcDestPoints->clear();
-            srcDestPoints->top.insert(intermediatePoint);
-            srcDestPoints->bottom.insert(*i);
+            srcDestPoints->top.push_back(intermediatePoint);
+            srcDestPoints->bottom.push_back(*i);
 
 #ifdef DEBUG_GRAPHCUT
             std::cout << "Running graph-cut: " << intermediatePoint << ":" << *i << std::endl;
 #endif
 
-            dualPath = A_star<IMAGETYPE<GraphPixelType>, IMAGETYPE<GradientPixelType>, BasePixelType>
+            A_star<IMAGETYPE<GraphPixelType>, IMAGETYPE<GradientPixelType>, BasePixelType>
                 (vigra::Point2D(-10, -10), vigra::Point2D(-20, -20), &intermediateGraphImg, &gradientX,
-                 &gradientY, graphsize - vigra::Diff2D(1, 1), srcDestPoints.get(), &visited);
+                 &gradientY, graphsize - vigra::Diff2D(1, 1), srcDestPoints.get(), &visited, &dualPath);
 
-            visited.insert(dualPath->begin(), dualPath->end());
+            visited.insert(dualPath.begin(), dualPath.end());
 
-            for (std::vector<vigra::Point2D>::reverse_iterator j = dualPath->rbegin(); j < dualPath->rend(); j++) {
-                if ((j == dualPath->rbegin() && totalDualPath.empty()) || j != dualPath->rbegin()) {
+            for (std::vector<vigra::Point2D>::reverse_iterator j = dualPath.rbegin(); j < dualPath.rend(); j++) {
+                if ((j == dualPath.rbegin() && totalDualPath.empty()) || j != dualPath.rbegin()) {
                     totalDualPath.push_back(*j);
                 }
             }
@@ -1466,7 +1558,6 @@ namespace enblend {
              dest_upperleft, da, totalDualPath, iBB);
 
         delete intermediatePointList;
-        delete dualPath;
     }
 
 } /* namespace enblend */
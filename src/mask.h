@@ -894,10 +894,211 @@ vigra::Rect2D vertexBoundingBox(ContourVector& contours)
 }
 
 
+// Cost of a single canvas pixel for the refinement levels of the
+// coarse-to-fine seam search.  It follows the cost image of the
+// optimizer chain: where both images overlap, the pixel costs their
+// difference; where neither image has data, it costs one; every
+// other pixel has maximum cost.
+template <typename ImageType, typename AlphaType, typename MismatchPixelType, typename DifferenceFunctorType>
+class SeamCostFunctor
+{
+public:
+    typedef MismatchPixelType result_type;
+
+    SeamCostFunctor(const ImageType* const white, const vigra::Rect2D& whiteWindow,
+                    const ImageType* const black,
+                    const AlphaType* const whiteAlpha, const AlphaType* const blackAlpha,
+                    const vigra::Rect2D& uBB, const DifferenceFunctorType& difference) :
+        white_(white), whiteWindow_(whiteWindow), black_(black),
+        whiteAlpha_(whiteAlpha), blackAlpha_(blackAlpha),
+        uBB_(uBB), difference_(difference) {}
+
+    result_type operator()(const vigra::Point2D& p) const {
+        typedef typename AlphaType::PixelType AlphaPixelType;
+
+        if (!uBB_.contains(p)) {
+            return vigra::NumericTraits<result_type>::max();
+        }
+
+        const bool inWhite = (*whiteAlpha_)[p] != vigra::NumericTraits<AlphaPixelType>::zero();
+        const bool inBlack = (*blackAlpha_)[p] != vigra::NumericTraits<AlphaPixelType>::zero();
+
+        if (inWhite && inBlack) {
+            return whiteWindow_.contains(p) ?
+                difference_((*white_)[p - whiteWindow_.upperLeft()], (*black_)[p]) :
+                vigra::NumericTraits<result_type>::max();
+        } else if (inWhite || inBlack) {
+            return vigra::NumericTraits<result_type>::max();
+        } else {
+            return vigra::NumericTraits<result_type>::one();
+        }
+    }
+
+private:
+    const ImageType* const white_;
+    const vigra::Rect2D whiteWindow_;
+    const ImageType* const black_;
+    const AlphaType* const whiteAlpha_;
+    const AlphaType* const blackAlpha_;
+    const vigra::Rect2D uBB_;
+    const DifferenceFunctorType difference_;
+};
+
+
+// Refine one seam from previousStride to stride.  On entry dense
+// holds the seam of the previous level, i.e. the vertices of
+// anchors, which must be in the same (vBB-relative, strided)
+// coordinates, interspersed with the shortest paths between them.
+// We route between the same anchors again, but on a cost image that
+// only covers a corridor of the given radius around the previous
+// seam.  On exit dense and anchors are in the coordinates of stride.
+template <typename SeamCostFunctorType>
+void
+refineSeamSnake(Segment& dense, Segment& anchors,
+                int previousStride, int stride,
+                const vigra::Rect2D& vBB, int corridorRadius,
+                const SeamCostFunctorType& cost)
+{
+    typedef typename SeamCostFunctorType::result_type CostPixelType;
+    typedef vigra::BasicImage<CostPixelType> CostImageType;
+
+    if (dense.empty() || anchors.empty()) {
+        return;
+    }
+
+    const vigra::Rect2D levelRect(vigra::Size2D((vBB.width() + stride - 1) / stride,
+                                                (vBB.height() + stride - 1) / stride));
+    Segment refinedDense;
+    Segment refinedAnchors;
+    Segment::const_iterator d = dense.begin();
+    MinCostPathEngine<CostPixelType> pathEngine;
+    std::vector<vigra::Point2D> shortPath;
+
+    for (Segment::const_iterator a = anchors.begin(); a != anchors.end(); ++a) {
+        Segment::const_iterator nextAnchor = enblend::next(a);
+        const bool lastAnchor = nextAnchor == anchors.end();
+        if (lastAnchor) {
+            nextAnchor = anchors.begin();
+        }
+
+        const vigra::Point2D start(a->second * previousStride / stride);
+        const vigra::Point2D end(nextAnchor->second * previousStride / stride);
+
+        // Collect the previous seam between the two anchors.  The
+        // shortest path never revisits its starting point, so the
+        // first occurrence of the next anchor ends the run.
+        std::vector<vigra::Point2D> corridor(1, start);
+        if (d != dense.end()) {
+            ++d;
+        }
+        while (d != dense.end() && (lastAnchor || d->second != nextAnchor->second)) {
+            corridor.push_back(vigra::Point2D(d->second * previousStride / stride));
+            ++d;
+        }
+        corridor.push_back(end);
+
+        refinedDense.push_back(std::make_pair(a->first, start));
+        refinedAnchors.push_back(std::make_pair(a->first, start));
+
+        if (!(a->first || nextAnchor->first)) {
+            continue;
+        }
+
+        vigra::Rect2D roi(start, vigra::Size2D(1, 1));
+        for (std::vector<vigra::Point2D>::const_iterator c = corridor.begin(); c != corridor.end(); ++c) {
+            roi |= vigra::Rect2D(*c, vigra::Size2D(1, 1));
+        }
+        roi.addBorder(corridorRadius);
+        roi &= levelRect;
+
+        // Only the corridor gets real costs; everything else acts as
+        // a wall for the path search.
+        CostImageType costImage(roi.size(), vigra::NumericTraits<CostPixelType>::max());
+        vigra::BImage known(roi.size(), vigra::UInt8(0));
+        for (std::vector<vigra::Point2D>::const_iterator c = corridor.begin(); c != corridor.end(); ++c) {
+            for (int y = c->y - corridorRadius; y <= c->y + corridorRadius; ++y) {
+                for (int x = c->x - corridorRadius; x <= c->x + corridorRadius; ++x) {
+                    const vigra::Point2D p(x, y);
+                    if (roi.contains(p)) {
+                        const vigra::Point2D local(p - roi.upperLeft());
+                        if (!known[local]) {
+                            known[local] = 1;
+                            costImage[local] = cost(vigra::Point2D(vBB.upperLeft() + p * stride));
+                        }
+                    }
+                }
+            }
+        }
+
+        pathEngine.findPath(srcImageRange(costImage),
+                            vigra::Point2D(end - roi.upperLeft()),
+                            vigra::Point2D(start - roi.upperLeft()),
+                            shortPath);
+
+        // findPath() returns the path from end to start.
+        for (std::vector<vigra::Point2D>::reverse_iterator p = shortPath.rbegin();
+             p != shortPath.rend();
+             ++p) {
+            refinedDense.push_back(std::make_pair(false, *p + roi.upperLeft()));
+        }
+    }
+
+    dense.swap(refinedDense);
+    anchors.swap(refinedAnchors);
+}
+
+
+// Refine all seams in contours, which the optimizer chain has
+// placed at stride, level by level down to stride one.  anchors
+// holds the snakes as they were before the Dijkstra optimizer ran,
+// in the order of the segments in contours.
+template <typename SeamCostFunctorType>
+void
+refineSeamsCoarseToFine(ContourVector& contours, std::vector<Segment>& anchors,
+                        const vigra::Rect2D& vBB, int stride,
+                        const SeamCostFunctorType& cost)
+{
+    const int corridorWidth =
+        static_cast<int>(enblend::parameter::as_unsigned("coarse-to-fine-corridor", 3U));
+
+    for (int previousStride = stride, currentStride = stride / 2;
+         previousStride > 1;
+         previousStride = currentStride, currentStride /= 2) {
+        currentStride = std::max(currentStride, 1);
+        const int corridorRadius =
+            std::max(corridorWidth, (previousStride + currentStride - 1) / currentStride);
+
+        if (Verbose >= VERBOSE_MASK_MESSAGES) {
+            std::cerr << command
+                      << ": info: refining seams at 1/" << currentStride << " scale" << std::endl;
+        }
+
+        std::vector<Segment>::iterator anchor = anchors.begin();
+        for (ContourVector::iterator currentContour = contours.begin();
+             currentContour != contours.end();
+             ++currentContour) {
+            for (Contour::iterator currentSegment = (*currentContour)->begin();
+                 currentSegment != (*currentContour)->end();
+                 ++currentSegment, ++anchor) {
+                refineSeamSnake(**currentSegment, *anchor,
+                                previousStride, currentStride,
+                                vBB, corridorRadius,
+                                cost);
+            }
+        }
+    }
+}
+
+
 /** Calculate a blending mask between whiteImage and blackImage.
+ *
+ *  The white image only covers whiteWindow, which is given relative
+ *  to the upper left corner of the black image; all other images
+ *  cover the whole canvas.
  */
 template <typename ImageType, typename AlphaType, typename MaskType>
 MaskType* createMask(const ImageType* const white,
+                     const vigra::Rect2D& whiteWindow,
                      const ImageType* const black,
                      const AlphaType* const whiteAlpha,
                      const AlphaType* const blackAlpha,
@@ -1005,8 +1206,13 @@ MaskType* createMask(const ImageType* const white,
                  enblend::parameter::as_unsigned("distance-transform-norm", static_cast<unsigned>(ManhattanDistance)));
     const nearest_neighbor_metric_t norm = static_cast<nearest_neighbor_metric_t>(default_norm_value);
 
+    // Version of iBB relative to the upper left corner of whiteWindow.
+    // The intersection always lies inside of the white image's window.
+    vigra::Rect2D iBB_white = iBB;
+    iBB_white.moveBy(-whiteWindow.upperLeft());
+
     if (MainAlgorithm == GraphCut)
-        graphCut(vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(iBB, srcImageRange(*white))),
+        graphCut(vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(iBB_white, srcImageRange(*white))),
                  vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(iBB, srcImage(*black))),
                  vigra::destIter(mainOutputImage->upperLeft() + mainOutputOffset),
                  vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(uBB, srcImageRange(*whiteAlpha))),
@@ -1014,6 +1220,20 @@ MaskType* createMask(const ImageType* const white,
                  norm,
                  wraparound ? HorizontalStrip : OpenBoundaries,
                  mainInputBB);
+    else if (MainAlgorithm == NFT && !wraparound &&
+             enblend::parameter::as_boolean("restrict-nft-to-overlap", true)) {
+        // Outside of iBB at most one image carries data, thus the
+        // expensive part of the NFT is only needed close to iBB.
+        // The extra border accounts for the rounding of mainInputBB
+        // when striding.
+        vigra::Rect2D mainOverlap(mainInputBB);
+        mainOverlap.addBorder(1);
+        overlapNearestFeatureTransform(vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(uBB, srcImageRange(*whiteAlpha))),
+                                       vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(uBB, srcImage(*blackAlpha))),
+                                       vigra::destIter(mainOutputImage->upperLeft() + mainOutputOffset),
+                                       norm,
+                                       mainOverlap);
+    }
     else if (MainAlgorithm == NFT)
         nearestFeatureTransform(vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(uBB, srcImageRange(*whiteAlpha))),
                                 vigra_ext::stride(mainStride, mainStride, vigra_ext::apply(uBB, srcImage(*blackAlpha))),
@@ -1140,19 +1360,24 @@ MaskType* createMask(const ImageType* const white,
     int mismatchImageStride;
     vigra::Diff2D uvBBStrideOffset;
 
+    // In coarse-to-fine mode the optimizer chain works at half the
+    // coarseness of the NFT and refineSeamsCoarseToFine() takes the
+    // seams down to full resolution afterwards.
+    const bool coarseToFine =
+        CoarseMask && OptimizeMask &&
+        enblend::parameter::as_boolean("coarse-to-fine-seam", false);
+
     if (CoarseMask) {
-        // Prepare to stride by two over uvBB to create cost image.
-        // Push ul corner of vBB so that there is an even number of
-        // pixels between vBB and uvBB.
-        if (uvBBOffset.x % 2) {
-            vBB.setUpperLeft(vBB.upperLeft() + vigra::Diff2D(-1, 0));
-        }
-        if (uvBBOffset.y % 2) {
-            vBB.setUpperLeft(vBB.upperLeft() + vigra::Diff2D(0, -1));
-        }
-        uvBBStrideOffset = (uvBB.upperLeft() - vBB.upperLeft()) / 2;
-        mismatchImageStride = 2;
-        mismatchImageSize = (vBB.size() + vigra::Diff2D(1, 1)) / 2;
+        // Prepare to stride over uvBB to create cost image.  Push ul
+        // corner of vBB so that the number of pixels between vBB and
+        // uvBB is a multiple of the stride.
+        mismatchImageStride =
+            coarseToFine ? std::max(2, static_cast<int>(CoarsenessFactor) / 2) : 2;
+        vBB.setUpperLeft(vBB.upperLeft() - vigra::Diff2D(uvBBOffset.x % mismatchImageStride,
+                                                         uvBBOffset.y % mismatchImageStride));
+        uvBBStrideOffset = (uvBB.upperLeft() - vBB.upperLeft()) / mismatchImageStride;
+        mismatchImageSize = (vBB.size() + vigra::Diff2D(mismatchImageStride - 1, mismatchImageStride - 1)) /
+            mismatchImageStride;
     } else {
         uvBBStrideOffset = uvBBOffset;
         mismatchImageStride = 1;
@@ -1176,25 +1401,44 @@ MaskType* createMask(const ImageType* const white,
     //                  !Visualize && CoarseMask: 1/2 * iBB * UInt8
     //                  !Visualize && !CoarseMask: iBB * UInt8
 
+    // Portion of uvBB where the white image carries data.  Outside of
+    // it the images cannot overlap, so we leave the mismatch image at
+    // its maximum cost there.  When striding, keep the upper left
+    // corner on the grid of uvBB.
+    vigra::Rect2D uvwBB = uvBB & whiteWindow;
+    if (!uvwBB.isEmpty()) {
+        const vigra::Diff2D offset = uvwBB.upperLeft() - uvBB.upperLeft();
+        const vigra::Diff2D misalignment(offset.x % mismatchImageStride, offset.y % mismatchImageStride);
+        uvwBB.setUpperLeft(uvwBB.upperLeft() +
+                           vigra::Diff2D(misalignment.x == 0 ? 0 : mismatchImageStride - misalignment.x,
+                                         misalignment.y == 0 ? 0 : mismatchImageStride - misalignment.y));
+    }
+    vigra::Rect2D uvwBB_white = uvwBB;
+    uvwBB_white.moveBy(-whiteWindow.upperLeft());
+    const vigra::Diff2D uvwBBStrideOffset =
+        uvBBStrideOffset + (uvwBB.upperLeft() - uvBB.upperLeft()) / mismatchImageStride;
+
     // Calculate mismatch image
-    switch (PixelDifferenceFunctor)
-    {
-    case HueLuminanceMaxDifference:
-        combineTwoImagesMP(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
-                           vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
-                           vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
-                           MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
-                           (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
-        break;
-    case DeltaEDifference:
-        combineTwoImagesMP(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImageRange(*white))),
-                           vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvBB, srcImage(*black))),
-                           vigra::destIter(mismatchImage.upperLeft() + uvBBStrideOffset),
-                           DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
-                           (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
-        break;
-    default:
-        throw never_reached("switch control expression \"PixelDifferenceFunctor\" out of range");
+    if (!uvwBB.isEmpty()) {
+        switch (PixelDifferenceFunctor)
+        {
+        case HueLuminanceMaxDifference:
+            combineTwoImagesMP(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvwBB_white, srcImageRange(*white))),
+                               vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvwBB, srcImage(*black))),
+                               vigra::destIter(mismatchImage.upperLeft() + uvwBBStrideOffset),
+                               MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                               (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+            break;
+        case DeltaEDifference:
+            combineTwoImagesMP(vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvwBB_white, srcImageRange(*white))),
+                               vigra_ext::stride(mismatchImageStride, mismatchImageStride, vigra_ext::apply(uvwBB, srcImage(*black))),
+                               vigra::destIter(mismatchImage.upperLeft() + uvwBBStrideOffset),
+                               DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType>
+                               (LuminanceDifferenceWeight, ChrominanceDifferenceWeight));
+            break;
+        default:
+            throw never_reached("switch control expression \"PixelDifferenceFunctor\" out of range");
+        }
     }
 
     if (Verbose >= VERBOSE_DIFFERENCE_STATISTICS) {
@@ -1280,6 +1524,8 @@ MaskType* createMask(const ImageType* const white,
         }
 
         std::vector<double> *params = new(std::vector<double>);
+        std::vector<Segment> anchors;
+        int seamStride = mismatchImageStride;
 
         OptimizerChain<MismatchImagePixelType, MismatchImageType, VisualizeImageType, AlphaType>
             *defaultOptimizerChain = new OptimizerChain<MismatchImagePixelType, MismatchImageType, VisualizeImageType, AlphaType>
@@ -1294,8 +1540,51 @@ MaskType* createMask(const ImageType* const white,
             // Add Strategy 2: Use Dijkstra shortest path algorithm between snake vertices
         defaultOptimizerChain->addOptimizer("dijkstra");
 
+        if (coarseToFine) {
+            // Run the annealer alone first and keep its snakes as
+            // the anchors of all refinement levels.
+            defaultOptimizerChain->runCurrentOptimizer();
+            for (ContourVector::const_iterator currentContour = contours.begin();
+                 currentContour != contours.end();
+                 ++currentContour) {
+                for (Contour::const_iterator currentSegment = (*currentContour)->begin();
+                     currentSegment != (*currentContour)->end();
+                     ++currentSegment) {
+                    anchors.push_back(**currentSegment);
+                }
+            }
+            defaultOptimizerChain->runCurrentOptimizer();
+        } else {
             // Fire optimizer chain (runs every optimizer on the list in sequence)
-        defaultOptimizerChain->runOptimizerChain();
+            defaultOptimizerChain->runOptimizerChain();
+        }
+
+        if (coarseToFine) {
+            switch (PixelDifferenceFunctor)
+            {
+            case HueLuminanceMaxDifference:
+            {
+                typedef MaxHueLuminanceDifferenceFunctor<ImagePixelType, MismatchImagePixelType> DifferenceFunctor;
+                refineSeamsCoarseToFine(contours, anchors, vBB, mismatchImageStride,
+                                        SeamCostFunctor<ImageType, AlphaType, MismatchImagePixelType, DifferenceFunctor>
+                                        (white, whiteWindow, black, whiteAlpha, blackAlpha, uBB,
+                                         DifferenceFunctor(LuminanceDifferenceWeight, ChrominanceDifferenceWeight)));
+                break;
+            }
+            case DeltaEDifference:
+            {
+                typedef DeltaEPixelDifferenceFunctor<ImagePixelType, MismatchImagePixelType> DifferenceFunctor;
+                refineSeamsCoarseToFine(contours, anchors, vBB, mismatchImageStride,
+                                        SeamCostFunctor<ImageType, AlphaType, MismatchImagePixelType, DifferenceFunctor>
+                                        (white, whiteWindow, black, whiteAlpha, blackAlpha, uBB,
+                                         DifferenceFunctor(LuminanceDifferenceWeight, ChrominanceDifferenceWeight)));
+                break;
+            }
+            default:
+                throw never_reached("switch control expression \"PixelDifferenceFunctor\" out of range");
+            }
+            seamStride = 1;
+        }
 
         // Move snake vertices from mismatchImage-relative
         // coordinates to uBB-relative coordinates.
@@ -1311,7 +1600,7 @@ MaskType* createMask(const ImageType* const white,
                         currentVertex != snake->end();
                         ++currentVertex) {
                         currentVertex->second =
-                            currentVertex->second * mismatchImageStride +
+                            currentVertex->second * seamStride +
                             vBB.upperLeft() - uBB.upperLeft();
                     }
                 }
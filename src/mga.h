@@ -26,14 +26,247 @@
 
 #include <iostream>
 #include <iomanip>
+#include <vector>
 
+#include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
+
+#include <vigra/accessor.hxx>
 #include <vigra/colorconversions.hxx>
+#include <vigra/rgbvalue.hxx>
 
 #include "common.h"
+#include "muopt.h"
+#include "numerictraits.h"
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
 
 
 namespace enblend {
 
+// Projections of RGB rows that have vector kernels
+struct AverageProjection {};
+struct ValueProjection {};
+struct AntiValueProjection {};
+struct LuminanceProjection {};
+
+
+// Accessors that return the pixels as they are stored, so that the
+// vector kernels may read a row directly
+template <class Accessor, class PixelType>
+struct ReadsStoredPixels {enum {value = false};};
+
+template <class PixelType>
+struct ReadsStoredPixels<vigra::StandardAccessor<PixelType>, PixelType> {enum {value = true};};
+
+template <class PixelType>
+struct ReadsStoredPixels<vigra::StandardValueAccessor<PixelType>, PixelType> {enum {value = true};};
+
+template <class PixelType>
+struct ReadsStoredPixels<vigra::StandardConstAccessor<PixelType>, PixelType> {enum {value = true};};
+
+template <class PixelType>
+struct ReadsStoredPixels<vigra::StandardConstValueAccessor<PixelType>, PixelType> {enum {value = true};};
+
+template <class PixelType>
+struct ReadsStoredPixels<vigra::RGBAccessor<PixelType>, PixelType> {enum {value = true};};
+
+template <class PixelType>
+struct ReadsStoredPixels<vigra::VectorAccessor<PixelType>, PixelType> {enum {value = true};};
+
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+
+// Load the 8 RGB pixels at p as 32-bit red, green, and blue
+// components.  Only the 24 bytes of the pixels are read: the upper
+// lane is loaded from byte 8 on, so that pixel 4 starts at byte 4 of
+// the lane.
+TARGET_AVX2 inline void
+loadRGBAVX2(const vigra::RGBValue<vigra::UInt8>* p, __m256i& r, __m256i& g, __m256i& b)
+{
+    BOOST_STATIC_ASSERT(sizeof(vigra::RGBValue<vigra::UInt8>) == 3);
+    const char* const bytes = reinterpret_cast<const char*>(p);
+    const __m256i v =
+        _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes))),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 8)), 1);
+    r = _mm256_shuffle_epi8(v, _mm256_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1,
+                                                4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1, 13, -1, -1, -1));
+    g = _mm256_shuffle_epi8(v, _mm256_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1,
+                                                5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1, 14, -1, -1, -1));
+    b = _mm256_shuffle_epi8(v, _mm256_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+                                                6, -1, -1, -1, 9, -1, -1, -1, 12, -1, -1, -1, 15, -1, -1, -1));
+}
+
+
+// The 16-bit variant loads the pixels 0-3 and 4-7 like the 8-bit
+// one loads 0-7.  Each load yields two pixels per lane; they are
+// merged as pixels 0, 1, 4, 5, 6, 7, 2, 3 and then permuted.
+TARGET_AVX2 inline __m256i
+loadRGBHalfAVX2(const char* bytes)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes))),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 8)), 1);
+}
+
+
+TARGET_AVX2 inline __m256i
+gatherRGBComponentAVX2(__m256i v0, __m256i v1, int offset)
+{
+    const char o = static_cast<char>(offset);
+    const __m256i c0 =
+        _mm256_shuffle_epi8(v0, _mm256_setr_epi8(o, o + 1, -1, -1, o + 6, o + 7, -1, -1,
+                                                 -1, -1, -1, -1, -1, -1, -1, -1,
+                                                 -1, -1, -1, -1, -1, -1, -1, -1,
+                                                 o + 4, o + 5, -1, -1, o + 10, o + 11, -1, -1));
+    const __m256i c1 =
+        _mm256_shuffle_epi8(v1, _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                                 o, o + 1, -1, -1, o + 6, o + 7, -1, -1,
+                                                 o + 4, o + 5, -1, -1, o + 10, o + 11, -1, -1,
+                                                 -1, -1, -1, -1, -1, -1, -1, -1));
+    return _mm256_permutevar8x32_epi32(_mm256_or_si256(c0, c1), _mm256_setr_epi32(0, 1, 6, 7, 2, 3, 4, 5));
+}
+
+
+TARGET_AVX2 inline void
+loadRGBAVX2(const vigra::RGBValue<vigra::UInt16>* p, __m256i& r, __m256i& g, __m256i& b)
+{
+    BOOST_STATIC_ASSERT(sizeof(vigra::RGBValue<vigra::UInt16>) == 6);
+    const char* const bytes = reinterpret_cast<const char*>(p);
+    const __m256i v0 = loadRGBHalfAVX2(bytes);
+    const __m256i v1 = loadRGBHalfAVX2(bytes + 24);
+    r = gatherRGBComponentAVX2(v0, v1, 0);
+    g = gatherRGBComponentAVX2(v0, v1, 2);
+    b = gatherRGBComponentAVX2(v0, v1, 4);
+}
+
+
+TARGET_AVX2 inline void
+storeGrayAVX2(vigra::UInt8* result, __m256i v)
+{
+    const __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(result), _mm_packus_epi16(w, w));
+}
+
+
+TARGET_AVX2 inline void
+storeGrayAVX2(vigra::UInt16* result, __m256i v)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(result),
+                     _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+
+// The rounded average (r + g + b) / 3 equals (r + g + b + 1) / 3 in
+// integers.  We compute it as the truncation of (r + g + b + 1.5) /
+// 3, which is at least 1/6 away from the next integer, so that the
+// rounding error of float does not matter.
+TARGET_AVX2 inline __m256i
+projectAVX2(AverageProjection, __m256i r, __m256i g, __m256i b)
+{
+    const __m256 sum = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_add_epi32(r, g), b));
+    return _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_add_ps(sum, _mm256_set1_ps(1.5f)),
+                                             _mm256_set1_ps(1.0f / 3.0f)));
+}
+
+
+TARGET_AVX2 inline __m256i
+projectAVX2(ValueProjection, __m256i r, __m256i g, __m256i b)
+{
+    return _mm256_max_epi32(r, _mm256_max_epi32(g, b));
+}
+
+
+TARGET_AVX2 inline __m256i
+projectAVX2(AntiValueProjection, __m256i r, __m256i g, __m256i b)
+{
+    return _mm256_min_epi32(r, _mm256_min_epi32(g, b));
+}
+
+
+// Same weights and order of evaluation as
+// vigra::RGBValue::luminance(), rounded like fromRealPromote().
+TARGET_AVX2 inline __m128i
+luminanceAVX2(__m128i r, __m128i g, __m128i b)
+{
+    const __m256d y =
+        _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(0.3), _mm256_cvtepi32_pd(r)),
+                                    _mm256_mul_pd(_mm256_set1_pd(0.59), _mm256_cvtepi32_pd(g))),
+                      _mm256_mul_pd(_mm256_set1_pd(0.11), _mm256_cvtepi32_pd(b)));
+    return _mm256_cvttpd_epi32(_mm256_add_pd(y, _mm256_set1_pd(0.5)));
+}
+
+
+TARGET_AVX2 inline __m256i
+projectAVX2(LuminanceProjection, __m256i r, __m256i g, __m256i b)
+{
+    const __m128i low = luminanceAVX2(_mm256_castsi256_si128(r),
+                                      _mm256_castsi256_si128(g),
+                                      _mm256_castsi256_si128(b));
+    const __m128i high = luminanceAVX2(_mm256_extracti128_si256(r, 1),
+                                       _mm256_extracti128_si256(g, 1),
+                                       _mm256_extracti128_si256(b, 1));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+
+
+template <class Projection, typename ChannelType>
+TARGET_AVX2 inline int
+projectRGBRowAVX2(const vigra::RGBValue<ChannelType>* src, ChannelType* result, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i r, g, b;
+        loadRGBAVX2(src + i, r, g, b);
+        storeGrayAVX2(result + i, projectAVX2(Projection(), r, g, b));
+    }
+    return i;
+}
+
+#endif // HAVE_X86_SIMD_DISPATCH
+
+
+/** Project the leading pixels of the RGB row [src, src + n) into
+ *  result with the vector kernel of Projection and return their
+ *  number.  The remaining pixels are left to the caller.  Only 8-bit
+ *  and 16-bit rows that are projected to their channel type have
+ *  kernels, which need AVX2.
+ */
+template <class Projection, typename InputType, typename ResultType>
+inline int
+projectRGBRowVectorized(Projection, const InputType*, ResultType*, int)
+{
+    return 0;
+}
+
+
+template <class Projection>
+inline int
+projectRGBRowVectorized(Projection, const vigra::RGBValue<vigra::UInt8>* src, vigra::UInt8* result, int n)
+{
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (muopt::cpu_supports_avx2()) {
+        return projectRGBRowAVX2<Projection>(src, result, n);
+    }
+#endif
+    return 0;
+}
+
+
+template <class Projection>
+inline int
+projectRGBRowVectorized(Projection, const vigra::RGBValue<vigra::UInt16>* src, vigra::UInt16* result, int n)
+{
+#ifdef HAVE_X86_SIMD_DISPATCH
+    if (muopt::cpu_supports_avx2()) {
+        return projectRGBRowAVX2<Projection>(src, result, n);
+    }
+#endif
+    return 0;
+}
+
+
 template <typename InputType, typename ResultType>
 class MultiGrayscaleAccessor
 {
@@ -44,6 +277,7 @@ public:
         typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
         initializeTypeSpecific(srcIsScalar());
         initialize(accessorName);
+        initializeLookupTables(srcIsScalar());
     }
 
     ResultType operator()(const InputType& x) const {
@@ -63,6 +297,15 @@ public:
         return f(i, d, srcIsScalar());
     }
 
+    // Project the row [first, last) to grayscale.  The projector is
+    // selected once per row, not once per pixel.
+    template <class SrcIterator, class SrcAccessor, class DestIterator, class DestAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa,
+                    DestIterator result, DestAccessor da) const {
+        typedef typename vigra::NumericTraits<InputType>::isScalar srcIsScalar;
+        projectRow(first, last, sa, result, da, srcIsScalar());
+    }
+
     static const std::string defaultGrayscaleAccessorName() {return "average";}
 
 private:
@@ -179,48 +422,242 @@ private:
         rgb_prime_to_lab_fun = vigra::RGBPrime2LabFunctor<double>(vigra::NumericTraits<ValueType>::max());
     }
 
-    ResultType project(const InputType& x) const {
-        typedef typename InputType::value_type ValueType;
+    // Integral channels with few enough levels get per-channel
+    // tables of the Y-contributions of the RGB->XYZ transform, which
+    // replace the full color conversion of the L*-projectors.
+    typedef typename vigra::NumericTraits<InputType>::ValueType ChannelType;
+    typedef typename LookupTableSelector<EnblendNumericTraits<ChannelType>::ImagePixelComponentLevels>::type
+        hasLuminanceTable;
+
+    void initializeLookupTables(vigra::VigraTrueType) {}
+
+    void initializeLookupTables(vigra::VigraFalseType) {
+        initializeLuminanceTable(hasLuminanceTable());
+    }
+
+    void initializeLuminanceTable(vigra::VigraFalseType) {}
+
+    void initializeLuminanceTable(vigra::VigraTrueType) {
+        const double max = vigra::NumericTraits<ChannelType>::max();
+
         switch (kind)
         {
-        case AVERAGE:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                ((vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
-                  vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
-                  vigra::NumericTraits<ValueType>::toRealPromote(x.blue())) /
-                 3.0);
         case LSTAR:
+            luminanceTable = makeLuminanceTable(vigra::RGB2XYZFunctor<double>(max));
+            break;
+        case PRIMED_LSTAR:
+            luminanceTable = makeLuminanceTable(vigra::RGBPrime2XYZFunctor<double>(max));
+            break;
+        default:
+            break;
+        }
+    }
+
+    static int luminanceTableLevels() {
+        return EnblendNumericTraits<ChannelType>::ImagePixelComponentLevels;
+    }
+
+    static int luminanceTableIndex(ChannelType x) {
+        return static_cast<int>(x) - static_cast<int>(vigra::NumericTraits<ChannelType>::min());
+    }
+
+    // Layout: red block, green block, blue block of luminanceTableLevels() entries each.
+    template <class ToXYZFunctor>
+    static boost::shared_ptr<const std::vector<double> > makeLuminanceTable(const ToXYZFunctor& to_xyz) {
+        const int levels = luminanceTableLevels();
+        std::vector<double>* table = new std::vector<double>(3 * levels);
+        const ChannelType zero = vigra::NumericTraits<ChannelType>::zero();
+
+        for (int i = 0; i < levels; ++i)
         {
-            typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
-            const LABResultType y = rgb_to_lab_fun.operator()(x) / 100.0;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
+            const ChannelType v =
+                static_cast<ChannelType>(i + static_cast<int>(vigra::NumericTraits<ChannelType>::min()));
+            (*table)[i] = to_xyz(InputType(v, zero, zero))[1];
+            (*table)[levels + i] = to_xyz(InputType(zero, v, zero))[1];
+            (*table)[2 * levels + i] = to_xyz(InputType(zero, zero, v))[1];
         }
-        case PRIMED_LSTAR:
+
+        return boost::shared_ptr<const std::vector<double> >(table);
+    }
+
+    ResultType tabulatedLstar(const InputType& x) const {
+        const int levels = luminanceTableLevels();
+        const double* const table = &(*luminanceTable)[0];
+        const double y =
+            table[luminanceTableIndex(x.red())] +
+            table[levels + luminanceTableIndex(x.green())] +
+            table[2 * levels + luminanceTableIndex(x.blue())];
+        const double lightness = xyz_to_lab_fun(vigra::TinyVector<double, 3>(0.0, y, 0.0))[0] / 100.0;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ChannelType>::max() * lightness);
+    }
+
+    ResultType average(const InputType& x) const {
+        return vigra::NumericTraits<ResultType>::fromRealPromote
+            ((vigra::NumericTraits<ChannelType>::toRealPromote(x.red()) +
+              vigra::NumericTraits<ChannelType>::toRealPromote(x.green()) +
+              vigra::NumericTraits<ChannelType>::toRealPromote(x.blue())) /
+             3.0);
+    }
+
+    ResultType lstar(const InputType& x) const {
+        if (luminanceTable)
+        {
+            return tabulatedLstar(x);
+        }
+        typedef typename vigra::RGB2LabFunctor<double>::result_type LABResultType;
+        const LABResultType y = rgb_to_lab_fun.operator()(x) / 100.0;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ChannelType>::max() * y[0]);
+    }
+
+    ResultType primedLstar(const InputType& x) const {
+        if (luminanceTable)
+        {
+            return tabulatedLstar(x);
+        }
+        typedef typename vigra::RGBPrime2LabFunctor<double>::result_type LABResultType;
+        const LABResultType y = rgb_prime_to_lab_fun.operator()(x) / 100.0;
+        return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ChannelType>::max() * y[0]);
+    }
+
+    ResultType lightness(const InputType& x) const {
+        return vigra::NumericTraits<ResultType>::fromRealPromote
+            ((std::min(x.red(), std::min(x.green(), x.blue())) +
+              std::max(x.red(), std::max(x.green(), x.blue()))) /
+             2.0);
+    }
+
+    ResultType value(const InputType& x) const {
+        return std::max(x.red(), std::max(x.green(), x.blue()));
+    }
+
+    ResultType antiValue(const InputType& x) const {
+        return std::min(x.red(), std::min(x.green(), x.blue()));
+    }
+
+    ResultType luminance(const InputType& x) const {
+        return vigra::NumericTraits<ResultType>::fromRealPromote(x.luminance());
+    }
+
+    ResultType mixer(const InputType& x) const {
+        return vigra::NumericTraits<ResultType>::fromRealPromote
+            (redWeight * vigra::NumericTraits<ChannelType>::toRealPromote(x.red()) +
+             greenWeight * vigra::NumericTraits<ChannelType>::toRealPromote(x.green()) +
+             blueWeight * vigra::NumericTraits<ChannelType>::toRealPromote(x.blue()));
+    }
+
+    ResultType project(const InputType& x) const {
+        switch (kind)
+        {
+        case AVERAGE: return average(x);
+        case LSTAR: return lstar(x);
+        case PRIMED_LSTAR: return primedLstar(x);
+        case LIGHTNESS: return lightness(x);
+        case VALUE: return value(x);
+        case ANTI_VALUE: return antiValue(x);
+        case LUMINANCE: return luminance(x);
+        case MIXER: return mixer(x);
+        }
+
+        // never reached
+        return ResultType();
+    }
+
+    typedef ResultType (MultiGrayscaleAccessor::*Projector)(const InputType&) const;
+
+    // The projector is fixed for the whole row, so the switch over
+    // kind stays out of the pixel loop.
+    template <Projector projector,
+              class SrcIterator, class SrcAccessor, class DestIterator, class DestAccessor>
+    void projectRowWith(SrcIterator first, SrcIterator last, SrcAccessor sa,
+                        DestIterator result, DestAccessor da) const {
+        for (; first != last; ++first, ++result)
         {
-            typedef typename vigra::RGBPrime2LabFunctor<double>::result_type LABResultType;
-            const LABResultType y = rgb_prime_to_lab_fun.operator()(x) / 100.0;
-            return vigra::NumericTraits<ResultType>::fromRealPromote(vigra::NumericTraits<ValueType>::max() * y[0]);
+            da.set((this->*projector)(sa(first)), result);
         }
+    }
+
+    // Projectors with vector kernels: rows that are not stored
+    // contiguously or that go through a general accessor take the
+    // scalar path.
+    template <Projector projector, class Projection,
+              class SrcIterator, class SrcAccessor, class DestIterator, class DestAccessor>
+    void projectRowWith(SrcIterator first, SrcIterator last, SrcAccessor sa,
+                        DestIterator result, DestAccessor da, Projection) const {
+        projectRowWith<projector>(first, last, sa, result, da);
+    }
+
+    template <Projector projector, class Projection, class SrcAccessor>
+    void projectRowWith(const InputType* first, const InputType* last, SrcAccessor sa,
+                        ResultType* result, vigra::StandardValueAccessor<ResultType> da, Projection) const {
+        const int n =
+            ReadsStoredPixels<SrcAccessor, InputType>::value ?
+            projectRGBRowVectorized(Projection(), first, result, static_cast<int>(last - first)) :
+            0;
+        projectRowWith<projector>(first + n, last, sa, result + n, da);
+    }
+
+    template <Projector projector, class Projection, class SrcAccessor>
+    void projectRowWith(InputType* first, InputType* last, SrcAccessor sa,
+                        ResultType* result, vigra::StandardValueAccessor<ResultType> da, Projection) const {
+        projectRowWith<projector>(static_cast<const InputType*>(first), static_cast<const InputType*>(last),
+                                  sa, result, da, Projection());
+    }
+
+    // RGB
+    template <class SrcIterator, class SrcAccessor, class DestIterator, class DestAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa,
+                    DestIterator result, DestAccessor da, vigra::VigraFalseType) const {
+        switch (kind)
+        {
+        case AVERAGE:
+            projectRowWith<&MultiGrayscaleAccessor::average>(first, last, sa, result, da, AverageProjection());
+            break;
+        case LSTAR:
+            if (luminanceTable)
+            {
+                projectRowWith<&MultiGrayscaleAccessor::tabulatedLstar>(first, last, sa, result, da);
+            }
+            else
+            {
+                projectRowWith<&MultiGrayscaleAccessor::lstar>(first, last, sa, result, da);
+            }
+            break;
+        case PRIMED_LSTAR:
+            if (luminanceTable)
+            {
+                projectRowWith<&MultiGrayscaleAccessor::tabulatedLstar>(first, last, sa, result, da);
+            }
+            else
+            {
+                projectRowWith<&MultiGrayscaleAccessor::primedLstar>(first, last, sa, result, da);
+            }
+            break;
         case LIGHTNESS:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                ((std::min(x.red(), std::min(x.green(), x.blue())) +
-                  std::max(x.red(), std::max(x.green(), x.blue()))) /
-                 2.0);
+            projectRowWith<&MultiGrayscaleAccessor::lightness>(first, last, sa, result, da);
+            break;
         case VALUE:
-            return std::max(x.red(), std::max(x.green(), x.blue()));
+            projectRowWith<&MultiGrayscaleAccessor::value>(first, last, sa, result, da, ValueProjection());
+            break;
         case ANTI_VALUE:
-            return std::min(x.red(), std::min(x.green(), x.blue()));
+            projectRowWith<&MultiGrayscaleAccessor::antiValue>(first, last, sa, result, da, AntiValueProjection());
+            break;
         case LUMINANCE:
-            return vigra::NumericTraits<ResultType>::fromRealPromote(x.luminance());
+            projectRowWith<&MultiGrayscaleAccessor::luminance>(first, last, sa, result, da, LuminanceProjection());
+            break;
         case MIXER:
-            return vigra::NumericTraits<ResultType>::fromRealPromote
-                (redWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.red()) +
-                 greenWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.green()) +
-                 blueWeight * vigra::NumericTraits<ValueType>::toRealPromote(x.blue()));
+            projectRowWith<&MultiGrayscaleAccessor::mixer>(first, last, sa, result, da);
+            break;
         }
+    }
 
-        // never reached
-        return ResultType();
+    // grayscale
+    template <class SrcIterator, class SrcAccessor, class DestIterator, class DestAccessor>
+    void projectRow(SrcIterator first, SrcIterator last, SrcAccessor sa,
+                    DestIterator result, DestAccessor da, vigra::VigraTrueType) const {
+        for (; first != last; ++first, ++result)
+        {
+            da.set(ResultType(sa(first)), result);
+        }
     }
 
     // RGB
@@ -252,6 +689,8 @@ private:
     double redWeight, greenWeight, blueWeight;
     vigra::RGB2LabFunctor<double> rgb_to_lab_fun;
     vigra::RGBPrime2LabFunctor<double> rgb_prime_to_lab_fun;
+    vigra::XYZ2LabFunctor<double> xyz_to_lab_fun;
+    boost::shared_ptr<const std::vector<double> > luminanceTable; // shared between copies
 };
 
 } // namespace enblend
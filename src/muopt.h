@@ -44,6 +44,30 @@
 #endif
 
 
+// Instruction-set specific kernels.  Functions tagged with
+// TARGET_AVX2 are compiled for AVX2 regardless of the global
+// compiler flags; call them only if cpu_supports_avx2() is true.
+// SSE2 is part of the x86-64 baseline and enforced for 32-bit x86
+// release builds, so SSE2 kernels need no runtime check.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+
+#define HAVE_X86_SIMD_DISPATCH 1
+
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+namespace muopt
+{
+    inline static bool
+    cpu_supports_avx2()
+    {
+        static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+        return avx2;
+    }
+}
+
+#endif
+
+
 typedef enum {
     PREPARE_FOR_READ,
     PREPARE_FOR_WRITE
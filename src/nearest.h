@@ -31,9 +31,12 @@
 #include <math.h>
 #endif
 #include <stdlib.h>
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 #include <vigra/functorexpression.hxx>
+#include <vigra/initimage.hxx>
 #include <vigra/inspectimage.hxx>
 #include <vigra/numerictraits.hxx>
 
@@ -317,6 +320,764 @@ quick_tally(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
 }
 
 
+// Count the non-zero pixels in the rectangle [upperleft,
+// lowerright) and stop as soon as threshold is reached.
+template <class SrcImageIterator, class SrcAccessor>
+inline unsigned
+quick_tally_2d(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+               unsigned threshold)
+{
+    typedef typename SrcAccessor::value_type SrcValueType;
+
+    unsigned count = 0U;
+    for (SrcImageIterator y(src_upperleft); count < threshold && y.y != src_lowerright.y; ++y.y)
+    {
+        for (SrcImageIterator x(y); count < threshold && x.x != src_lowerright.x; ++x.x)
+        {
+            if (sa(x) != SrcValueType())
+            {
+                ++count;
+            }
+        }
+    }
+
+    return count;
+}
+
+
+// Functions that free the buffers of the shared
+// NearestFeatureWorkspace instances; see
+// releaseNearestFeatureWorkspaces().
+typedef void (*nft_release_function_t)();
+
+inline std::vector<nft_release_function_t>&
+nftReleaseFunctions()
+{
+    static std::vector<nft_release_function_t> functions;
+    return functions;
+}
+
+
+// Free the buffers of all shared NearestFeatureWorkspace instances.
+inline void
+releaseNearestFeatureWorkspaces()
+{
+    const std::vector<nft_release_function_t>& functions(nftReleaseFunctions());
+    for (std::vector<nft_release_function_t>::const_iterator f = functions.begin();
+         f != functions.end();
+         ++f)
+    {
+        (*f)();
+    }
+}
+
+
+// Scratch images of nearestFeatureTransform().  The shared instance
+// keeps the largest images requested so far and hands out their
+// upper-left corners, so that the transforms of one mask do not
+// allocate their buffers over and over.  It is not safe to run two
+// NFTs of the same pixel type concurrently on the shared instance.
+// The buffers live until the next call of
+// releaseNearestFeatureWorkspaces().
+template <class DiffPixelType, class DistancePixelType>
+class NearestFeatureWorkspace
+{
+public:
+    typedef IMAGETYPE<DiffPixelType> DiffImageType;
+    typedef IMAGETYPE<DistancePixelType> DistanceImageType;
+
+    NearestFeatureWorkspace() : capacity_(0, 0) {}
+
+    static NearestFeatureWorkspace& shared()
+    {
+        static NearestFeatureWorkspace workspace;
+        static const bool registered =
+            (nftReleaseFunctions().push_back(&NearestFeatureWorkspace::releaseShared), true);
+        (void) registered;
+        return workspace;
+    }
+
+    static void releaseShared()
+    {
+        shared().release();
+    }
+
+    void reserve(const vigra::Diff2D& size)
+    {
+        if (size.x > capacity_.x || size.y > capacity_.y)
+        {
+            capacity_ = vigra::Diff2D(std::max(size.x, capacity_.x), std::max(size.y, capacity_.y));
+            diff12.resize(capacity_);
+            diff21.resize(capacity_);
+            dist12.resize(capacity_);
+            dist21.resize(capacity_);
+        }
+    }
+
+    void release()
+    {
+        capacity_ = vigra::Diff2D(0, 0);
+        DiffImageType().swap(diff12);
+        DiffImageType().swap(diff21);
+        DistanceImageType().swap(dist12);
+        DistanceImageType().swap(dist21);
+    }
+
+    DiffImageType diff12;
+    DiffImageType diff21;
+    DistanceImageType dist12;
+    DistanceImageType dist21;
+
+private:
+    NearestFeatureWorkspace(const NearestFeatureWorkspace&);            // not implemented
+    NearestFeatureWorkspace& operator=(const NearestFeatureWorkspace&); // not implemented
+
+    vigra::Diff2D capacity_;
+};
+
+
+// Free the shared NFT buffers when an instance of this class goes
+// out of scope, no matter how the scope is left.
+class NearestFeatureWorkspaceScope
+{
+public:
+    NearestFeatureWorkspaceScope() {}
+
+    ~NearestFeatureWorkspaceScope()
+    {
+        releaseNearestFeatureWorkspaces();
+    }
+
+private:
+    NearestFeatureWorkspaceScope(const NearestFeatureWorkspaceScope&);            // not implemented
+    NearestFeatureWorkspaceScope& operator=(const NearestFeatureWorkspaceScope&); // not implemented
+};
+
+
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+inline void
+nftDistanceTransform(SrcImageIterator src_upperleft, SrcImageIterator src_lowerright, SrcAccessor sa,
+                     DestImageIterator dest_upperleft, DestAccessor da,
+                     nearest_neighbor_metric_t norm, boundary_t boundary)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+
+    const SrcPixelType background = vigra::NumericTraits<SrcPixelType>::zero();
+
+    switch (boundary)
+    {
+    case OpenBoundaries:
+        distanceTransformMP(src_upperleft, src_lowerright, sa,
+                            dest_upperleft, da,
+                            background, norm);
+        break;
+
+    case HorizontalStrip: // FALLTHROUGH
+    case VerticalStrip:   // FALLTHROUGH
+    case DoubleStrip:
+        periodicDistanceTransform(src_upperleft, src_lowerright, sa,
+                                  dest_upperleft, da,
+                                  background, norm, boundary);
+        break;
+
+    default:
+        throw never_reached("switch control expression \"boundary\" out of range");
+    }
+}
+
+
+// Arbitrary threshold of overlapping pixels below which we consider
+// the overlap of the masks to be complete, i.e. the image pair as
+// useless.
+//
+// The current value is 2x the circumference of the overlap
+// rectangle.
+inline unsigned
+nftOverlapThreshold(const vigra::Diff2D& size)
+{
+    return 2U * 2U * (static_cast<unsigned>(size.x) + static_cast<unsigned>(size.y));
+}
+
+
+inline void
+nftExcessiveOverlap(const vigra::Diff2D& size, unsigned overlap_threshold, unsigned overlap_tally)
+{
+    std::cerr << "\n" <<
+        command << ": excessive overlap detected; remove one of the images\n";
+#ifdef DEBUG_NEAREST_FEATURE_TRANSFORM
+    cout <<
+        "+ nearestFeatureTransform: overlap area size = " << size << "\n" <<
+        "+ nearestFeatureTransform: threshold is " << overlap_threshold <<
+        " pixels for this pair of images\n" <<
+        "+ nearestFeatureTransform: only " << overlap_tally << " of " <<
+        size.x * size.y << " pixels do not overlap\n";
+#else
+    (void) size;
+    (void) overlap_threshold;
+    (void) overlap_tally;
+#endif
+    exit(1);
+}
+
+
+inline void
+nftAnnounce()
+{
+    if (Verbose >= VERBOSE_NFT_MESSAGES)
+    {
+        std::cerr << command << ": info: creating ";
+        if (CoarseMask) {
+            std::cerr << "coarse/" << CoarsenessFactor;
+        } else {
+            std::cerr << "fine";
+        }
+        std::cerr << " blend mask: 1/3";
+        std::cerr.flush();
+    }
+}
+
+
+inline void
+nftProgress(const char* step)
+{
+    if (Verbose >= VERBOSE_NFT_MESSAGES)
+    {
+        std::cerr << step;
+        std::cerr.flush();
+    }
+}
+
+
+// Fill the difference images of workspace from the rectangle
+// [src1_upperleft, src1_lowerright) of both masks and answer the
+// larger of the two non-overlap tallies, which never exceeds
+// threshold.
+template <class SrcImageIterator, class SrcAccessor, class Workspace>
+unsigned
+nftDifferences(SrcImageIterator src1_upperleft, SrcImageIterator src1_lowerright, SrcAccessor sa1,
+               SrcImageIterator src2_upperleft, SrcAccessor sa2,
+               Workspace& workspace, unsigned threshold)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+    typedef typename Workspace::DiffImageType::traverser DiffIterator;
+
+    const vigra::Diff2D size(src1_lowerright.x - src1_upperleft.x,
+                             src1_lowerright.y - src1_upperleft.y);
+
+    workspace.reserve(size);
+
+    const DiffIterator diff12(workspace.diff12.upperLeft());
+    const DiffIterator diff21(workspace.diff21.upperLeft());
+
+    combineTwoImagesMP(src1_upperleft, src1_lowerright, sa1,
+                       src2_upperleft, sa2,
+                       diff12, workspace.diff12.accessor(),
+                       saturating_subtract<SrcPixelType>());
+    combineTwoImagesMP(src2_upperleft, src2_upperleft + size, sa2,
+                       src1_upperleft, sa1,
+                       diff21, workspace.diff21.accessor(),
+                       saturating_subtract<SrcPixelType>());
+
+    const unsigned tally12 = quick_tally_2d(diff12, diff12 + size, workspace.diff12.accessor(), threshold);
+    const unsigned tally21 = quick_tally_2d(diff21, diff21 + size, workspace.diff21.accessor(), threshold);
+
+    return std::max(tally12, tally21);
+}
+
+
+// Run the distance transforms of both difference images of
+// workspace, whose valid part has the given size.
+template <class Workspace>
+void
+nftDistances(const vigra::Diff2D& size, Workspace& workspace,
+             nearest_neighbor_metric_t norm, boundary_t boundary)
+{
+    typedef typename Workspace::DiffImageType::traverser DiffIterator;
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+
+    const DiffIterator diff12(workspace.diff12.upperLeft());
+    const DiffIterator diff21(workspace.diff21.upperLeft());
+    const DistanceIterator dist12(workspace.dist12.upperLeft());
+    const DistanceIterator dist21(workspace.dist21.upperLeft());
+
+    // The two distance transforms are independent of each other.
+    // Given at least two threads and nested parallelism we run them
+    // side by side, each one with half of the team.  Otherwise each
+    // of them alone gets all threads in turn.
+    const int number_of_threads = omp_get_max_threads();
+    const bool concurrent_transforms =
+        number_of_threads >= 2 && !omp_in_parallel() && have_openmp_nested();
+    omp::scoped_nested nested;
+    if (concurrent_transforms)
+    {
+        omp_set_nested(true);
+    }
+
+#ifdef OPENMP
+#pragma omp parallel sections num_threads(2) if (concurrent_transforms)
+#endif
+    {
+#ifdef OPENMP
+#pragma omp section
+#endif
+        {
+            if (concurrent_transforms)
+            {
+                omp_set_num_threads(std::max(1, number_of_threads / 2));
+            }
+            nftDistanceTransform(diff12, diff12 + size, workspace.diff12.accessor(),
+                                 dist12, workspace.dist12.accessor(),
+                                 norm, boundary);
+        }
+
+#ifdef OPENMP
+#pragma omp section
+#endif
+        {
+            if (concurrent_transforms)
+            {
+                omp_set_num_threads(std::max(1, number_of_threads - number_of_threads / 2));
+            }
+            nftDistanceTransform(diff21, diff21 + size, workspace.diff21.accessor(),
+                                 dist21, workspace.dist21.accessor(),
+                                 norm, boundary);
+        }
+    } // omp parallel sections
+}
+
+
+// Answer whether every pixel of rect (relative to the distance
+// images of workspace) has at least one of its two distances not
+// exceeding margin.
+template <class Workspace>
+bool
+nftWithinMargin(Workspace& workspace, const vigra::Rect2D& rect, int margin)
+{
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+    typedef typename Workspace::DistanceImageType::Accessor DistanceAccessor;
+    typedef typename DistanceAccessor::value_type DistancePixelType;
+
+    const DistancePixelType limit = static_cast<DistancePixelType>(margin);
+    const DistanceAccessor da12(workspace.dist12.accessor());
+    const DistanceAccessor da21(workspace.dist21.accessor());
+
+    DistanceIterator y12(workspace.dist12.upperLeft() + rect.upperLeft());
+    DistanceIterator y21(workspace.dist21.upperLeft() + rect.upperLeft());
+    const DistanceIterator end12(workspace.dist12.upperLeft() + rect.lowerRight());
+    for (; y12.y != end12.y; ++y12.y, ++y21.y)
+    {
+        DistanceIterator x12(y12);
+        DistanceIterator x21(y21);
+        for (; x12.x != end12.x; ++x12.x, ++x21.x)
+        {
+            if (std::min(da12(x12), da21(x21)) > limit)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Uncovered regions that are closer to each other than this many
+// pixels share one windowed transform in
+// overlapNearestFeatureTransform().
+#define NFT_REGION_MERGE_DISTANCE 16
+
+// Larger uncovered regions get split into tiles of at most this
+// size, each with its own windowed transform.
+#define NFT_REGION_TILE_SIZE 256
+
+
+// A run [begin, end) of uncovered pixels of one row; index refers to
+// the union-find forest of nftUncoveredRegions().
+struct NftRun
+{
+    NftRun(int i, int b, int e) : index(i), begin(b), end(e) {}
+
+    int index;
+    int begin;
+    int end;
+};
+
+
+inline int
+nftFindRegion(std::vector<int>& parent, int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+
+// Answer the bounding box of the pixels of rect (relative to
+// src1_upperleft) that neither src1 nor src2 covers.  The box is
+// empty if the two images cover all of rect.
+template <class SrcImageIterator, class SrcAccessor>
+vigra::Rect2D
+nftUncoveredBounds(SrcImageIterator src1_upperleft, SrcAccessor sa1,
+                   SrcImageIterator src2_upperleft, SrcAccessor sa2,
+                   const vigra::Rect2D& rect)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+
+    const SrcPixelType zero(vigra::NumericTraits<SrcPixelType>::zero());
+    vigra::Rect2D bounds;
+
+    SrcImageIterator y1(src1_upperleft + rect.upperLeft());
+    SrcImageIterator y2(src2_upperleft + rect.upperLeft());
+    for (int y = rect.top(); y != rect.bottom(); ++y, ++y1.y, ++y2.y)
+    {
+        SrcImageIterator x1(y1);
+        SrcImageIterator x2(y2);
+        for (int x = rect.left(); x != rect.right(); ++x, ++x1.x, ++x2.x)
+        {
+            if (sa1(x1) == zero && sa2(x2) == zero)
+            {
+                bounds |= vigra::Point2D(x, y);
+            }
+        }
+    }
+
+    return bounds;
+}
+
+
+// Answer the rectangles that hold the pixels that neither src1 nor
+// src2 covers, leaving out the ones that lie inside of inner.  We
+// find the bounding boxes of the 8-connected regions of these pixels
+// by joining their runs row by row in a union-find forest, which
+// needs memory in proportion to the number of runs instead of a
+// label image.  Regions closer than NFT_REGION_MERGE_DISTANCE to
+// each other share a box.  Boxes larger than NFT_REGION_TILE_SIZE
+// get split into tiles, of which we keep the bounding boxes of their
+// uncovered pixels, so that for example a thin diagonal region does
+// not answer its whole bounding box.
+template <class SrcImageIterator, class SrcAccessor>
+std::vector<vigra::Rect2D>
+nftUncoveredRegions(SrcImageIterator src1_upperleft, SrcImageIterator src1_lowerright, SrcAccessor sa1,
+                    SrcImageIterator src2_upperleft, SrcAccessor sa2,
+                    const vigra::Rect2D& inner)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+
+    const SrcPixelType zero(vigra::NumericTraits<SrcPixelType>::zero());
+    const int width = src1_lowerright.x - src1_upperleft.x;
+
+    std::vector<int> parent;
+    std::vector<vigra::Rect2D> bounds; // valid for the roots of parent
+    std::vector<NftRun> previous_row;
+    std::vector<NftRun> current_row;
+
+    SrcImageIterator y1(src1_upperleft);
+    SrcImageIterator y2(src2_upperleft);
+    for (int y = 0; y1.y != src1_lowerright.y; ++y, ++y1.y, ++y2.y)
+    {
+        SrcImageIterator x1(y1);
+        SrcImageIterator x2(y2);
+        std::vector<NftRun>::const_iterator previous = previous_row.begin();
+
+        current_row.clear();
+        for (int x = 0; x < width;)
+        {
+            if (!(sa1(x1) == zero && sa2(x2) == zero))
+            {
+                ++x, ++x1.x, ++x2.x;
+                continue;
+            }
+
+            const int begin = x;
+            while (x < width && sa1(x1) == zero && sa2(x2) == zero)
+            {
+                ++x, ++x1.x, ++x2.x;
+            }
+
+            const int run = static_cast<int>(parent.size());
+            parent.push_back(run);
+            bounds.push_back(vigra::Rect2D(begin, y, x, y + 1));
+            current_row.push_back(NftRun(run, begin, x));
+
+            // Runs of the previous row that touch [begin - 1, x + 1)
+            while (previous != previous_row.end() && previous->end < begin)
+            {
+                ++previous;
+            }
+            for (std::vector<NftRun>::const_iterator p = previous;
+                 p != previous_row.end() && p->begin <= x;
+                 ++p)
+            {
+                const int root = nftFindRegion(parent, run);
+                const int other = nftFindRegion(parent, p->index);
+                if (root != other)
+                {
+                    parent[other] = root;
+                    bounds[root] |= bounds[other];
+                }
+            }
+        }
+
+        previous_row.swap(current_row);
+    }
+
+    std::vector<vigra::Rect2D> regions;
+    for (int run = 0; run != static_cast<int>(parent.size()); ++run)
+    {
+        if (parent[run] != run || inner.contains(bounds[run]))
+        {
+            continue;
+        }
+
+        vigra::Rect2D neighborhood(bounds[run]);
+        neighborhood.addBorder(NFT_REGION_MERGE_DISTANCE);
+        std::vector<vigra::Rect2D>::iterator r = regions.begin();
+        while (r != regions.end() && !neighborhood.intersects(*r))
+        {
+            ++r;
+        }
+        if (r == regions.end())
+        {
+            regions.push_back(bounds[run]);
+        }
+        else
+        {
+            *r |= bounds[run];
+        }
+    }
+
+    std::vector<vigra::Rect2D> tiles;
+    for (std::vector<vigra::Rect2D>::const_iterator r = regions.begin(); r != regions.end(); ++r)
+    {
+        if (r->width() <= NFT_REGION_TILE_SIZE && r->height() <= NFT_REGION_TILE_SIZE)
+        {
+            tiles.push_back(*r);
+            continue;
+        }
+
+        for (int y = r->top(); y < r->bottom(); y += NFT_REGION_TILE_SIZE)
+        {
+            for (int x = r->left(); x < r->right(); x += NFT_REGION_TILE_SIZE)
+            {
+                const vigra::Rect2D tile(vigra::Rect2D(x, y,
+                                                       x + NFT_REGION_TILE_SIZE,
+                                                       y + NFT_REGION_TILE_SIZE) & *r);
+                if (!inner.contains(tile))
+                {
+                    const vigra::Rect2D bounds(nftUncoveredBounds(src1_upperleft, sa1,
+                                                                  src2_upperleft, sa2,
+                                                                  tile));
+                    if (!bounds.isEmpty())
+                    {
+                        tiles.push_back(bounds);
+                    }
+                }
+            }
+        }
+    }
+
+    return tiles;
+}
+
+
+// Answer how far away the nearer feature of the pixels of rect
+// (relative to src1_upperleft) that neither src1 nor src2 covers
+// lies at most, going by the distance images of workspace, which
+// belong to window.  The answer is -1 if at least one of these
+// pixels has no feature inside of window at all.  As the features
+// inside of window are a subset of all features, a window with a
+// margin of the answer around rect always suffices.
+template <class SrcImageIterator, class SrcAccessor, class Workspace>
+int
+nftUncoveredReach(SrcImageIterator src1_upperleft, SrcAccessor sa1,
+                  SrcImageIterator src2_upperleft, SrcAccessor sa2,
+                  Workspace& workspace, const vigra::Rect2D& window,
+                  const vigra::Rect2D& rect)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+    typedef typename Workspace::DistanceImageType::Accessor DistanceAccessor;
+    typedef typename DistanceAccessor::value_type DistancePixelType;
+    typedef vigra::NumericTraits<DistancePixelType> DistancePixelTraits;
+
+    const SrcPixelType zero(vigra::NumericTraits<SrcPixelType>::zero());
+    const DistancePixelType infinity(DistancePixelTraits::max());
+    const DistanceAccessor da12(workspace.dist12.accessor());
+    const DistanceAccessor da21(workspace.dist21.accessor());
+    const vigra::Diff2D offset(rect.upperLeft() - window.upperLeft());
+    DistancePixelType reach(DistancePixelTraits::zero());
+
+    SrcImageIterator y1(src1_upperleft + rect.upperLeft());
+    SrcImageIterator y2(src2_upperleft + rect.upperLeft());
+    DistanceIterator y12(workspace.dist12.upperLeft() + offset);
+    DistanceIterator y21(workspace.dist21.upperLeft() + offset);
+    const SrcImageIterator end1(src1_upperleft + rect.lowerRight());
+    for (; y1.y != end1.y; ++y1.y, ++y2.y, ++y12.y, ++y21.y)
+    {
+        SrcImageIterator x1(y1);
+        SrcImageIterator x2(y2);
+        DistanceIterator x12(y12);
+        DistanceIterator x21(y21);
+        for (; x1.x != end1.x; ++x1.x, ++x2.x, ++x12.x, ++x21.x)
+        {
+            if (sa1(x1) == zero && sa2(x2) == zero)
+            {
+                const DistancePixelType distance = std::min(da12(x12), da21(x21));
+                if (distance == infinity)
+                {
+                    return -1;
+                }
+                reach = std::max(reach, distance);
+            }
+        }
+    }
+
+    return static_cast<int>(std::ceil(static_cast<double>(reach)));
+}
+
+
+// Run the distance transforms of the difference images of
+// workspace, whose valid part has the given size, and answer whether
+// they contain any feature at all.  A difference image without
+// features gets the largest distance everywhere instead of a
+// transform.  Its pixels then lose every comparison, which is right
+// for all pixels that have a feature of the other image within the
+// margin of the window: the missing features all lie outside of the
+// window, thus farther away than that.
+template <class Workspace>
+bool
+nftWindowDistances(const vigra::Diff2D& size, Workspace& workspace, nearest_neighbor_metric_t norm)
+{
+    typedef typename Workspace::DiffImageType::traverser DiffIterator;
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+    typedef typename Workspace::DistanceImageType::Accessor DistanceAccessor;
+    typedef typename DistanceAccessor::value_type DistancePixelType;
+    typedef vigra::NumericTraits<DistancePixelType> DistancePixelTraits;
+
+    const DiffIterator diff12(workspace.diff12.upperLeft());
+    const DiffIterator diff21(workspace.diff21.upperLeft());
+    const DistanceIterator dist12(workspace.dist12.upperLeft());
+    const DistanceIterator dist21(workspace.dist21.upperLeft());
+
+    const bool features12 = quick_tally_2d(diff12, diff12 + size, workspace.diff12.accessor(), 1U) != 0U;
+    const bool features21 = quick_tally_2d(diff21, diff21 + size, workspace.diff21.accessor(), 1U) != 0U;
+
+    if (features12 && features21)
+    {
+        nftDistances(size, workspace, norm, OpenBoundaries);
+    }
+    else if (features12)
+    {
+        nftDistanceTransform(diff12, diff12 + size, workspace.diff12.accessor(),
+                             dist12, workspace.dist12.accessor(),
+                             norm, OpenBoundaries);
+        vigra::initImage(dist21, dist21 + size, workspace.dist21.accessor(), DistancePixelTraits::max());
+    }
+    else if (features21)
+    {
+        nftDistanceTransform(diff21, diff21 + size, workspace.diff21.accessor(),
+                             dist21, workspace.dist21.accessor(),
+                             norm, OpenBoundaries);
+        vigra::initImage(dist12, dist12 + size, workspace.dist12.accessor(), DistancePixelTraits::max());
+    }
+
+    return features12 || features21;
+}
+
+
+// Set the mask values of the pixels of region (relative to
+// src1_upperleft) that neither src1 nor src2 covers.  Like the
+// transform of the overlap in overlapNearestFeatureTransform(), the
+// distance transforms run on a window around region, whose margin
+// grows until the nearer feature of each of these pixels lies inside
+// of it.  A failed window tells how far these features lie at most
+// (see nftUncoveredReach()), so it takes at most one more window
+// unless some pixel found no feature at all.
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor,
+          class Workspace>
+void
+nftUncoveredRegion(SrcImageIterator src1_upperleft, SrcAccessor sa1,
+                   SrcImageIterator src2_upperleft, SrcAccessor sa2,
+                   DestImageIterator dest_upperleft, DestAccessor da,
+                   nearest_neighbor_metric_t norm,
+                   const vigra::Rect2D& whole, const vigra::Rect2D& region,
+                   Workspace& workspace)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+    typedef typename DestAccessor::value_type DestPixelType;
+    typedef vigra::NumericTraits<DestPixelType> DestPixelTraits;
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+    typedef typename Workspace::DistanceImageType::Accessor DistanceAccessor;
+
+    // A failed guess costs one extra window only, so we start with a
+    // smaller margin than for overlap.
+    int margin = (std::min(region.width(), region.height()) + 1) / 4 + 2;
+    vigra::Rect2D window;
+    while (true)
+    {
+        window = region;
+        window.addBorder(margin);
+        window &= whole;
+
+        const bool complete = window == whole;
+        const vigra::Diff2D window_size(window.size());
+        nftDifferences(src1_upperleft + window.upperLeft(),
+                       src1_upperleft + window.lowerRight(), sa1,
+                       src2_upperleft + window.upperLeft(), sa2,
+                       workspace, 0U);
+        if (!nftWindowDistances(window_size, workspace, norm) && !complete)
+        {
+            margin *= 2;
+            continue;
+        }
+
+        if (complete)
+        {
+            break;
+        }
+        const int reach = nftUncoveredReach(src1_upperleft, sa1, src2_upperleft, sa2,
+                                            workspace, window, region);
+        if (reach >= 0 && reach <= margin)
+        {
+            break;
+        }
+        margin = reach > margin ? reach : 2 * margin;
+    }
+
+    const SrcPixelType zero(vigra::NumericTraits<SrcPixelType>::zero());
+    const DistanceAccessor da12(workspace.dist12.accessor());
+    const DistanceAccessor da21(workspace.dist21.accessor());
+    const vigra::Diff2D offset(region.upperLeft() - window.upperLeft());
+
+    SrcImageIterator y1(src1_upperleft + region.upperLeft());
+    SrcImageIterator y2(src2_upperleft + region.upperLeft());
+    DistanceIterator y12(workspace.dist12.upperLeft() + offset);
+    DistanceIterator y21(workspace.dist21.upperLeft() + offset);
+    DestImageIterator yd(dest_upperleft + region.upperLeft());
+    const SrcImageIterator end1(src1_upperleft + region.lowerRight());
+    for (; y1.y != end1.y; ++y1.y, ++y2.y, ++y12.y, ++y21.y, ++yd.y)
+    {
+        SrcImageIterator x1(y1);
+        SrcImageIterator x2(y2);
+        DistanceIterator x12(y12);
+        DistanceIterator x21(y21);
+        DestImageIterator xd(yd);
+        for (; x1.x != end1.x; ++x1.x, ++x2.x, ++x12.x, ++x21.x, ++xd.x)
+        {
+            if (sa1(x1) == zero && sa2(x2) == zero)
+            {
+                da.set(da12(x12) < da21(x21) ? DestPixelTraits::max() : DestPixelTraits::zero(), xd);
+            }
+        }
+    }
+}
+
+
 // Compute a mask (dest) that defines the seam line given the
 // blackmask (src1) and the whitemask (src2) of the overlapping
 // images.
@@ -350,123 +1111,177 @@ nearestFeatureTransform(SrcImageIterator src1_upperleft, SrcImageIterator src1_l
     typedef typename DestAccessor::value_type DestPixelType;
     typedef vigra::NumericTraits<DestPixelType> DestPixelTraits;
 
-    const SrcPixelType background = SrcPixelTraits::zero();
+    typedef NearestFeatureWorkspace<SrcPixelType, SrcPromoteType> Workspace;
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+
     const vigra::Diff2D size(src1_lowerright.x - src1_upperleft.x,
                              src1_lowerright.y - src1_upperleft.y);
 
-    IMAGETYPE<SrcPromoteType> dist12(size);
-    IMAGETYPE<SrcPromoteType> dist21(size);
-    if (Verbose >= VERBOSE_NFT_MESSAGES)
+    Workspace local_workspace;
+    Workspace& workspace =
+        enblend::parameter::as_boolean("reuse-nft-buffers", true) ? Workspace::shared() : local_workspace;
+
+    nftAnnounce();
+
+    const unsigned overlap_threshold = nftOverlapThreshold(size);
+    const unsigned overlap_tally = nftDifferences(src1_upperleft, src1_lowerright, sa1,
+                                                  src2_upperleft, sa2,
+                                                  workspace, overlap_threshold);
+    // Both tallies are known before the expensive distance
+    // transforms, so we can bail out early.
+    if (overlap_tally < overlap_threshold)
     {
-        std::cerr << command << ": info: creating ";
-        if (CoarseMask) {
-            std::cerr << "coarse/" << CoarsenessFactor;
-        } else {
-            std::cerr << "fine";
-        }
-        std::cerr << " blend mask: 1/3";
-        std::cerr.flush();
+        nftExcessiveOverlap(size, overlap_threshold, overlap_tally);
     }
 
-    const unsigned overlap_threshold =
-        // Arbitrary threshold of overlapping pixels below which we
-        // consider the overlap of the masks to be complete, i.e. the
-        // image pair as useless.
-        //
-        // The current value is 2x the circumference of the overlap
-        // rectangle.
-        2U * 2U * (static_cast<unsigned>(size.x) + static_cast<unsigned>(size.y));
-    unsigned tally12;
-    unsigned tally21;
+    nftProgress(" 2/3");
+    nftDistances(size, workspace, norm, boundary);
+    nftProgress(" 3/3");
 
-    IMAGETYPE<SrcPixelType> diff12(size);
-    combineTwoImagesMP(src1_upperleft, src1_lowerright, sa1,
-                       src2_upperleft, sa2,
-                       diff12.upperLeft(), diff12.accessor(),
-                       saturating_subtract<SrcPixelType>());
+    const DistanceIterator dist12(workspace.dist12.upperLeft());
+    const DistanceIterator dist21(workspace.dist21.upperLeft());
 
-    tally12 = quick_tally(diff12.begin(), diff12.end(), diff12.accessor(),
-                          overlap_threshold);
+    combineTwoImagesMP(dist12, dist12 + size, workspace.dist12.accessor(),
+                       dist21, workspace.dist21.accessor(),
+                       dest_upperleft, da,
+                       ifThenElse(vigra::functor::Arg1() < vigra::functor::Arg2(),
+                                  vigra::functor::Param(DestPixelTraits::max()),
+                                  vigra::functor::Param(DestPixelTraits::zero())));
 
-    switch (boundary)
+    if (Verbose >= VERBOSE_NFT_MESSAGES)
     {
-    case OpenBoundaries:
-        distanceTransformMP(srcImageRange(diff12), destImage(dist12),
-                            background, norm);
-        break;
+        std::cerr << std::endl;
+    }
+}
 
-    case HorizontalStrip: // FALLTHROUGH
-    case VerticalStrip:   // FALLTHROUGH
-    case DoubleStrip:
-        periodicDistanceTransform(srcImageRange(diff12), destImage(dist12),
-                                  background, norm, boundary);
-        break;
 
-    default:
-        throw never_reached("switch control expression \"boundary\" out of range");
-    }
+// Variant of nearestFeatureTransform() for open boundaries that
+// confines the distance transforms to the rectangle overlap
+// (relative to src1_upperleft) plus a margin.  Outside of overlap a
+// pixel belongs to at most one of the images.  If it belongs to
+// exactly one, its mask value follows directly from src1.  Pixels
+// that neither image covers get their value from the distances just
+// like the pixels of overlap.  Their regions can lie anywhere in the
+// image, so each group of them outside of overlap gets a windowed
+// transform of its own (see nftUncoveredRegion()) instead of
+// stretching the window of overlap across the image.
+//
+// Inside of overlap the result equals that of
+// nearestFeatureTransform() whenever the nearer of a pixel's two
+// features lies no farther away than the margin, because every
+// feature outside of the window lies farther away than that.  We
+// check this for all pixels of overlap and double the margin
+// until it holds, which in the worst case makes the window cover the
+// whole image.
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+void
+overlapNearestFeatureTransform(SrcImageIterator src1_upperleft, SrcImageIterator src1_lowerright, SrcAccessor sa1,
+                               SrcImageIterator src2_upperleft, SrcAccessor sa2,
+                               DestImageIterator dest_upperleft, DestAccessor da,
+                               nearest_neighbor_metric_t norm, const vigra::Rect2D& overlap)
+{
+    typedef typename SrcAccessor::value_type SrcPixelType;
+    typedef vigra::NumericTraits<SrcPixelType> SrcPixelTraits;
+    typedef typename SrcPixelTraits::Promote SrcPromoteType;
 
-    if (Verbose >= VERBOSE_NFT_MESSAGES)
+    typedef typename DestAccessor::value_type DestPixelType;
+    typedef vigra::NumericTraits<DestPixelType> DestPixelTraits;
+
+    typedef NearestFeatureWorkspace<SrcPixelType, SrcPromoteType> Workspace;
+    typedef typename Workspace::DistanceImageType::traverser DistanceIterator;
+
+    const vigra::Diff2D size(src1_lowerright.x - src1_upperleft.x,
+                             src1_lowerright.y - src1_upperleft.y);
+    const vigra::Rect2D whole(vigra::Point2D(0, 0), vigra::Size2D(size));
+    const vigra::Rect2D inner(overlap & whole);
+
+    if (inner.isEmpty())
     {
-        std::cerr << " 2/3";
-        std::cerr.flush();
+        nearestFeatureTransform(src1_upperleft, src1_lowerright, sa1,
+                                src2_upperleft, sa2,
+                                dest_upperleft, da,
+                                norm, OpenBoundaries);
+        return;
     }
-    IMAGETYPE<SrcPixelType> diff21(size);
-    combineTwoImagesMP(src2_upperleft, src2_upperleft + size, sa2,
-                       src1_upperleft, sa1,
-                       diff21.upperLeft(), diff21.accessor(),
-                       saturating_subtract<SrcPixelType>());
 
-    tally21 = quick_tally(diff21.begin(), diff21.end(), diff21.accessor(),
-                          overlap_threshold);
+    Workspace local_workspace;
+    Workspace& workspace =
+        enblend::parameter::as_boolean("reuse-nft-buffers", true) ? Workspace::shared() : local_workspace;
 
-    switch (boundary)
-    {
-    case OpenBoundaries:
-        distanceTransformMP(srcImageRange(diff21), destImage(dist21),
-                            background, norm);
-        break;
+    nftAnnounce();
 
-    case HorizontalStrip: // FALLTHROUGH
-    case VerticalStrip:   // FALLTHROUGH
-    case DoubleStrip:
-        periodicDistanceTransform(srcImageRange(diff21), destImage(dist21),
-                                  background, norm, boundary);
-        break;
+    transformImageMP(src1_upperleft, src1_lowerright, sa1,
+                     dest_upperleft, da,
+                     ifThenElse(vigra::functor::Arg1() == vigra::functor::Param(SrcPixelTraits::zero()),
+                                vigra::functor::Param(DestPixelTraits::zero()),
+                                vigra::functor::Param(DestPixelTraits::max())));
 
-    default:
-        throw never_reached("switch control expression \"boundary\" out of range");
-    }
+    const std::vector<vigra::Rect2D> regions(nftUncoveredRegions(src1_upperleft, src1_lowerright, sa1,
+                                                                 src2_upperleft, sa2,
+                                                                 inner));
 
-    if (Verbose >= VERBOSE_NFT_MESSAGES)
-    {
-        std::cerr << " 3/3";
-        std::cerr.flush();
-    }
+    nftProgress(" 2/3");
 
-    const unsigned overlap_tally = std::max(tally12, tally21);
-    if (overlap_tally < overlap_threshold)
+    // Features directly outside of overlap are at most half of its
+    // smaller side away from any of its pixels, which makes a good
+    // first guess for the margin.
+    int margin = (std::min(inner.width(), inner.height()) + 1) / 2 + 2;
+    vigra::Rect2D window;
+    while (true)
     {
-        std::cerr << "\n" <<
-            command << ": excessive overlap detected; remove one of the images\n";
-#ifdef DEBUG_NEAREST_FEATURE_TRANSFORM
-        cout <<
-            "+ nearestFeatureTransform: overlap area size = " << size << "\n" <<
-            "+ nearestFeatureTransform: threshold is " << overlap_threshold <<
-            " pixels for this pair of images\n" <<
-            "+ nearestFeatureTransform: only " << overlap_tally << " of " <<
-            size.x * size.y << " pixels do not overlap\n";
-#endif
-        exit(1);
+        window = inner;
+        window.addBorder(margin);
+        window &= whole;
+
+        const bool complete = window == whole;
+        const vigra::Diff2D window_size(window.size());
+        const unsigned overlap_threshold = nftOverlapThreshold(window_size);
+        const unsigned overlap_tally = nftDifferences(src1_upperleft + window.upperLeft(),
+                                                      src1_upperleft + window.lowerRight(), sa1,
+                                                      src2_upperleft + window.upperLeft(), sa2,
+                                                      workspace, overlap_threshold);
+        if (overlap_tally < overlap_threshold)
+        {
+            if (complete)
+            {
+                nftExcessiveOverlap(size, overlap_threshold, overlap_tally);
+            }
+            margin *= 2;
+            continue;
+        }
+
+        // The tally guarantees features in the window.
+        nftWindowDistances(window_size, workspace, norm);
+
+        if (complete ||
+            nftWithinMargin(workspace, vigra::Rect2D(inner).moveBy(-window.upperLeft()), margin))
+        {
+            break;
+        }
+        margin *= 2;
     }
 
-    combineTwoImagesMP(dist12.upperLeft(), dist12.lowerRight(), dist12.accessor(),
-                       dist21.upperLeft(), dist21.accessor(),
-                       dest_upperleft, da,
+    nftProgress(" 3/3");
+
+    const vigra::Diff2D offset(inner.upperLeft() - window.upperLeft());
+    const DistanceIterator dist12(workspace.dist12.upperLeft() + offset);
+    const DistanceIterator dist21(workspace.dist21.upperLeft() + offset);
+
+    combineTwoImagesMP(dist12, dist12 + inner.size(), workspace.dist12.accessor(),
+                       dist21, workspace.dist21.accessor(),
+                       dest_upperleft + inner.upperLeft(), da,
                        ifThenElse(vigra::functor::Arg1() < vigra::functor::Arg2(),
                                   vigra::functor::Param(DestPixelTraits::max()),
                                   vigra::functor::Param(DestPixelTraits::zero())));
 
+    for (std::vector<vigra::Rect2D>::const_iterator r = regions.begin(); r != regions.end(); ++r)
+    {
+        nftUncoveredRegion(src1_upperleft, sa1, src2_upperleft, sa2,
+                           dest_upperleft, da,
+                           norm, whole, *r, workspace);
+    }
+
     if (Verbose >= VERBOSE_NFT_MESSAGES)
     {
         std::cerr << std::endl;
@@ -474,6 +1289,21 @@ nearestFeatureTransform(SrcImageIterator src1_upperleft, SrcImageIterator src1_l
 }
 
 
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor>
+inline void
+overlapNearestFeatureTransform(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src1,
+                               vigra::pair<SrcImageIterator, SrcAccessor> src2,
+                               vigra::pair<DestImageIterator, DestAccessor> dest,
+                               nearest_neighbor_metric_t norm, const vigra::Rect2D& overlap)
+{
+    overlapNearestFeatureTransform(src1.first, src1.second, src1.third,
+                                   src2.first, src2.second,
+                                   dest.first, dest.second,
+                                   norm, overlap);
+}
+
+
 template <class SrcImageIterator, class SrcAccessor,
           class DestImageIterator, class DestAccessor>
 inline void
@@ -47,6 +47,9 @@ struct EnblendNumericTraits {
     typedef Error_EnblendNumericTraits_not_specialized_for_this_case ImagePixelType;
     typedef Error_EnblendNumericTraits_not_specialized_for_this_case ImageType;
     typedef Error_EnblendNumericTraits_not_specialized_for_this_case ImageIsScalar;
+    // Number of distinct values of ImagePixelComponentType if it is
+    // small enough to tabulate functions of it, otherwise zero.
+    enum { ImagePixelComponentLevels = 0 };
     typedef Error_EnblendNumericTraits_not_specialized_for_this_case AlphaPixelType;
     typedef Error_EnblendNumericTraits_not_specialized_for_this_case AlphaType;
 
@@ -76,6 +79,27 @@ struct EnblendNumericTraits {
     typedef Error_EnblendNumericTraits_not_specialized_for_this_case SKIPSMMaskPixelType;
 };
 
+// Integral types of at most 16 bits have few enough values for a
+// lookup table indexed by value.
+#define LOOKUP_TABLE_LEVELS(T) \
+    (vigra::NumericTraits<T>::isIntegral::asBool && sizeof(T) <= 2U ? \
+     1 << (8U * (sizeof(T) <= 2U ? sizeof(T) : 0U)) : \
+     0)
+
+// Map a number of levels from LOOKUP_TABLE_LEVELS() to a type that
+// selects between tabulated and computed code paths.
+template <int Levels>
+struct LookupTableSelector
+{
+    typedef vigra::VigraTrueType type;
+};
+
+template <>
+struct LookupTableSelector<0>
+{
+    typedef vigra::VigraFalseType type;
+};
+
 #define DEFINE_ENBLENDNUMERICTRAITS(IMAGE, IMAGECOMPONENT, ALPHA, MASK, PYRAMIDCOMPONENT, PYRAMIDINTEGER, PYRAMIDFRACTION, SKIPSMIMAGE, SKIPSMALPHA, MASKPYRAMID, MASKPYRAMIDINTEGER, MASKPYRAMIDFRACTION, SKIPSMMASK) \
 template<> \
 struct EnblendNumericTraits<IMAGECOMPONENT> { \
@@ -83,6 +107,7 @@ struct EnblendNumericTraits<IMAGECOMPONENT> { \
     typedef IMAGECOMPONENT ImagePixelType; \
     typedef IMAGE<IMAGECOMPONENT> ImageType; \
     typedef vigra::VigraTrueType ImageIsScalar; \
+    enum {ImagePixelComponentLevels = LOOKUP_TABLE_LEVELS(IMAGECOMPONENT)}; \
     typedef ALPHA AlphaPixelType; \
     typedef IMAGE<ALPHA> AlphaType; \
     typedef MASK MaskPixelType; \
@@ -107,6 +132,7 @@ struct EnblendNumericTraits<vigra::RGBValue<IMAGECOMPONENT,0,1,2> > { \
     typedef vigra::RGBValue<IMAGECOMPONENT,0,1,2> ImagePixelType; \
     typedef IMAGE<vigra::RGBValue<IMAGECOMPONENT,0,1,2> > ImageType; \
     typedef vigra::VigraFalseType ImageIsScalar;                     \
+    enum {ImagePixelComponentLevels = LOOKUP_TABLE_LEVELS(IMAGECOMPONENT)}; \
     typedef ALPHA AlphaPixelType; \
     typedef IMAGE<ALPHA> AlphaType; \
     typedef MASK MaskPixelType; \
@@ -24,9 +24,13 @@
 #include <config.h>
 #endif
 
+#include <exception>
 #include <limits>
+#include <new>
+#include <string>
 
 #include <vigra/diff2d.hxx>
+#include <vigra/error.hxx>
 #include <vigra/initimage.hxx>
 #include <vigra/inspectimage.hxx>
 #include <vigra/transformimage.hxx>
@@ -392,6 +396,13 @@ namespace detail
     };
 
 
+    // Number of adjacent columns that the column pass of
+    // fhDistanceTransform() gathers into one contiguous strip.  Each
+    // source row then is read as a short run of neighboring pixels
+    // instead of a single pixel per full-row stride.
+    const int column_block_width = 16;
+
+
     template <class SrcImageIterator, class SrcAccessor,
               class DestImageIterator, class DestAccessor,
               class ValueType, class Transform1dFunctor>
@@ -405,41 +416,51 @@ namespace detail
         typedef vigra::BasicImage<DistanceType> DistanceImageType;
 
         const vigra::Size2D size(src_lowerright - src_upperleft);
-        const int greatest_length = std::max(size.x, size.y);
+        const int number_of_strips = (size.x + column_block_width - 1) / column_block_width;
         DistanceImageType intermediate(size, vigra::SkipInitialization);
 
 #pragma omp parallel
         {
-            DistanceType* const f = new DistanceType[greatest_length];
-            DistanceType* const d = new DistanceType[greatest_length];
-
-            DistanceType* const pf_end = f + size.y;
-            const DistanceType* const pd_end = d + size.y;
+            DistanceType* const f = new DistanceType[column_block_width * size.y];
+            DistanceType* const g = new DistanceType[column_block_width * size.y];
+            DistanceType* const d = new DistanceType[size.x];
 
 // IMPLEMENTATION NOTE
 //     We need "guided" schedule to reduce the waiting time at the
 //     (implicit) barriers.  This holds true for the next OpenMP
 //     parallelized "for" loop, too.
 #pragma omp for schedule(guided)
-            for (int x = 0; x < size.x; ++x)
+            for (int strip = 0; strip < number_of_strips; ++strip)
             {
-                SrcImageIterator si(src_upperleft + vigra::Diff2D(x, 0));
-                for (DistanceType* pf = f; pf != pf_end; ++pf)
+                const int x_begin = strip * column_block_width;
+                const int width = std::min(column_block_width, size.x - x_begin);
+
+                // Gather the strip column-major into f.
+                SrcImageIterator si(src_upperleft + vigra::Diff2D(x_begin, 0));
+                for (int y = 0; y < size.y; ++y, ++si.y)
                 {
-                    *pf = EXPECT_RESULT(sa(si) == background, false) ? DistanceTraits::max() : DistanceTraits::zero();
-                    ++si.y;
+                    SrcImageIterator sx(si);
+                    DistanceType* pf = f + y;
+                    for (int c = 0; c < width; ++c, ++sx.x, pf += size.y)
+                    {
+                        *pf = EXPECT_RESULT(sa(sx) == background, false) ? DistanceTraits::max() : DistanceTraits::zero();
+                    }
                 }
 
-                transform1d(d, f, size.y);
+                for (int c = 0; c < width; ++c)
+                {
+                    transform1d(g + c * size.y, f + c * size.y, size.y);
+                }
 
-                typename DistanceImageType::column_iterator ci(intermediate.columnBegin(x));
-                for (const DistanceType* pd = d; pd != pd_end; ++pd)
+                // Scatter the transformed columns row by row.
+                for (int y = 0; y < size.y; ++y)
                 {
-                    *ci = *pd;
-                    ++ci;
-                    // IMPLEMENTATION NOTE
-                    //     Prefetching about halves the number of stalls per instruction of this loop.
-                    HINTED_PREFETCH(ci.operator->(), PREPARE_FOR_WRITE, HIGH_TEMPORAL_LOCALITY);
+                    DistanceType* const row = &intermediate(x_begin, y);
+                    const DistanceType* pg = g + y;
+                    for (int c = 0; c < width; ++c, pg += size.y)
+                    {
+                        row[c] = *pg;
+                    }
                 }
             }
 
@@ -466,6 +487,7 @@ namespace detail
             }
 
             delete [] d;
+            delete [] g;
             delete [] f;
         } // omp parallel
     }
@@ -681,6 +703,78 @@ distanceTransformMP(SrcImageIterator src_upperleft, SrcImageIterator src_lowerri
 #endif // _OPENMP >= 200505
 
 
+namespace omp
+{
+    // An exception that escapes the structured block of a parallel
+    // region calls std::terminate().  Worksharing loops therefore
+    // catch everything, record the first exception in an
+    // exception_store, and the master thread rethrows it once the
+    // region has been left.  We have no std::exception_ptr, so only
+    // the kind and the message survive the trip.
+    class forwarded_exception : public vigra::StdException
+    {
+    public:
+        explicit forwarded_exception(const std::string& message) : message_(message) {}
+        virtual ~forwarded_exception() throw() {}
+        virtual const char* what() const throw() {return message_.c_str();}
+
+    private:
+        std::string message_;
+    };
+
+
+    class exception_store
+    {
+    public:
+        exception_store() : kind_(NONE) {}
+
+        // Call only from within a catch-block.
+        void capture()
+        {
+#ifdef OPENMP
+#pragma omp critical (omp_exception_store)
+#endif
+            {
+                if (kind_ == NONE)
+                {
+                    try {
+                        throw;
+                    } catch (std::bad_alloc&) {
+                        kind_ = OUT_OF_MEMORY;
+                    } catch (std::exception& e) {
+                        kind_ = EXCEPTION;
+                        message_ = e.what();
+                    } catch (...) {
+                        kind_ = EXCEPTION;
+                        message_ = "unknown exception in parallel region";
+                    }
+                }
+            }
+        }
+
+        bool empty() const {return kind_ == NONE;}
+
+        // Call outside of any parallel region.
+        void rethrow() const
+        {
+            switch (kind_)
+            {
+            case NONE:
+                break;
+            case OUT_OF_MEMORY:
+                throw std::bad_alloc();
+            case EXCEPTION:
+                throw forwarded_exception(message_);
+            }
+        }
+
+    private:
+        enum {NONE, OUT_OF_MEMORY, EXCEPTION} kind_;
+        std::string message_;
+    };
+}
+
+
 // Answer whether the underlying OpenMP implementation really (thinks
 // that it) supports nested parallelism.
 inline static bool
@@ -24,161 +24,409 @@
 #include <config.h>
 #endif
 
-#include <queue>
+#include <algorithm>
+#include <limits>
+#include <utility>
 #include <vector>
 
 
 namespace enblend {
 
-template <typename Point, typename Image>
-class PathCompareFunctor
+// Reusable engine for minimum-cost paths through a cost image.
+//
+// The engine keeps its working buffers from one search to the next.
+// Callers that run many searches over small regions, like
+// DijkstraOptimizer routing each leg of a seam, stop allocating
+// after the first few searches.  A generation counter marks the
+// valid entries, so even the buffers need no clearing.
+//
+// Optionally, a search is confined to a corridor around the straight
+// line between its end points and/or it runs from both ends at once.
+template <typename CostPixelType>
+class MinCostPathEngine
 {
 public:
-    PathCompareFunctor(const Image* i) : image(i) {}
+    typedef typename vigra::NumericTraits<CostPixelType>::Promote WorkingPixelType;
+
+    MinCostPathEngine() :
+        width(0), generation(0), corridorRadius(-1), bidirectional(false) {}
+
+    // Confine all searches to the points whose distance from the
+    // line between the end points does not exceed radius.  A
+    // negative radius lifts the restriction.  Any corridor is at
+    // least one pixel wide, so that it stays connected.
+    void setCorridor(int radius) {corridorRadius = radius < 0 ? -1 : std::max(1, radius);}
+
+    // Search from both end points simultaneously.
+    void setBidirectional(bool enable) {bidirectional = enable;}
 
-    bool operator()(const Point& a, const Point& b) const {
-#ifdef DEBUG_PATH_COMPARE
-        cout << "+ PathCompareFunctor::operator(): comparing "
-             << "a = (" << a.x << ", " << a.y << ") = " << (*image)[a]
-             << ", b = (" << b.x << ", " << b.y << ") = " << (*image)[b] << endl;
+    // Store the points of a minimum-cost path from startingPoint to
+    // endingPoint in result, beginning next to startingPoint.  The
+    // end points themselves are not part of the path.
+    template <class CostImageIterator, class CostAccessor>
+    void findPath(CostImageIterator cost_upperleft, CostImageIterator cost_lowerright, CostAccessor ca,
+                  vigra::Point2D startingPoint, vigra::Point2D endingPoint,
+                  std::vector<vigra::Point2D>& result)
+    {
+        const int w = cost_lowerright.x - cost_upperleft.x;
+        const int h = cost_lowerright.y - cost_upperleft.y;
+
+        prepare(w, h);
+        corridorStart = startingPoint;
+        corridorEnd = endingPoint;
+        result.clear();
+
+#ifdef DEBUG_PATH
+        cout << "+ MinCostPathEngine::findPath: w = " << w << ", h = " << h << "\n"
+             << "+ MinCostPathEngine::findPath: startingPoint = " << startingPoint
+             << ", endingPoint = " << endingPoint << endl;
 #endif
-        // want the priority queue sorted in ascending order
-        return (*image)[a] > (*image)[b];
+
+        if (bidirectional) {
+            searchBothWays(cost_upperleft, ca, w, h, startingPoint, endingPoint, result);
+        } else {
+            searchBackwards(cost_upperleft, ca, w, h, startingPoint, endingPoint, result);
+        }
     }
 
-protected:
-    const Image* image;
-};
+    template <class CostImageIterator, class CostAccessor>
+    void findPath(vigra::triple<CostImageIterator, CostImageIterator, CostAccessor> cost,
+                  vigra::Point2D startingPoint, vigra::Point2D endingPoint,
+                  std::vector<vigra::Point2D>& result)
+    {
+        findPath(cost.first, cost.second, cost.third, startingPoint, endingPoint, result);
+    }
 
+private:
+    // The forward search starts at the ending point, the backward
+    // search at the starting point.
+    enum {FORWARD = 0, BACKWARD = 1};
 
-template <class CostImageIterator, class CostAccessor>
-std::vector<vigra::Point2D>* minCostPath(CostImageIterator cost_upperleft,
-                                         CostImageIterator cost_lowerright,
-                                         CostAccessor ca,
-                                         vigra::Point2D startingPoint,
-                                         vigra::Point2D endingPoint)
-{
-    typedef typename CostAccessor::value_type CostPixelType;
-    typedef typename vigra::NumericTraits<CostPixelType>::Promote WorkingPixelType;
-    typedef vigra::BasicImage<WorkingPixelType> WorkingImageType;
-    typedef typename WorkingImageType::traverser WorkingImageIterator;
-    typedef std::priority_queue<vigra::Point2D, std::vector<vigra::Point2D>, PathCompareFunctor<vigra::Point2D, WorkingImageType> > PQ;
+    typedef std::pair<WorkingPixelType, vigra::Point2D> QueueEntry;
 
-    const int w = cost_lowerright.x - cost_upperleft.x;
-    const int h = cost_lowerright.y - cost_upperleft.y;
+    // want the priority queue sorted in ascending order
+    struct QueueCompare
+    {
+        bool operator()(const QueueEntry& a, const QueueEntry& b) const {return a.first > b.first;}
+    };
 
-    // 4-bit direction encoding {up, down, left, right}
-    // A  8  9
-    // 2  0  1
-    // 6  4  5
-    //const unsigned char neighborArray[] = {0xA, 8, 9, 1, 5, 4, 6, 2};
-    const vigra::UInt8 neighborArray[] = {0xA, 1, 6, 8, 5, 2, 9, 4};
-    //const unsigned char neighborArrayInverse[] = {5, 4, 6, 2, 0xA, 8, 9, 1};
-    const vigra::UInt8 neighborArrayInverse[] = {5, 2, 9, 4, 0xA, 1, 6, 8};
-
-    vigra::UInt8Image* pathNextHop = new vigra::UInt8Image(w, h, vigra::UInt8(0));
-    WorkingImageType* costSoFar = new WorkingImageType(w, h, vigra::NumericTraits<WorkingPixelType>::max());
-    PQ* pq = new PQ(PathCompareFunctor<vigra::Point2D, WorkingImageType>(costSoFar));
-    std::vector<vigra::Point2D>* result = new std::vector<vigra::Point2D>;
+    static WorkingPixelType infinity() {return vigra::NumericTraits<WorkingPixelType>::max();}
 
-#ifdef DEBUG_PATH
-    cout << "+ minCostPath: w = " << w << ", h = " << h << "\n"
-         << "+ minCostPath: startingPoint = " << startingPoint
-         << ", endingPoint = " << endingPoint << endl;
-#endif
+    void prepare(int w, int h)
+    {
+        const size_t size = static_cast<size_t>(w) * static_cast<size_t>(h);
 
-    (*costSoFar)[endingPoint] =
-        std::max(vigra::NumericTraits<WorkingPixelType>::one(),
-                 vigra::NumericTraits<CostPixelType>::toPromote(ca(cost_upperleft + endingPoint)));
-    pq->push(endingPoint);
+        if (size > stamp.size()) {
+            stamp.resize(size, 0U);
+            for (int side = FORWARD; side <= BACKWARD; ++side) {
+                cost[side].resize(size);
+                hop[side].resize(size);
+            }
+        }
+        width = w;
 
-    while (!pq->empty()) {
-        vigra::Point2D top = pq->top();
-        pq->pop();
-#ifdef DEBUG_PATH
-        cout << "+ minCostPath: visiting point = " << top << endl;
-#endif
+        ++generation;
+        if (generation == 0U) {
+            std::fill(stamp.begin(), stamp.end(), 0U);
+            generation = 1U;
+        }
+
+        queue[FORWARD].clear();
+        queue[BACKWARD].clear();
+    }
+
+    size_t index(const vigra::Point2D& p) const
+    {
+        return static_cast<size_t>(p.y) * static_cast<size_t>(width) + static_cast<size_t>(p.x);
+    }
+
+    WorkingPixelType costOf(int side, const vigra::Point2D& p) const
+    {
+        const size_t i = index(p);
+        return stamp[i] == generation ? cost[side][i] : infinity();
+    }
+
+    vigra::UInt8 hopOf(int side, const vigra::Point2D& p) const
+    {
+        const size_t i = index(p);
+        return stamp[i] == generation ? hop[side][i] : vigra::UInt8(0);
+    }
+
+    void label(int side, const vigra::Point2D& p, WorkingPixelType pathCost, vigra::UInt8 nextHop)
+    {
+        const size_t i = index(p);
+        if (stamp[i] != generation) {
+            stamp[i] = generation;
+            cost[FORWARD][i] = cost[BACKWARD][i] = infinity();
+            hop[FORWARD][i] = hop[BACKWARD][i] = vigra::UInt8(0);
+        }
+        cost[side][i] = pathCost;
+        hop[side][i] = nextHop;
+    }
+
+    void push(int side, const vigra::Point2D& p, WorkingPixelType pathCost)
+    {
+        queue[side].push_back(QueueEntry(pathCost, p));
+        std::push_heap(queue[side].begin(), queue[side].end(), QueueCompare());
+    }
+
+    QueueEntry pop(int side)
+    {
+        std::pop_heap(queue[side].begin(), queue[side].end(), QueueCompare());
+        const QueueEntry top = queue[side].back();
+        queue[side].pop_back();
+        return top;
+    }
+
+    bool inCorridor(const vigra::Point2D& p) const
+    {
+        if (corridorRadius < 0) {
+            return true;
+        }
+
+        const double dx = static_cast<double>(corridorEnd.x - corridorStart.x);
+        const double dy = static_cast<double>(corridorEnd.y - corridorStart.y);
+        const double px = static_cast<double>(p.x - corridorStart.x);
+        const double py = static_cast<double>(p.y - corridorStart.y);
+        const double length2 = dx * dx + dy * dy;
+        const double t = length2 == 0.0 ? 0.0 : std::min(1.0, std::max(0.0, (px * dx + py * dy) / length2));
+        const double ex = px - t * dx;
+        const double ey = py - t * dy;
+
+        return ex * ex + ey * ey <= static_cast<double>(corridorRadius) * static_cast<double>(corridorRadius);
+    }
+
+    // Cost of entering p from one of its neighbors
+    template <class CostImageIterator, class CostAccessor>
+    static WorkingPixelType enteringCost(CostImageIterator cost_upperleft, CostAccessor ca,
+                                         const vigra::Point2D& p, bool diagonal)
+    {
+        WorkingPixelType pointCost =
+            std::max(vigra::NumericTraits<WorkingPixelType>::one(),
+                     vigra::NumericTraits<CostPixelType>::toPromote(ca(cost_upperleft + p)));
+        if (pointCost == vigra::NumericTraits<CostPixelType>::max()) {
+            pointCost *= 65536; // Can't use << since pointCost may be floating-point
+        }
+
+        if (diagonal) {
+            pointCost = WorkingPixelType(static_cast<double>(pointCost) * 1.4);
+        }
+
+        return pointCost;
+    }
+
+    static void step(vigra::Point2D& p, vigra::UInt8 direction)
+    {
+        if (direction & 0x8) {--p.y;}
+        if (direction & 0x4) {++p.y;}
+        if (direction & 0x2) {--p.x;}
+        if (direction & 0x1) {++p.x;}
+    }
+
+    // Append p and its successors towards the root of side's search
+    // tree to path, excluding the root itself.
+    void followHops(int side, vigra::Point2D p, std::vector<vigra::Point2D>& path) const
+    {
+        for (vigra::UInt8 nextHop = hopOf(side, p); nextHop != 0; nextHop = hopOf(side, p)) {
+            path.push_back(p);
+            step(p, nextHop);
+        }
+    }
 
-        if (top != startingPoint) {
-            WorkingPixelType costToTop = (*costSoFar)[top];
+    // Classic single-ended search from the ending point to the
+    // starting point.  A point's cost is fixed when the point is
+    // reached the first time.
+    template <class CostImageIterator, class CostAccessor>
+    void searchBackwards(CostImageIterator cost_upperleft, CostAccessor ca, int w, int h,
+                         vigra::Point2D startingPoint, vigra::Point2D endingPoint,
+                         std::vector<vigra::Point2D>& result)
+    {
+        const WorkingPixelType endingCost =
+            std::max(vigra::NumericTraits<WorkingPixelType>::one(),
+                     vigra::NumericTraits<CostPixelType>::toPromote(ca(cost_upperleft + endingPoint)));
+        label(FORWARD, endingPoint, endingCost, vigra::UInt8(0));
+        push(FORWARD, endingPoint, endingCost);
+
+        while (!queue[FORWARD].empty()) {
+            const QueueEntry top = pop(FORWARD);
 #ifdef DEBUG_PATH
-            cout << "+ minCostPath: costToTop = " << costToTop << endl;
+            cout << "+ MinCostPathEngine::searchBackwards: visiting point = " << top.second << endl;
 #endif
 
-            // For each 8-neighbor of top with costSoFar == 0 do relax
+            if (top.second == startingPoint) {
+                // Follow back to the ending point, but include
+                // neither start nor end point in result.
+                vigra::Point2D p(startingPoint);
+                const vigra::UInt8 firstHop = hopOf(FORWARD, p);
+                if (firstHop != 0) {
+                    step(p, firstHop);
+                    followHops(FORWARD, p, result);
+                }
+                return;
+            }
+
             for (int i = 0; i < 8; i++) {
-                // get the negihbor;
-                vigra::UInt8 neighborDirection = neighborArray[i];
-                vigra::Point2D neighborPoint = top;
-                if (neighborDirection & 0x8) {--neighborPoint.y;}
-                if (neighborDirection & 0x4) {++neighborPoint.y;}
-                if (neighborDirection & 0x2) {--neighborPoint.x;}
-                if (neighborDirection & 0x1) {++neighborPoint.x;}
+                vigra::Point2D neighborPoint(top.second);
+                step(neighborPoint, neighborArray[i]);
 
                 // Make sure neighbor is in valid region
-                if (neighborPoint.y < 0 || neighborPoint.y >= h
-                    || neighborPoint.x < 0 || neighborPoint.x >= w) {
+                if (neighborPoint.y < 0 || neighborPoint.y >= h ||
+                    neighborPoint.x < 0 || neighborPoint.x >= w ||
+                    !inCorridor(neighborPoint)) {
                     continue;
                 }
-#ifdef DEBUG_PATH
-                cout << "+ minCostPath: neighbor = " << neighborPoint << endl;
-#endif
 
-                // See if the neighbor has already been visited.
-                // If neighbor has maximal cost, it has not been visited.
-                // If so skip it.
-                WorkingPixelType neighborPreviousCost = (*costSoFar)[neighborPoint];
-#ifdef DEBUG_PATH
-                cout << "+ minCostPath: neighborPreviousCost = " << neighborPreviousCost << endl;
-#endif
-                if (neighborPreviousCost != vigra::NumericTraits<WorkingPixelType>::max()) {
+                // Skip neighbors that have already been reached.
+                const WorkingPixelType neighborPreviousCost = costOf(FORWARD, neighborPoint);
+                if (neighborPreviousCost != infinity()) {
                     continue;
                 }
 
-                WorkingPixelType neighborCost =
-                    std::max(vigra::NumericTraits<WorkingPixelType>::one(),
-                             vigra::NumericTraits<CostPixelType>::toPromote(ca(cost_upperleft + neighborPoint)));
-#ifdef DEBUG_PATH
-                cout << "+ minCostPath: neighborCost = " << neighborCost << endl;
-#endif
-                if (neighborCost == vigra::NumericTraits<CostPixelType>::max()) {
-                    neighborCost *= 65536; // Can't use << since neighborCost may be floating-point
+                const WorkingPixelType newNeighborCost =
+                    enteringCost(cost_upperleft, ca, neighborPoint, (i & 1) == 0) + top.first;
+                if (newNeighborCost < neighborPreviousCost) {
+                    label(FORWARD, neighborPoint, newNeighborCost, neighborArrayInverse[i]);
+                    push(FORWARD, neighborPoint, newNeighborCost);
                 }
+            }
+        }
+    }
+
+    // Run the forward search from the ending point and the backward
+    // search from the starting point in lockstep, always advancing
+    // the one with the cheaper frontier.  Whenever one of them
+    // reaches a point the other one has seen, the joint path is a
+    // candidate.  We stop as soon as no cheaper candidate can
+    // appear.  Unlike searchBackwards() both searches lower the cost
+    // of a point whenever they find a cheaper way to it; otherwise
+    // the stopping rule would not be sound.
+    template <class CostImageIterator, class CostAccessor>
+    void searchBothWays(CostImageIterator cost_upperleft, CostAccessor ca, int w, int h,
+                        vigra::Point2D startingPoint, vigra::Point2D endingPoint,
+                        std::vector<vigra::Point2D>& result)
+    {
+        if (startingPoint == endingPoint) {
+            return;
+        }
+
+        const WorkingPixelType endingCost =
+            std::max(vigra::NumericTraits<WorkingPixelType>::one(),
+                     vigra::NumericTraits<CostPixelType>::toPromote(ca(cost_upperleft + endingPoint)));
+        label(FORWARD, endingPoint, endingCost, vigra::UInt8(0));
+        push(FORWARD, endingPoint, endingCost);
+        label(BACKWARD, startingPoint, vigra::NumericTraits<WorkingPixelType>::zero(), vigra::UInt8(0));
+        push(BACKWARD, startingPoint, vigra::NumericTraits<WorkingPixelType>::zero());
 
-                if ((i & 1) == 0) {
-                    // neighbor is diagonal
-                    neighborCost = WorkingPixelType(static_cast<double>(neighborCost) * 1.4);
+        // The joint path runs from the ending point to meetingForward,
+        // steps to meetingBackward, and continues to the starting
+        // point.
+        double bestCost = std::numeric_limits<double>::max();
+        vigra::Point2D meetingForward;
+        vigra::Point2D meetingBackward;
+
+        while (!queue[FORWARD].empty() && !queue[BACKWARD].empty()) {
+            const double forwardFrontier = static_cast<double>(queue[FORWARD].front().first);
+            const double backwardFrontier = static_cast<double>(queue[BACKWARD].front().first);
+            if (forwardFrontier + backwardFrontier >= bestCost) {
+                break;
+            }
+
+            const int side = forwardFrontier <= backwardFrontier ? FORWARD : BACKWARD;
+            const int otherSide = side == FORWARD ? BACKWARD : FORWARD;
+            const QueueEntry top = pop(side);
+
+            // Skip entries superseded by a cheaper one.
+            if (top.first != costOf(side, top.second)) {
+                continue;
+            }
+
+            for (int i = 0; i < 8; i++) {
+                vigra::Point2D neighborPoint(top.second);
+                step(neighborPoint, neighborArray[i]);
+
+                if (neighborPoint.y < 0 || neighborPoint.y >= h ||
+                    neighborPoint.x < 0 || neighborPoint.x >= w ||
+                    !inCorridor(neighborPoint)) {
+                    continue;
                 }
 
-                const WorkingPixelType newNeighborCost = neighborCost + costToTop;
-                if (newNeighborCost < neighborPreviousCost) {
-                    // We have found the shortest path to neighbor.
-                    (*costSoFar)[neighborPoint] = newNeighborCost;
-                    (*pathNextHop)[neighborPoint] = neighborArrayInverse[i];
-                    pq->push(neighborPoint);
+                // The forward search pays for entering the neighbor,
+                // the backward search for entering top from the
+                // neighbor.
+                const WorkingPixelType edgeCost =
+                    enteringCost(cost_upperleft, ca,
+                                 side == FORWARD ? neighborPoint : top.second,
+                                 (i & 1) == 0);
+
+                const WorkingPixelType otherCost = costOf(otherSide, neighborPoint);
+                if (otherCost != infinity()) {
+                    const double jointCost =
+                        static_cast<double>(top.first) + static_cast<double>(edgeCost) + static_cast<double>(otherCost);
+                    if (jointCost < bestCost) {
+                        bestCost = jointCost;
+                        meetingForward = side == FORWARD ? top.second : neighborPoint;
+                        meetingBackward = side == FORWARD ? neighborPoint : top.second;
+                    }
                 }
-            }
-        } else {
-            // If yes then follow back to beginning using pathNextHop
-            // include neither start nor end point in result
-            vigra::UInt8 nextHop = (*pathNextHop)[top];
-            while (nextHop != 0) {
-                if (nextHop & 0x8) {--top.y;}
-                if (nextHop & 0x4) {++top.y;}
-                if (nextHop & 0x2) {--top.x;}
-                if (nextHop & 0x1) {++top.x;}
-                nextHop = (*pathNextHop)[top];
-                if (nextHop != 0) {
-                    result->push_back(top);
+
+                const WorkingPixelType newNeighborCost = edgeCost + top.first;
+                if (newNeighborCost < costOf(side, neighborPoint)) {
+                    label(side, neighborPoint, newNeighborCost, neighborArrayInverse[i]);
+                    push(side, neighborPoint, newNeighborCost);
                 }
             }
-            break;
         }
+
+        if (bestCost == std::numeric_limits<double>::max()) {
+            return;
+        }
+
+        // Backward part from the starting point to meetingBackward,
+        // then the forward part on to the ending point.
+        followHops(BACKWARD, meetingBackward, result);
+        std::reverse(result.begin(), result.end());
+        followHops(FORWARD, meetingForward, result);
     }
 
-    delete pathNextHop;
-    delete costSoFar;
-    delete pq;
+    // 4-bit direction encoding {up, down, left, right}
+    // A  8  9
+    // 2  0  1
+    // 6  4  5
+    static const vigra::UInt8 neighborArray[8];
+    static const vigra::UInt8 neighborArrayInverse[8];
+
+    int width;
+    unsigned int generation;
+    std::vector<unsigned int> stamp;
+    std::vector<WorkingPixelType> cost[2];
+    std::vector<vigra::UInt8> hop[2];
+    std::vector<QueueEntry> queue[2];
+
+    int corridorRadius;
+    vigra::Point2D corridorStart;
+    vigra::Point2D corridorEnd;
+    bool bidirectional;
+};
+
+
+template <typename CostPixelType>
+const vigra::UInt8 MinCostPathEngine<CostPixelType>::neighborArray[8] = {0xA, 1, 6, 8, 5, 2, 9, 4};
+
+template <typename CostPixelType>
+const vigra::UInt8 MinCostPathEngine<CostPixelType>::neighborArrayInverse[8] = {5, 2, 9, 4, 0xA, 1, 6, 8};
+
+
+template <class CostImageIterator, class CostAccessor>
+std::vector<vigra::Point2D>* minCostPath(CostImageIterator cost_upperleft,
+                                         CostImageIterator cost_lowerright,
+                                         CostAccessor ca,
+                                         vigra::Point2D startingPoint,
+                                         vigra::Point2D endingPoint)
+{
+    MinCostPathEngine<typename CostAccessor::value_type> engine;
+    std::vector<vigra::Point2D>* result = new std::vector<vigra::Point2D>;
+
+    engine.findPath(cost_upperleft, cost_lowerright, ca, startingPoint, endingPoint, *result);
 
     return result;
 }
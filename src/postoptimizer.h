@@ -20,14 +20,18 @@
 #ifndef __POSTOPTIMIZER_H__
 #define __POSTOPTIMIZER_H__
 
+#include <algorithm>
 #include <vector>
 
 #include "vigra_ext/rect2d.hxx"
 #include "vigra_ext/stride.hxx"
 
 #include "anneal.h"
+#include "common.h"
 #include "masktypedefs.h"
 #include "mask.h"
+#include "openmp.h"
+#include "path.h"
 
 using vigra::functor::Arg1;
 using vigra::functor::Arg2;
@@ -62,8 +66,57 @@ namespace enblend
         virtual ~PostOptimizer() {}
 
     protected:
+        // A snake together with its number inside of its contour and
+        // its number of vertices.
+        struct NumberedSnake
+        {
+            NumberedSnake(Segment* aSnake, int aNumber) :
+                snake(aSnake), number(aNumber), size(aSnake->size()) {}
+
+            // Order to put the largest snakes first.
+            bool operator<(const NumberedSnake& other) const {return size > other.size;}
+
+            Segment* snake;
+            int number;
+            size_t size;
+        };
+
+        typedef std::vector<NumberedSnake> numbered_snake_list_t;
+
         virtual void configureOptimizer() {}
 
+        // Collect the snakes of all contours in their natural order.
+        numbered_snake_list_t numberedSnakes() const {
+            numbered_snake_list_t snakes;
+
+            for (ContourVector::const_iterator currentContour = contours->begin();
+                 currentContour != contours->end();
+                 ++currentContour) {
+                int segmentNumber = 0;
+                for (Contour::const_iterator currentSegment = (*currentContour)->begin();
+                     currentSegment != (*currentContour)->end();
+                     ++currentSegment, ++segmentNumber) {
+                    snakes.push_back(NumberedSnake(*currentSegment, segmentNumber));
+                }
+            }
+
+            return snakes;
+        }
+
+        // Answer whether independent snakes can be optimized by
+        // several threads at the same time.  The GPU, the
+        // visualization image, and the interleaved progress messages
+        // are shared between all snakes, so any of them forces the
+        // sequential order.
+        bool optimizeConcurrently() const {
+            return parameter::as_boolean("parallel-seam-optimizer", true) &&
+                !UseGPU &&
+                visualizeImage == NULL &&
+                Verbose < VERBOSE_MASK_MESSAGES &&
+                omp_get_max_threads() > 1 &&
+                !omp_in_parallel();
+        }
+
         MismatchImageType* mismatchImage;
         VisualizeImageType* visualizeImage;
         vigra::Size2D* mismatchImageSize;
@@ -89,6 +142,7 @@ namespace enblend
     class AnnealOptimizer : public PostOptimizer<MismatchImageType, VisualizeImageType, AlphaType> {
     public:
         typedef PostOptimizer<MismatchImageType, VisualizeImageType, AlphaType> super;
+        typedef typename super::numbered_snake_list_t numbered_snake_list_t;
 
         AnnealOptimizer(MismatchImageType* mismatchImage, VisualizeImageType* visualizeImage,
                         vigra::Size2D* mismatchImageSize, int* mismatchImageStride,
@@ -105,109 +159,149 @@ namespace enblend
 
             configureOptimizer();
 
-            int segmentNumber;
+            numbered_snake_list_t snakes(this->numberedSnakes());
 
-            for (ContourVector::iterator currentContour = (*this->contours).begin();
-                 currentContour != (*this->contours).end();
-                 ++currentContour) {
-                segmentNumber = 0;
-                for (Contour::iterator currentSegment = (*currentContour)->begin();
-                     currentSegment != (*currentContour)->end();
-                     ++currentSegment, ++segmentNumber) {
-                    Segment* snake = *currentSegment;
+            if (snakes.size() < 2 || !this->optimizeConcurrently()) {
+                for (typename numbered_snake_list_t::const_iterator s = snakes.begin(); s != snakes.end(); ++s) {
+                    optimizeSnake(s->snake, s->number);
+                }
+                return;
+            }
 
-                    if (Verbose >= VERBOSE_MASK_MESSAGES) {
-                        std::cerr << command
-                             << ": info: Annealing Optimizer, s"
-                             << segmentNumber << ":";
-                        std::cerr.flush();
+            // Hand out the largest snakes first, so that the dynamic
+            // schedule does not end with one thread annealing a long
+            // snake while the others idle.
+            std::stable_sort(snakes.begin(), snakes.end());
+
+            // A snake with more than a thread's fair share of all
+            // vertices is annealed alone, so that it keeps the
+            // parallel mean-field update of GDAConfiguration.
+            const int numberOfSnakes = static_cast<int>(snakes.size());
+            size_t totalSize = 0;
+            for (typename numbered_snake_list_t::const_iterator s = snakes.begin(); s != snakes.end(); ++s) {
+                totalSize += s->size;
+            }
+            const size_t fairShare = totalSize / static_cast<size_t>(omp_get_max_threads());
+
+            int firstShared = 0;
+            while (firstShared < numberOfSnakes && snakes[firstShared].size > fairShare) {
+                optimizeSnake(snakes[firstShared].snake, snakes[firstShared].number);
+                ++firstShared;
+            }
+
+            omp::scoped_nested nested(false);
+            omp::exception_store failure;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+            for (int i = firstShared; i < numberOfSnakes; ++i) {
+                try {
+                    optimizeSnake(snakes[i].snake, snakes[i].number);
+                } catch (...) {
+                    failure.capture();
+                }
+            }
+            failure.rethrow();
+        }
+
+        virtual ~AnnealOptimizer() {}
+
+    private:
+        void optimizeSnake(Segment* snake, int segmentNumber) {
+            if (Verbose >= VERBOSE_MASK_MESSAGES) {
+                std::cerr << command
+                     << ": info: Annealing Optimizer, s"
+                     << segmentNumber << ":";
+                std::cerr.flush();
+            }
+
+            if (snake->empty()) {
+#ifdef OPENMP
+#pragma omp critical
+#endif
+                std::cerr << std::endl
+                     << command
+                     << ": warning: seam s"
+                     << segmentNumber - 1
+                     << " is a tiny closed contour and was removed before optimization"
+                     << std::endl;
+                return;
+            }
+
+            annealSnake(this->mismatchImage, OptimizerWeights,
+                        snake, this->visualizeImage);
+
+            // Post-process annealed vertices
+            Segment::iterator lastVertex = enblend::prev(snake->end());
+            for (Segment::iterator vertexIterator = snake->begin();
+                 vertexIterator != snake->end();) {
+                if (vertexIterator->first &&
+                    (*this->mismatchImage)[vertexIterator->second] == vigra::NumericTraits<MismatchImagePixelType>::max()) {
+                    // Vertex is still in max-cost region. Delete it.
+                    if (vertexIterator == snake->begin()) {
+                        snake->pop_front();
+                        vertexIterator = snake->begin();
+                    } else {
+                        vertexIterator = snake->erase(enblend::next(lastVertex));
                     }
 
-                    if (snake->empty()) {
-                        std::cerr << std::endl
-                             << command
-                             << ": warning: seam s"
-                             << segmentNumber - 1
-                             << " is a tiny closed contour and was removed before optimization"
-                             << std::endl;
-                        continue;
+                    bool needsBreak = false;
+                    if (vertexIterator == snake->end()) {
+                        vertexIterator = snake->begin();
+                        needsBreak = true;
                     }
 
-                    annealSnake(this->mismatchImage, OptimizerWeights,
-                                snake, this->visualizeImage);
-
-                    // Post-process annealed vertices
-                    Segment::iterator lastVertex = enblend::prev(snake->end());
-                    for (Segment::iterator vertexIterator = snake->begin();
-                         vertexIterator != snake->end();) {
-                        if (vertexIterator->first &&
-                            (*this->mismatchImage)[vertexIterator->second] == vigra::NumericTraits<MismatchImagePixelType>::max()) {
-                            // Vertex is still in max-cost region. Delete it.
-                            if (vertexIterator == snake->begin()) {
-                                snake->pop_front();
-                                vertexIterator = snake->begin();
-                            } else {
-                                vertexIterator = snake->erase(enblend::next(lastVertex));
-                            }
-
-                            bool needsBreak = false;
-                            if (vertexIterator == snake->end()) {
-                                vertexIterator = snake->begin();
-                                needsBreak = true;
-                            }
-
-                            // vertexIterator now points to next entry.
-
-                            // It is conceivable but very unlikely that every vertex in a closed contour
-                            // ended up in the max-cost region after annealing.
-                            if (snake->empty()) {
-                                break;
-                            }
-
-                            if (!(lastVertex->first || vertexIterator->first)) {
-                                // We deleted an entire range of moveable points between two nonmoveable points.
-                                // insert dummy point after lastVertex so dijkstra can work over this range.
-                                if (vertexIterator == snake->begin()) {
-                                    snake->push_front(std::make_pair(true, vertexIterator->second));
-                                    lastVertex = snake->begin();
-                                } else {
-                                    lastVertex = snake->insert(enblend::next(lastVertex),
-                                                               std::make_pair(true, vertexIterator->second));
-                                }
-                            }
-
-                            if (needsBreak) {
-                                break;
-                            }
-                        }
-                        else {
-                            lastVertex = vertexIterator;
-                            ++vertexIterator;
-                        }
+                    // vertexIterator now points to next entry.
+
+                    // It is conceivable but very unlikely that every vertex in a closed contour
+                    // ended up in the max-cost region after annealing.
+                    if (snake->empty()) {
+                        break;
                     }
 
-                    if (Verbose >= VERBOSE_MASK_MESSAGES) {
-                        std::cerr << std::endl;
+                    if (!(lastVertex->first || vertexIterator->first)) {
+                        // We deleted an entire range of moveable points between two nonmoveable points.
+                        // insert dummy point after lastVertex so dijkstra can work over this range.
+                        if (vertexIterator == snake->begin()) {
+                            snake->push_front(std::make_pair(true, vertexIterator->second));
+                            lastVertex = snake->begin();
+                        } else {
+                            lastVertex = snake->insert(enblend::next(lastVertex),
+                                                       std::make_pair(true, vertexIterator->second));
+                        }
                     }
 
-                    // Print an explanation if every vertex in a closed contour ended up in the
-                    // max-cost region after annealing.
-                    // FIXME: explain how to fix this problem in the error message!
-                    if (snake->empty()) {
-                        std::cerr << std::endl
-                             << command
-                             << ": seam s"
-                             << segmentNumber - 1
-                             << " is a tiny closed contour and was removed after optimization"
-                             << std::endl;
+                    if (needsBreak) {
+                        break;
                     }
                 }
+                else {
+                    lastVertex = vertexIterator;
+                    ++vertexIterator;
+                }
             }
-        }
 
-        virtual ~AnnealOptimizer() {}
+            if (Verbose >= VERBOSE_MASK_MESSAGES) {
+                std::cerr << std::endl;
+            }
+
+            // Print an explanation if every vertex in a closed contour ended up in the
+            // max-cost region after annealing.
+            // FIXME: explain how to fix this problem in the error message!
+            if (snake->empty()) {
+#ifdef OPENMP
+#pragma omp critical
+#endif
+                std::cerr << std::endl
+                     << command
+                     << ": seam s"
+                     << segmentNumber - 1
+                     << " is a tiny closed contour and was removed after optimization"
+                     << std::endl;
+            }
+        }
 
-    private:
         void configureOptimizer() {
             // Areas other than intersection region have maximum cost.
             combineThreeImagesMP(vigra_ext::stride(*this->mismatchImageStride,
@@ -232,6 +326,7 @@ namespace enblend
     class DijkstraOptimizer : public PostOptimizer<MismatchImageType, VisualizeImageType, AlphaType> {
     public:
         typedef PostOptimizer<MismatchImageType, VisualizeImageType, AlphaType> super;
+        typedef typename super::numbered_snake_list_t numbered_snake_list_t;
 
         DijkstraOptimizer(MismatchImageType* mismatchImage, VisualizeImageType* visualizeImage,
                           vigra::Size2D* mismatchImageSize, int* mismatchImageStride,
@@ -248,8 +343,8 @@ namespace enblend
 
             configureOptimizer();
 
-            vigra::Rect2D withinMismatchImage(*this->mismatchImageSize);
-            int segmentNumber;
+            const vigra::Rect2D withinMismatchImage(*this->mismatchImageSize);
+            const numbered_snake_list_t snakes(this->numberedSnakes());
 
             if (Verbose >= VERBOSE_MASK_MESSAGES) {
                 std::cerr << command
@@ -257,85 +352,112 @@ namespace enblend
                 std::cerr.flush();
             }
 
-            // Use Dijkstra to route between moveable snake vertices over mismatchImage.
-            for (ContourVector::iterator currentContour = (*this->contours).begin();
-                 currentContour != (*this->contours).end();
-                 ++currentContour) {
-                segmentNumber = 0;
-                for (Contour::iterator currentSegment = (*currentContour)->begin();
-                     currentSegment != (*currentContour)->end();
-                     ++currentSegment, ++segmentNumber) {
-                    Segment* snake = *currentSegment;
+            // Each pair of neighboring vertices, where at least one
+            // of them is moveable, is a leg that Dijkstra routes
+            // independently of all other legs, no matter which snake
+            // they belong to.
+            leg_list_t legs;
+            for (typename numbered_snake_list_t::const_iterator s = snakes.begin(); s != snakes.end(); ++s) {
+                Segment* snake = s->snake;
 
-                    if (snake->empty()) {
-                        continue;
+                if (snake->empty()) {
+                    continue;
+                }
+
+                for (Segment::iterator currentVertex = snake->begin(); ; ) {
+                    Segment::iterator nextVertex = currentVertex;
+                    ++nextVertex;
+                    if (nextVertex == snake->end()) {
+                        nextVertex = snake->begin();
                     }
 
-                    if (Verbose >= VERBOSE_MASK_MESSAGES) {
-                        std::cerr << " s" << segmentNumber;
-                        std::cerr.flush();
+                    if (currentVertex->first || nextVertex->first) {
+                        vigra::Rect2D pointSurround(currentVertex->second, vigra::Size2D(1, 1));
+                        pointSurround |= vigra::Rect2D(nextVertex->second, vigra::Size2D(1, 1));
+                        pointSurround.addBorder(DijkstraRadius);
+                        pointSurround &= withinMismatchImage;
+
+                        legs.push_back(Leg(snake, s->number, currentVertex, nextVertex, pointSurround));
                     }
 
-                    for (Segment::iterator currentVertex = snake->begin(); ; ) {
-                        Segment::iterator nextVertex = currentVertex;
-                        ++nextVertex;
-                        if (nextVertex == snake->end()) {
-                            nextVertex = snake->begin();
-                        }
+                    currentVertex = nextVertex;
+                    if (nextVertex == snake->begin()) {
+                        break;
+                    }
+                }
+            }
 
-                        if (currentVertex->first || nextVertex->first) {
-                            // Find shortest path between these points
-                            vigra::Point2D currentPoint = currentVertex->second;
-                            vigra::Point2D nextPoint = nextVertex->second;
-
-                            vigra::Rect2D pointSurround(currentPoint, vigra::Size2D(1, 1));
-                            pointSurround |= vigra::Rect2D(nextPoint, vigra::Size2D(1, 1));
-                            pointSurround.addBorder(DijkstraRadius);
-                            pointSurround &= withinMismatchImage;
-
-                            // Make BasicImage to hold pointSurround portion of mismatchImage.
-                            // min cost path needs inexpensive random access to cost image.
-                            vigra::BasicImage<MismatchImagePixelType> mismatchROIImage(pointSurround.size());
-                            copyImage(vigra_ext::apply(pointSurround, srcImageRange(*this->mismatchImage)),
-                                      destImage(mismatchROIImage));
-
-                            std::vector<vigra::Point2D>* shortPath =
-                                minCostPath(srcImageRange(mismatchROIImage),
-                                            vigra::Point2D(nextPoint - pointSurround.upperLeft()),
-                                            vigra::Point2D(currentPoint - pointSurround.upperLeft()));
-
-                            for (std::vector<vigra::Point2D>::iterator shortPathPoint = shortPath->begin();
-                                 shortPathPoint != shortPath->end();
-                                 ++shortPathPoint) {
-                                snake->insert(enblend::next(currentVertex),
-                                              std::make_pair(false, *shortPathPoint + pointSurround.upperLeft()));
-
-                                if (this->visualizeImage) {
-                                    (*this->visualizeImage)[*shortPathPoint + pointSurround.upperLeft()] =
-                                        VISUALIZE_SHORT_PATH_VALUE;
-                                }
-                            }
-
-                            delete shortPath;
-
-                            if (this->visualizeImage) {
-                                (*this->visualizeImage)[currentPoint] =
-                                    currentVertex->first ?
-                                    VISUALIZE_FIRST_VERTEX_VALUE :
-                                    VISUALIZE_NEXT_VERTEX_VALUE;
-                                (*this->visualizeImage)[nextPoint] =
-                                    nextVertex->first ?
-                                    VISUALIZE_FIRST_VERTEX_VALUE :
-                                    VISUALIZE_NEXT_VERTEX_VALUE;
-                            }
-                        }
+            // Route the legs with the largest surroundings first.
+            std::vector<int> schedule(legs.size());
+            for (size_t i = 0; i != legs.size(); ++i) {
+                schedule[i] = static_cast<int>(i);
+            }
+            std::stable_sort(schedule.begin(), schedule.end(), LargerSurround(&legs));
+
+            const int numberOfLegs = static_cast<int>(legs.size());
+            // Routing writes nothing but the legs, so neither the
+            // visualization image nor the progress messages get in
+            // the way here.
+            const bool concurrent =
+                numberOfLegs > 1 && parameter::as_boolean("parallel-seam-optimizer", true);
+
+            // One path engine per thread, so that each of them
+            // allocates its buffers once for all the legs it routes.
+            std::vector<path_engine_t> engines(concurrent ? std::max(1, omp_get_max_threads()) : 1);
+            // The corridor is off unless requested, because it can
+            // change the route that the unconfined search finds.
+            const int corridorRadius = parameter::as_integer("dijkstra-corridor", -1);
+            const bool bidirectional = parameter::as_boolean("bidirectional-dijkstra", false);
+            for (typename std::vector<path_engine_t>::iterator e = engines.begin(); e != engines.end(); ++e) {
+                e->setCorridor(corridorRadius);
+                e->setBidirectional(bidirectional);
+            }
 
-                        currentVertex = nextVertex;
-                        if (nextVertex == snake->begin()) {
-                            break;
-                        }
+            omp::exception_store failure;
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic, 1) if (concurrent)
+#endif
+            for (int i = 0; i < numberOfLegs; ++i) {
+                try {
+                    routeLeg(engines[omp_get_thread_num()], legs[schedule[i]]);
+                } catch (...) {
+                    failure.capture();
+                }
+            }
+            failure.rethrow();
+
+            // Splice the routes into their snakes.  Inserting after
+            // the current vertex keeps all other iterators valid.
+            const Segment* previousSnake = NULL;
+            for (typename leg_list_t::iterator leg = legs.begin(); leg != legs.end(); ++leg) {
+                if (Verbose >= VERBOSE_MASK_MESSAGES && leg->snake != previousSnake) {
+                    std::cerr << " s" << leg->number;
+                    std::cerr.flush();
+                }
+                previousSnake = leg->snake;
+
+                for (std::vector<vigra::Point2D>::iterator shortPathPoint = leg->shortPath.begin();
+                     shortPathPoint != leg->shortPath.end();
+                     ++shortPathPoint) {
+                    leg->snake->insert(enblend::next(leg->currentVertex),
+                                       std::make_pair(false, *shortPathPoint + leg->surround.upperLeft()));
+
+                    if (this->visualizeImage) {
+                        (*this->visualizeImage)[*shortPathPoint + leg->surround.upperLeft()] =
+                            VISUALIZE_SHORT_PATH_VALUE;
                     }
+                }
 
+                if (this->visualizeImage) {
+                    (*this->visualizeImage)[leg->currentVertex->second] =
+                        leg->currentVertex->first ?
+                        VISUALIZE_FIRST_VERTEX_VALUE :
+                        VISUALIZE_NEXT_VERTEX_VALUE;
+                    (*this->visualizeImage)[leg->nextVertex->second] =
+                        leg->nextVertex->first ?
+                        VISUALIZE_FIRST_VERTEX_VALUE :
+                        VISUALIZE_NEXT_VERTEX_VALUE;
                 }
             }
 
@@ -358,6 +480,61 @@ namespace enblend
                                  destIter((this->mismatchImage)->upperLeft() + *this->uvBBStrideOffset),
                                  ifThenElse(!(Arg1() || Arg2()), Param(vigra::NumericTraits<MismatchImagePixelType>::one()), Arg3()));
         }
+
+        // Path between two neighboring vertices of a snake
+        struct Leg
+        {
+            Leg(Segment* aSnake, int aNumber,
+                Segment::iterator aCurrentVertex, Segment::iterator aNextVertex,
+                const vigra::Rect2D& aSurround) :
+                snake(aSnake), number(aNumber),
+                currentVertex(aCurrentVertex), nextVertex(aNextVertex),
+                surround(aSurround) {}
+
+            Segment* snake;
+            int number;
+            Segment::iterator currentVertex;
+            Segment::iterator nextVertex;
+            vigra::Rect2D surround;
+            std::vector<vigra::Point2D> shortPath;
+        };
+
+        typedef std::vector<Leg> leg_list_t;
+
+        class LargerSurround
+        {
+        public:
+            LargerSurround(const leg_list_t* someLegs) : legs(someLegs) {}
+
+            bool operator()(int i, int j) const {
+                return (*legs)[i].surround.area() > (*legs)[j].surround.area();
+            }
+
+        private:
+            const leg_list_t* legs;
+        };
+
+        typedef MinCostPathEngine<MismatchImagePixelType> path_engine_t;
+
+        // Find the shortest path between the vertices of leg.  Only
+        // reads the mismatch image and writes to leg, so that
+        // different legs can be routed concurrently, each with its
+        // own engine.
+        void routeLeg(path_engine_t& engine, Leg& leg) const {
+            const vigra::Point2D currentPoint = leg.currentVertex->second;
+            const vigra::Point2D nextPoint = leg.nextVertex->second;
+
+            // The mismatch image is a BasicImage, so the engine gets
+            // inexpensive random access to pointSurround without a
+            // copy.
+            engine.findPath(this->mismatchImage->upperLeft() + leg.surround.upperLeft(),
+                            this->mismatchImage->upperLeft() + leg.surround.lowerRight(),
+                            this->mismatchImage->accessor(),
+                            vigra::Point2D(nextPoint - leg.surround.upperLeft()),
+                            vigra::Point2D(currentPoint - leg.surround.upperLeft()),
+                            leg.shortPath);
+        }
+
         DijkstraOptimizer(DijkstraOptimizer* other); // NOT IMPLEMENTED
         DijkstraOptimizer& operator=(const DijkstraOptimizer &other); // NOT IMPLEMENTED
         DijkstraOptimizer();    // NOT IMPLEMENTED
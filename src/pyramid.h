@@ -24,9 +24,12 @@
 #include <config.h>
 #endif
 
+#include <algorithm>
 #include <functional>
 #include <vector>
 
+#include <boost/static_assert.hpp>
+
 #include <vigra/convolution.hxx>
 #include <vigra/error.hxx>
 #include <vigra/inspectimage.hxx>
@@ -36,6 +39,13 @@
 #include <vigra/transformimage.hxx>
 
 #include "fixmath.h"
+#include "muopt.h"
+#include "openmp.h"
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
 
 
 namespace enblend {
@@ -46,6 +56,15 @@ namespace enblend {
 #define IMUL11(A) (A * SKIPSMImagePixelType(11))
 #define AMUL6(A) (A * SKIPSMAlphaPixelType(6))
 
+// Minimum number of rows a band of a parallel reduce() or expand()
+// must have.  Each band re-runs a few rows above it to prime the
+// SKIPSM state, so thin bands waste work.
+#define MIN_PYRAMID_BAND_HEIGHT 32
+
+// Number of destination columns that expand() computes before it
+// writes them
+#define EXPAND_CHUNK 128
+
 
 /** Calculate the half-width of a n-level filter.
  *  Assumes that the input function is a left-handed function,
@@ -63,6 +82,335 @@ filterHalfWidth(const unsigned int levels)
 }
 
 
+/** Normalize the accumulated SKIPSM value ip by the accumulated
+ *  alpha weight ap, which must be non-zero.
+ *
+ *  Almost all output pixels of reduce() lie completely inside the
+ *  alpha mask, so that all 25 filter taps contribute and ap equals
+ *  256, the sum of the 5x5 binomial kernel.  Dividing by the literal
+ *  lets the compiler replace the (per-channel) integer division by
+ *  shifts, which is exact and much faster than a division by a
+ *  variable.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType>
+inline void
+normalizeByAlpha(SKIPSMImagePixelType& ip, const SKIPSMAlphaPixelType& ap)
+{
+    if (ap == SKIPSMAlphaPixelType(256)) {
+        ip /= SKIPSMImagePixelType(256);
+    } else {
+        ip /= SKIPSMImagePixelType(ap);
+    }
+}
+
+
+/** Vertical SKIPSM step of reduce() for an even source row.  For
+ *  each column x of the state arrays it computes
+ *
+ *      sum[x] <= c1[x] + 6*c0[x] + cp[x] + h[x]
+ *      c1[x] <= c0[x] + cp[x]
+ *      c0[x] <= h[x]
+ *
+ *  where h is the horizontally filtered source row.  The columns are
+ *  independent of each other, unlike the horizontal SKIPSM state,
+ *  which is a recurrence along the row.
+ */
+template <typename ComponentType>
+inline void
+reduceComponentColumns(ComponentType* c1, ComponentType* c0, const ComponentType* cp,
+                       const ComponentType* h, ComponentType* sum, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        ComponentType s = c1[i] + c0[i] * ComponentType(6) + cp[i];
+        c1[i] = c0[i] + cp[i];
+        c0[i] = h[i];
+        s += h[i];
+        sum[i] = s;
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+
+// 6 * x as shifts, because SSE2 lacks a 32-bit multiply
+#define SKIPSM_MUL6_EPI32(x) _mm_add_epi32(_mm_slli_epi32((x), 2), _mm_slli_epi32((x), 1))
+#define SKIPSM_MUL6_EPI16(x) _mm_add_epi16(_mm_slli_epi16((x), 2), _mm_slli_epi16((x), 1))
+#define SKIPSM_MUL6_EPI32_256(x) _mm256_add_epi32(_mm256_slli_epi32((x), 2), _mm256_slli_epi32((x), 1))
+#define SKIPSM_MUL6_EPI16_256(x) _mm256_add_epi16(_mm256_slli_epi16((x), 2), _mm256_slli_epi16((x), 1))
+
+inline void
+reduceComponentColumnsSSE2(vigra::Int32* c1, vigra::Int32* c0, const vigra::Int32* cp,
+                           const vigra::Int32* h, vigra::Int32* sum, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i vc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1 + i));
+        const __m128i vc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0 + i));
+        const __m128i vcp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cp + i));
+        const __m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        const __m128i s = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(vc1, SKIPSM_MUL6_EPI32(vc0)), vcp), vh);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c1 + i), _mm_add_epi32(vc0, vcp));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c0 + i), vh);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i), s);
+    }
+    reduceComponentColumns<vigra::Int32>(c1 + i, c0 + i, cp + i, h + i, sum + i, n - i);
+}
+
+
+inline void
+reduceComponentColumnsSSE2(vigra::Int16* c1, vigra::Int16* c0, const vigra::Int16* cp,
+                           const vigra::Int16* h, vigra::Int16* sum, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i vc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1 + i));
+        const __m128i vc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0 + i));
+        const __m128i vcp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cp + i));
+        const __m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        const __m128i s = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(vc1, SKIPSM_MUL6_EPI16(vc0)), vcp), vh);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c1 + i), _mm_add_epi16(vc0, vcp));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(c0 + i), vh);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i), s);
+    }
+    reduceComponentColumns<vigra::Int16>(c1 + i, c0 + i, cp + i, h + i, sum + i, n - i);
+}
+
+
+TARGET_AVX2 inline void
+reduceComponentColumnsAVX2(vigra::Int32* c1, vigra::Int32* c0, const vigra::Int32* cp,
+                           const vigra::Int32* h, vigra::Int32* sum, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i vc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1 + i));
+        const __m256i vc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + i));
+        const __m256i vcp = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cp + i));
+        const __m256i vh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+        const __m256i s =
+            _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(vc1, SKIPSM_MUL6_EPI32_256(vc0)), vcp), vh);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c1 + i), _mm256_add_epi32(vc0, vcp));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c0 + i), vh);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sum + i), s);
+    }
+    reduceComponentColumnsSSE2(c1 + i, c0 + i, cp + i, h + i, sum + i, n - i);
+}
+
+
+TARGET_AVX2 inline void
+reduceComponentColumnsAVX2(vigra::Int16* c1, vigra::Int16* c0, const vigra::Int16* cp,
+                           const vigra::Int16* h, vigra::Int16* sum, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i vc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1 + i));
+        const __m256i vc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + i));
+        const __m256i vcp = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cp + i));
+        const __m256i vh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+        const __m256i s =
+            _mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(vc1, SKIPSM_MUL6_EPI16_256(vc0)), vcp), vh);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c1 + i), _mm256_add_epi16(vc0, vcp));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c0 + i), vh);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sum + i), s);
+    }
+    reduceComponentColumnsSSE2(c1 + i, c0 + i, cp + i, h + i, sum + i, n - i);
+}
+
+// The fixed-point SKIPSM types get explicit SSE2 and AVX2 kernels,
+// selected by the capabilities of the CPU we are running on.
+inline void
+reduceComponentColumns(vigra::Int32* c1, vigra::Int32* c0, const vigra::Int32* cp,
+                       const vigra::Int32* h, vigra::Int32* sum, int n)
+{
+    if (muopt::cpu_supports_avx2()) {
+        reduceComponentColumnsAVX2(c1, c0, cp, h, sum, n);
+    } else {
+        reduceComponentColumnsSSE2(c1, c0, cp, h, sum, n);
+    }
+}
+
+
+inline void
+reduceComponentColumns(vigra::Int16* c1, vigra::Int16* c0, const vigra::Int16* cp,
+                       const vigra::Int16* h, vigra::Int16* sum, int n)
+{
+    if (muopt::cpu_supports_avx2()) {
+        reduceComponentColumnsAVX2(c1, c0, cp, h, sum, n);
+    } else {
+        reduceComponentColumnsSSE2(c1, c0, cp, h, sum, n);
+    }
+}
+
+#endif // HAVE_X86_SIMD_DISPATCH
+
+
+template <typename SKIPSMPixelType>
+struct SKIPSMComponentTraits
+{
+    typedef SKIPSMPixelType ComponentType;
+    enum {components = 1};
+};
+
+template <typename ComponentT>
+struct SKIPSMComponentTraits<vigra::RGBValue<ComponentT, 0, 1, 2> >
+{
+    typedef ComponentT ComponentType;
+    enum {components = 3};
+};
+
+
+/** Apply reduceComponentColumns() to columns [1, n] of SKIPSM state
+ *  arrays of scalar or RGB pixels.  RGB arrays are treated as flat
+ *  arrays of their components. */
+template <typename SKIPSMPixelType>
+inline void
+reduceColumns(SKIPSMPixelType* c1, SKIPSMPixelType* c0, const SKIPSMPixelType* cp,
+              const SKIPSMPixelType* h, SKIPSMPixelType* sum, int n)
+{
+    typedef SKIPSMComponentTraits<SKIPSMPixelType> Traits;
+    typedef typename Traits::ComponentType ComponentType;
+    BOOST_STATIC_ASSERT(sizeof(SKIPSMPixelType) == Traits::components * sizeof(ComponentType));
+
+    reduceComponentColumns(reinterpret_cast<ComponentType*>(c1 + 1),
+                           reinterpret_cast<ComponentType*>(c0 + 1),
+                           reinterpret_cast<const ComponentType*>(cp + 1),
+                           reinterpret_cast<const ComponentType*>(h + 1),
+                           reinterpret_cast<ComponentType*>(sum + 1),
+                           Traits::components * n);
+}
+
+
+/** Answer the number of horizontal bands an image with the given
+ *  number of rows is split into by reduce() and expand().  The bands
+ *  are processed in parallel, each with its own SKIPSM state.
+ */
+inline int
+numberOfPyramidBands(int rows)
+{
+#ifdef OPENMP
+    if (omp_in_parallel() && !omp_get_nested()) {
+        return 1;
+    }
+    return std::max(1, std::min(omp_get_max_threads(), rows / MIN_PYRAMID_BAND_HEIGHT));
+#else
+    return 1;
+#endif
+}
+
+
+/** Horizontal SKIPSM pass of reduce() for images with alpha
+ *  channels.  Filter source row sy and its mask row ay and leave
+ *  the values for destination columns 1, ..., ceil(src_w/2) in h and
+ *  ah, respectively.  Transparent pixels contribute nothing.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor>
+inline void
+reduceRow(bool wraparound,
+          SrcImageIterator sy, SrcAccessor sa,
+          AlphaIterator ay, AlphaAccessor aa,
+          int src_w,
+          SKIPSMImagePixelType* h, SKIPSMAlphaPixelType* ah)
+{
+    const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
+    const SKIPSMAlphaPixelType SKIPSMAlphaZero(vigra::NumericTraits<SKIPSMAlphaPixelType>::zero());
+    const SKIPSMAlphaPixelType SKIPSMAlphaOne(vigra::NumericTraits<SKIPSMAlphaPixelType>::one());
+
+    SKIPSMImagePixelType isr0, isr1, isrp;
+    SKIPSMAlphaPixelType asr0, asr1, asrp;
+
+    if (wraparound) {
+        asr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
+        asr1 = SKIPSMAlphaZero;
+        asrp = aa(ay, vigra::Diff2D(src_w - 1, 0)) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero;
+        isr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0))) : SKIPSMImageZero;
+        isr1 = SKIPSMImageZero;
+        isrp =
+            aa(ay, vigra::Diff2D(src_w - 1, 0)) ?
+            vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4) :
+            SKIPSMImageZero;
+    } else {
+        asr0 = SKIPSMAlphaZero;
+        asr1 = SKIPSMAlphaZero;
+        asrp = SKIPSMAlphaZero;
+        isr0 = SKIPSMImageZero;
+        isr1 = SKIPSMImageZero;
+        isrp = SKIPSMImageZero;
+    }
+
+    // First entry in row
+    SrcImageIterator sx = sy;
+    AlphaIterator ax = ay;
+    if (wraparound) {
+        asr1 = asr0 + asrp;
+        isr1 = isr0 + isrp;
+    }
+    asr0 = aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
+    isr0 = aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero;
+    // h[0] and ah[0] are never used
+    ++sx.x;
+    ++ax.x;
+
+    // Main entries in row, visited in (odd, even) pairs
+    int dstx = 0;
+    for (int srcx = 1; srcx < src_w; srcx += 2) {
+        {
+            // odd source pixel
+            const bool opaque = aa(ax);
+            asrp = opaque ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero;
+            isrp = opaque ? SKIPSMImagePixelType(sa(sx)) * 4 : SKIPSMImageZero;
+            ++dstx;
+            ++sx.x;
+            ++ax.x;
+        }
+        if (srcx + 1 < src_w) {
+            // even source pixel
+            const bool opaque = aa(ax);
+            SKIPSMAlphaPixelType mcurrent(opaque ? SKIPSMAlphaOne : SKIPSMAlphaZero);
+            SKIPSMImagePixelType icurrent(opaque ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
+            ah[dstx] = asr1 + AMUL6(asr0) + asrp + mcurrent;
+            asr1 = asr0 + asrp;
+            asr0 = mcurrent;
+            h[dstx] = isr1 + IMUL6(isr0) + isrp + icurrent;
+            isr1 = isr0 + isrp;
+            isr0 = icurrent;
+            ++sx.x;
+            ++ax.x;
+        }
+    }
+
+    // Last entries in row
+    if ((src_w & 1) != 0) {
+        // previous srcx was even
+        ++dstx;
+        if (wraparound) {
+            ah[dstx] =
+                asr1 + AMUL6(asr0) +
+                (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero) +
+                (aa(ay, vigra::Diff2D(1, 0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
+            h[dstx] =
+                isr1 + IMUL6(isr0) +
+                (aa(ay) ?
+                 vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
+                 SKIPSMImageZero) +
+                (aa(ay, vigra::Diff2D(1, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0))) : SKIPSMImageZero);
+        } else {
+            ah[dstx] = asr1 + AMUL6(asr0);
+            h[dstx] = isr1 + IMUL6(isr0);
+        }
+    } else {
+        // previous srcx was odd
+        if (wraparound) {
+            ah[dstx] = asr1 + AMUL6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
+            h[dstx] = isr1 + IMUL6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero);
+        } else {
+            ah[dstx] = asr1 + AMUL6(asr0) + asrp;
+            h[dstx] = isr1 + IMUL6(isr0) + isrp;
+        }
+    }
+}
+
+
 /** The Burt & Adelson Reduce operation.
  *  This version is for images with alpha channels.
  *  Gaussian blur, downsampling, and extrapolation in one pass over
@@ -155,6 +503,15 @@ filterHalfWidth(const unsigned int levels)
  *
  *  Updates when visting (odd x, odd y) source pixel:
  *  srp <= 4*current
+ *
+ *  *************************************************************************************************
+ *  Bands:
+ *
+ *  reduceBand() only writes the destination rows [dst_y_begin, dst_y_end).  Destination row k
+ *  is completed when visiting source row 2k+2, and the column state it needs only depends on
+ *  source rows 2k-2 to 2k+1.  Therefore a band that does not start at the top begins with a
+ *  clean state at source row 2*dst_y_begin-2 and suppresses the two output rows that follow,
+ *  which yields exactly the same pixels as a single pass over the whole image.
  */
 template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
           typename SrcImageIterator, typename SrcAccessor,
@@ -162,18 +519,19 @@ template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
           typename DestImageIterator, typename DestAccessor,
           typename DestAlphaIterator, typename DestAlphaAccessor>
 inline void
-reduce(bool wraparound,
-       SrcImageIterator src_upperleft,
-       SrcImageIterator src_lowerright,
-       SrcAccessor sa,
-       AlphaIterator alpha_upperleft,
-       AlphaAccessor aa,
-       DestImageIterator dest_upperleft,
-       DestImageIterator dest_lowerright,
-       DestAccessor da,
-       DestAlphaIterator dest_alpha_upperleft,
-       DestAlphaIterator dest_alpha_lowerright,
-       DestAlphaAccessor daa)
+reduceBand(bool wraparound,
+           SrcImageIterator src_upperleft,
+           SrcImageIterator src_lowerright,
+           SrcAccessor sa,
+           AlphaIterator alpha_upperleft,
+           AlphaAccessor aa,
+           DestImageIterator dest_upperleft,
+           DestImageIterator dest_lowerright,
+           DestAccessor da,
+           DestAlphaIterator dest_alpha_upperleft,
+           DestAlphaIterator dest_alpha_lowerright,
+           DestAlphaAccessor daa,
+           int dst_y_begin, int dst_y_end)
 {
     typedef typename DestAccessor::value_type DestPixelType;
     typedef typename DestAlphaAccessor::value_type DestAlphaPixelType;
@@ -181,335 +539,111 @@ reduce(bool wraparound,
     int src_w = src_lowerright.x - src_upperleft.x;
     int src_h = src_lowerright.y - src_upperleft.y;
     int dst_w = dest_lowerright.x - dest_upperleft.x;
-    //int dst_h = dest_lowerright.y - dest_upperleft.y;
+    int dst_h = dest_lowerright.y - dest_upperleft.y;
 
     vigra_precondition(src_w > 1 && src_h > 1,
                        "src image too small in reduce");
+    vigra_precondition(0 <= dst_y_begin && dst_y_begin < dst_y_end && dst_y_end <= dst_h,
+                       "invalid band in reduce");
+
+    // Source row after the last one that contributes to the band
+    const int src_y_end = dst_y_end == dst_h ? src_h : 2 * dst_y_end + 1;
 
     // State variables for source image pixel values
-    SKIPSMImagePixelType isr0, isr1, isrp;
     SKIPSMImagePixelType* isc0 = new SKIPSMImagePixelType[dst_w + 1];
     SKIPSMImagePixelType* isc1 = new SKIPSMImagePixelType[dst_w + 1];
     SKIPSMImagePixelType* iscp = new SKIPSMImagePixelType[dst_w + 1];
 
     // State variables for source mask pixel values
-    SKIPSMAlphaPixelType asr0, asr1, asrp;
     SKIPSMAlphaPixelType* asc0 = new SKIPSMAlphaPixelType[dst_w + 1];
     SKIPSMAlphaPixelType* asc1 = new SKIPSMAlphaPixelType[dst_w + 1];
     SKIPSMAlphaPixelType* ascp = new SKIPSMAlphaPixelType[dst_w + 1];
 
+    // Horizontally filtered source row and vertical sums
+    SKIPSMImagePixelType* ih = new SKIPSMImagePixelType[dst_w + 1];
+    SKIPSMImagePixelType* isum = new SKIPSMImagePixelType[dst_w + 1];
+    SKIPSMAlphaPixelType* ah = new SKIPSMAlphaPixelType[dst_w + 1];
+    SKIPSMAlphaPixelType* asum = new SKIPSMAlphaPixelType[dst_w + 1];
+
     // Convenient constants
     const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
     const SKIPSMAlphaPixelType SKIPSMAlphaZero(vigra::NumericTraits<SKIPSMAlphaPixelType>::zero());
-    const SKIPSMAlphaPixelType SKIPSMAlphaOne(vigra::NumericTraits<SKIPSMAlphaPixelType>::one());
     const DestPixelType DestImageZero(vigra::NumericTraits<DestPixelType>::zero());
     const DestAlphaPixelType DestAlphaZero(vigra::NumericTraits<DestAlphaPixelType>::zero());
     const DestAlphaPixelType DestAlphaMax(vigra::NumericTraits<DestAlphaPixelType>::max());
 
-    DestImageIterator dy = dest_upperleft;
+    DestImageIterator dy = dest_upperleft + vigra::Diff2D(0, dst_y_begin);
     DestImageIterator dx = dy;
     SrcImageIterator sy = src_upperleft;
-    SrcImageIterator sx = sy;
     AlphaIterator ay = alpha_upperleft;
-    AlphaIterator ax = ay;
-    DestAlphaIterator day = dest_alpha_upperleft;
+    DestAlphaIterator day = dest_alpha_upperleft + vigra::Diff2D(0, dst_y_begin);
     DestAlphaIterator dax = day;
 
     bool evenY = true;
-    bool evenX = true;
     int srcy = 0;
-    int srcx = 0;
-    //int dsty = 0;
     int dstx = 0;
 
     // First row
-    {
-        if (wraparound) {
-            asr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-            asr1 = SKIPSMAlphaZero;
-            asrp = aa(ay, vigra::Diff2D(src_w - 1, 0)) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero;
-            isr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0))) : SKIPSMImageZero;
-            isr1 = SKIPSMImageZero;
-            isrp =
-                aa(ay, vigra::Diff2D(src_w - 1, 0)) ?
-                vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4) :
-                SKIPSMImageZero;
-        } else {
-            asr0 = SKIPSMAlphaZero;
-            asr1 = SKIPSMAlphaZero;
-            asrp = SKIPSMAlphaZero;
-            isr0 = SKIPSMImageZero;
-            isr1 = SKIPSMImageZero;
-            isrp = SKIPSMImageZero;
-        }
-
-        for (sx = sy, ax = ay, evenX = true, srcx = 0, dstx = 0;
-             srcx < src_w;
-             ++srcx, ++sx.x, ++ax.x) {
-            SKIPSMAlphaPixelType mcurrent(aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-            SKIPSMImagePixelType icurrent(aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
-            if (evenX) {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + AMUL6(asr0) + asrp + mcurrent;
-                asr1 = asr0 + asrp;
-                asr0 = mcurrent;
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + IMUL6(isr0) + isrp + icurrent;
-                isr1 = isr0 + isrp;
-                isr0 = icurrent;
-            } else {
-                asrp = mcurrent * 4;
-                isrp = icurrent * 4;
-                ++dstx;
-            }
-            evenX = !evenX;
+    if (dst_y_begin == 0) {
+        reduceRow(wraparound, sy, sa, ay, aa, src_w, ih, ah);
+        for (dstx = 1; dstx < dst_w + 1; ++dstx) {
+            asc1[dstx] = SKIPSMAlphaZero;
+            asc0[dstx] = ah[dstx];
+            isc1[dstx] = SKIPSMImageZero;
+            isc0[dstx] = ih[dstx];
         }
 
-        // Last entries in first row
-        if (!evenX) {
-            // previous srcx was even
-            ++dstx;
-            if (wraparound) {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] =
-                    asr1 + AMUL6(asr0) +
-                    (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero) +
-                    (aa(ay, vigra::Diff2D(1,0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] =
-                    isr1 + IMUL6(isr0) +
-                    (aa(ay) ?
-                     vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
-                     SKIPSMImageZero) +
-                    (aa(ay, vigra::Diff2D(1, 0)) ?
-                     vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)))) :
-                     SKIPSMImageZero);
-            } else {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + AMUL6(asr0);
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + IMUL6(isr0);
-            }
-        } else {
-            // previous srcx was odd
-            if (wraparound) {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + AMUL6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + IMUL6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero);
-            } else {
-                asc1[dstx] = SKIPSMAlphaZero;
-                asc0[dstx] = asr1 + AMUL6(asr0) + asrp;
-                isc1[dstx] = SKIPSMImageZero;
-                isc0[dstx] = isr1 + IMUL6(isr0) + isrp;
-            }
-        }
+        ++sy.y;
+        ++ay.y;
+        evenY = false;
+        srcy = 1;
+    } else {
+        // The band starts further down.  Prime the column state by
+        // running the machine over the two pairs of source rows
+        // above the band, discarding the output rows they produce.
+        std::fill(isc0, isc0 + dst_w + 1, SKIPSMImageZero);
+        std::fill(isc1, isc1 + dst_w + 1, SKIPSMImageZero);
+        std::fill(iscp, iscp + dst_w + 1, SKIPSMImageZero);
+        std::fill(asc0, asc0 + dst_w + 1, SKIPSMAlphaZero);
+        std::fill(asc1, asc1 + dst_w + 1, SKIPSMAlphaZero);
+        std::fill(ascp, ascp + dst_w + 1, SKIPSMAlphaZero);
+        evenY = true;
+        srcy = 2 * dst_y_begin - 2;
+        sy.y += srcy;
+        ay.y += srcy;
     }
-    ++sy.y;
-    ++ay.y;
 
     // Main Rows
     {
-        for (evenY = false, srcy = 1; srcy < src_h; ++srcy, ++sy.y, ++ay.y) {
-            if (wraparound) {
-                asr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-                asr1 = SKIPSMAlphaZero;
-                asrp = aa(ay, vigra::Diff2D(src_w - 1, 0)) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero;
-                isr0 = aa(ay, vigra::Diff2D(src_w - 2, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2,0))) : SKIPSMImageZero;
-                isr1 = SKIPSMImageZero;
-                isrp =
-                    aa(ay, vigra::Diff2D(src_w - 1, 0)) ?
-                    vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1,0))) * 4) :
-                    SKIPSMImageZero;
-            } else {
-                asr0 = SKIPSMAlphaZero;
-                asr1 = SKIPSMAlphaZero;
-                asrp = SKIPSMAlphaZero;
-                isr0 = SKIPSMImageZero;
-                isr1 = SKIPSMImageZero;
-                isrp = SKIPSMImageZero;
-            }
+        for (; srcy < src_y_end; ++srcy, ++sy.y, ++ay.y) {
+            reduceRow(wraparound, sy, sa, ay, aa, src_w, ih, ah);
 
             if (evenY) {
-                // Even-numbered row
-
-                // First entry in row
-                sx = sy;
-                ax = ay;
-                if (wraparound) {
-                    asr1 = asr0 + asrp;
-                    isr1 = isr0 + isrp;
-                }
-                asr0 = aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-                isr0 = aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero;
-                // isc*[0] are never used
-                ++sx.x;
-                ++ax.x;
-                dx = dy;
-                dax = day;
-
-                // Main entries in row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x, ++ax.x) {
-                    SKIPSMAlphaPixelType mcurrent(aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    SKIPSMImagePixelType icurrent(aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
-                    if (evenX) {
-                        SKIPSMAlphaPixelType ap = asc1[dstx] + AMUL6(asc0[dstx]) + ascp[dstx];
-                        asc1[dstx] = asc0[dstx] + ascp[dstx];
-                        asc0[dstx] = asr1 + AMUL6(asr0) + asrp + mcurrent;
-                        asr1 = asr0 + asrp;
-                        asr0 = mcurrent;
-                        ap += asc0[dstx];
-
-                        SKIPSMImagePixelType ip = isc1[dstx] + IMUL6(isc0[dstx]) + iscp[dstx];
-                        isc1[dstx] = isc0[dstx] + iscp[dstx];
-                        isc0[dstx] = isr1 + IMUL6(isr0) + isrp + icurrent;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
+                // Even-numbered row; it completes output row srcy/2 - 1.
+                reduceColumns(asc1, asc0, ascp, ah, asum, dst_w);
+                reduceColumns(isc1, isc0, iscp, ih, isum, dst_w);
+
+                if (srcy / 2 - 1 >= dst_y_begin) {
+                    for (dstx = 1, dx = dy, dax = day; dstx < dst_w + 1; ++dstx, ++dx.x, ++dax.x) {
+                        const SKIPSMAlphaPixelType ap = asum[dstx];
                         if (ap) {
-                            ip += isc0[dstx];
-                            ip /= SKIPSMImagePixelType(ap);
+                            SKIPSMImagePixelType ip = isum[dstx];
+                            normalizeByAlpha(ip, ap);
                             da.set(DestPixelType(ip), dx);
                             daa.set(DestAlphaMax, dax);
                         } else {
                             da.set(DestImageZero, dx);
                             daa.set(DestAlphaZero, dax);
                         }
-
-                        ++dx.x;
-                        ++dax.x;
-                    } else {
-                        asrp = mcurrent * 4;
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
-
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-
-                    SKIPSMAlphaPixelType ap = asc1[dstx] + AMUL6(asc0[dstx]) + ascp[dstx];
-                    asc1[dstx] = asc0[dstx] + ascp[dstx];
-                    if (wraparound) {
-                        asc0[dstx] = asr1 + AMUL6(asr0) + (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero) + (aa(ay, vigra::Diff2D(1,0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    } else {
-                        asc0[dstx] = asr1 + AMUL6(asr0);
-                    }
-                    ap += asc0[dstx];
-
-                    SKIPSMImagePixelType ip = isc1[dstx] + IMUL6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] =
-                            isr1 + IMUL6(isr0) +
-                            (aa(ay) ?
-                             vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
-                             SKIPSMImageZero) +
-                            (aa(ay, vigra::Diff2D(1, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0))) : SKIPSMImageZero);
-                    } else {
-                        isc0[dstx] = isr1 + IMUL6(isr0);
-                    }
-                    if (ap) {
-                        ip += isc0[dstx];
-                        ip /= SKIPSMImagePixelType(ap);
-                        da.set(DestPixelType(ip), dx);
-                        daa.set(DestAlphaMax, dax);
-                    } else {
-                        da.set(DestImageZero, dx);
-                        daa.set(DestAlphaZero, dax);
-                    }
-                } else {
-                    // Previous srcx was odd
-                    SKIPSMAlphaPixelType ap = asc1[dstx] + AMUL6(asc0[dstx]) + ascp[dstx];
-                    asc1[dstx] = asc0[dstx] + ascp[dstx];
-                    if (wraparound) {
-                        asc0[dstx] = asr1 + AMUL6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    } else {
-                        asc0[dstx] = asr1 + AMUL6(asr0) + asrp;
-                    }
-                    ap += asc0[dstx];
-
-                    SKIPSMImagePixelType ip = isc1[dstx] + IMUL6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] = isr1 + IMUL6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero);
-                    } else {
-                        isc0[dstx] = isr1 + IMUL6(isr0) + isrp;
-                    }
-                    if (ap) {
-                        ip += isc0[dstx];
-                        ip /= SKIPSMImagePixelType(ap);
-                        da.set(DestPixelType(ip), dx);
-                        daa.set(DestAlphaMax, dax);
-                    } else {
-                        da.set(DestImageZero, dx);
-                        daa.set(DestAlphaZero, dax);
                     }
+                    ++dy.y;
+                    ++day.y;
                 }
-
-                ++dy.y;
-                ++day.y;
             } else {
-                // First entry in odd-numbered row
-                sx = sy;
-                ax = ay;
-                if (wraparound) {
-                    asr1 = asr0 + asrp;
-                    isr1 = isr0 + isrp;
-                }
-                asr0 = aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero;
-                isr0 = aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero;
-                // isc*[0] are never used
-                ++sx.x;
-                ++ax.x;
-
-                // Main entries in odd-numbered row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x, ++ax.x) {
-                    SKIPSMAlphaPixelType mcurrent(aa(ax) ? SKIPSMAlphaOne : SKIPSMAlphaZero);
-                    SKIPSMImagePixelType icurrent(aa(ax) ? SKIPSMImagePixelType(sa(sx)) : SKIPSMImageZero);
-                    if (evenX) {
-                        ascp[dstx] = (asr1 + AMUL6(asr0) + asrp + mcurrent) * 4;
-                        asr1 = asr0 + asrp;
-                        asr0 = mcurrent;
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + isrp + icurrent) * 4;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                    } else {
-                        asrp = mcurrent * 4;
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
-
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-                    if (wraparound) {
-                        ascp[dstx] = (asr1 + AMUL6(asr0) + (aa(ay) ? (SKIPSMAlphaOne * 4) : SKIPSMAlphaZero)
-                                      + (aa(ay, vigra::Diff2D(1,0)) ? SKIPSMAlphaOne : SKIPSMAlphaZero)) * 4;
-                        iscp[dstx] =
-                            (isr1 + IMUL6(isr0) +
-                             (aa(ay) ?
-                              vigra::NumericTraits<SKIPSMImagePixelType>::fromRealPromote(SKIPSMImagePixelType(sa(sy)) * 4) :
-                              SKIPSMImageZero) +
-                             (aa(ay, vigra::Diff2D(1, 0)) ? SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0))) : SKIPSMImageZero)) * 4;
-                    } else {
-                        ascp[dstx] = (asr1 + AMUL6(asr0)) * 4;
-                        iscp[dstx] = (isr1 + IMUL6(isr0)) * 4;
-                    }
-                } else {
-                    // previous srcx was odd
-                    if (wraparound) {
-                        ascp[dstx] = (asr1 + AMUL6(asr0) + asrp + (aa(ay) ? SKIPSMAlphaOne : SKIPSMAlphaZero)) * 4;
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + isrp + (aa(ay) ? SKIPSMImagePixelType(sa(sy)) : SKIPSMImageZero)) * 4;
-                    } else {
-                        ascp[dstx] = (asr1 + AMUL6(asr0) + asrp) * 4;
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + isrp) * 4;
-                    }
+                // Odd-numbered row
+                for (dstx = 1; dstx < dst_w + 1; ++dstx) {
+                    ascp[dstx] = ah[dstx] * 4;
+                    iscp[dstx] = ih[dstx] * 4;
                 }
             }
             evenY = !evenY;
@@ -517,7 +651,7 @@ reduce(bool wraparound,
     }
 
     // Last Rows
-    {
+    if (dst_y_end == dst_h) {
         if (!evenY) {
             // Last srcy was even
             // odd row will set all iscp[] to zero
@@ -563,6 +697,52 @@ reduce(bool wraparound,
     delete [] asc0;
     delete [] asc1;
     delete [] ascp;
+
+    delete [] ih;
+    delete [] isum;
+    delete [] ah;
+    delete [] asum;
+}
+
+
+/** The Burt & Adelson Reduce operation.
+ *  This version is for images with alpha channels.
+ *  The destination is split into horizontal bands, which are
+ *  reduced in parallel.
+ */
+template <typename SKIPSMImagePixelType, typename SKIPSMAlphaPixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename AlphaIterator, typename AlphaAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename DestAlphaIterator, typename DestAlphaAccessor>
+inline void
+reduce(bool wraparound,
+       SrcImageIterator src_upperleft,
+       SrcImageIterator src_lowerright,
+       SrcAccessor sa,
+       AlphaIterator alpha_upperleft,
+       AlphaAccessor aa,
+       DestImageIterator dest_upperleft,
+       DestImageIterator dest_lowerright,
+       DestAccessor da,
+       DestAlphaIterator dest_alpha_upperleft,
+       DestAlphaIterator dest_alpha_lowerright,
+       DestAlphaAccessor daa)
+{
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int bands = numberOfPyramidBands(dst_h);
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static) if (bands > 1)
+#endif
+    for (int band = 0; band < bands; ++band) {
+        reduceBand<SKIPSMImagePixelType, SKIPSMAlphaPixelType>(wraparound,
+                                                               src_upperleft, src_lowerright, sa,
+                                                               alpha_upperleft, aa,
+                                                               dest_upperleft, dest_lowerright, da,
+                                                               dest_alpha_upperleft, dest_alpha_lowerright, daa,
+                                                               band * dst_h / bands, (band + 1) * dst_h / bands);
+    }
 }
 
 
@@ -588,220 +768,170 @@ reduce(bool wraparound,
 
 
 
+/** Horizontal SKIPSM pass of reduce() for images without alpha
+ *  channels.  Filter source row sy and leave the values for
+ *  destination columns 1, ..., ceil(src_w/2) in h.
+ */
+template <typename SKIPSMImagePixelType, typename SrcImageIterator, typename SrcAccessor>
+inline void
+reduceRow(bool wraparound, SrcImageIterator sy, SrcAccessor sa, int src_w, SKIPSMImagePixelType* h)
+{
+    SKIPSMImagePixelType isr0, isr1, isrp;
+
+    if (wraparound) {
+        isr0 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0)));
+        isr1 = vigra::NumericTraits<SKIPSMImagePixelType>::zero();
+        isrp = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4;
+    } else {
+        isr0 = SKIPSMImagePixelType(sa(sy));
+        isr1 = vigra::NumericTraits<SKIPSMImagePixelType>::zero();
+        isrp = SKIPSMImagePixelType(sa(sy)) * 4;
+    }
+
+    // First entry in row
+    SrcImageIterator sx = sy;
+    isr1 = isr0 + isrp;
+    isr0 = SKIPSMImagePixelType(sa(sx));
+    // h[0] is never used
+    ++sx.x;
+
+    // Main entries in row, visited in (odd, even) pairs
+    int dstx = 0;
+    for (int srcx = 1; srcx < src_w; srcx += 2) {
+        {
+            // odd source pixel
+            isrp = SKIPSMImagePixelType(sa(sx)) * 4;
+            ++dstx;
+            ++sx.x;
+        }
+        if (srcx + 1 < src_w) {
+            // even source pixel
+            SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
+            h[dstx] = isr1 + IMUL6(isr0) + isrp + icurrent;
+            isr1 = isr0 + isrp;
+            isr0 = icurrent;
+            ++sx.x;
+        }
+    }
+
+    // Last entries in row
+    if ((src_w & 1) != 0) {
+        // previous srcx was even
+        ++dstx;
+        if (wraparound) {
+            h[dstx] = isr1 + IMUL6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
+                + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)));
+        } else {
+            h[dstx] = isr1 + IMUL11(isr0);
+        }
+    } else {
+        // previous srcx was odd
+        if (wraparound) {
+            h[dstx] = isr1 + IMUL6(isr0) + isrp + SKIPSMImagePixelType(sa(sy));
+        } else {
+            h[dstx] = isr1 + IMUL6(isr0) + isrp + (isrp / 4);
+        }
+    }
+}
+
+
 /** The Burt & Adelson Reduce operation.
  *  This version is for images that do not have alpha channels.
+ *  See the version for images with alpha channels for the
+ *  explanation of bands.
  */
 template <typename SKIPSMImagePixelType,
           typename SrcImageIterator, typename SrcAccessor,
           typename DestImageIterator, typename DestAccessor>
 inline void
-reduce(bool wraparound,
-       SrcImageIterator src_upperleft,
-       SrcImageIterator src_lowerright,
-       SrcAccessor sa,
-       DestImageIterator dest_upperleft,
-       DestImageIterator dest_lowerright,
-       DestAccessor da)
+reduceBand(bool wraparound,
+           SrcImageIterator src_upperleft,
+           SrcImageIterator src_lowerright,
+           SrcAccessor sa,
+           DestImageIterator dest_upperleft,
+           DestImageIterator dest_lowerright,
+           DestAccessor da,
+           int dst_y_begin, int dst_y_end)
 {
     typedef typename DestAccessor::value_type DestPixelType;
 
     const int src_w = src_lowerright.x - src_upperleft.x;
     const int src_h = src_lowerright.y - src_upperleft.y;
     const int dst_w = dest_lowerright.x - dest_upperleft.x;
-    //const int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
 
     vigra_precondition(src_w > 1 && src_h > 1,
                        "src image too small in reduce");
+    vigra_precondition(0 <= dst_y_begin && dst_y_begin < dst_y_end && dst_y_end <= dst_h,
+                       "invalid band in reduce");
+
+    // Source row after the last one that contributes to the band
+    const int src_y_end = dst_y_end == dst_h ? src_h : 2 * dst_y_end + 1;
 
     // State variables for source image pixel values
-    SKIPSMImagePixelType isr0, isr1, isrp;
     SKIPSMImagePixelType* isc0 = new SKIPSMImagePixelType[dst_w + 1];
     SKIPSMImagePixelType* isc1 = new SKIPSMImagePixelType[dst_w + 1];
     SKIPSMImagePixelType* iscp = new SKIPSMImagePixelType[dst_w + 1];
 
+    // Horizontally filtered source row and vertical sums
+    SKIPSMImagePixelType* ih = new SKIPSMImagePixelType[dst_w + 1];
+    SKIPSMImagePixelType* isum = new SKIPSMImagePixelType[dst_w + 1];
+
     // Convenient constants
     const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
 
-    DestImageIterator dy = dest_upperleft;
+    DestImageIterator dy = dest_upperleft + vigra::Diff2D(0, dst_y_begin);
     DestImageIterator dx = dy;
     SrcImageIterator sy = src_upperleft;
-    SrcImageIterator sx = sy;
 
     bool evenY = true;
-    bool evenX = true;
     int srcy = 0;
-    int srcx = 0;
-    //int dsty = 0;
     int dstx = 0;
 
     // First row
-    {
-        if (wraparound) {
-            isr0 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0)));
-            isr1 = SKIPSMImageZero;
-            isrp = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4;
-        } else {
-            isr0 = SKIPSMImagePixelType(sa(sy));
-            isr1 = SKIPSMImageZero;
-            isrp = SKIPSMImagePixelType(sa(sy)) * 4;
+    if (dst_y_begin == 0) {
+        reduceRow(wraparound, sy, sa, src_w, ih);
+        for (dstx = 1; dstx < dst_w + 1; ++dstx) {
+            isc0[dstx] = ih[dstx];
+            isc1[dstx] = IMUL5(isc0[dstx]);
         }
 
-        // Main pixels in first row
-        for (sx = sy, evenX = true, srcx = 0, dstx = 0;
-             srcx < src_w;
-             ++srcx, ++sx.x) {
-            SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
-            if (evenX) {
-                isc0[dstx] = isr1 + IMUL6(isr0) + isrp + icurrent;
-                isc1[dstx] = IMUL5(isc0[dstx]);
-                isr1 = isr0 + isrp;
-                isr0 = icurrent;
-            } else {
-                isrp = icurrent * 4;
-                ++dstx;
-            }
-            evenX = !evenX;
-        }
-
-        // Last entries in first row
-        if (!evenX) {
-            // previous srcx was even
-            ++dstx;
-            if (wraparound) {
-                isc0[dstx] = isr1 + IMUL6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
-                    + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)));
-                isc1[dstx] = IMUL5(isc0[dstx]);
-            } else {
-                isc0[dstx] = isr1 + IMUL11(isr0);
-                isc1[dstx] = IMUL5(isc0[dstx]);
-            }
-        } else {
-            // previous srcx was odd
-            if (wraparound) {
-                isc0[dstx] = isr1 + IMUL6(isr0) + isrp + SKIPSMImagePixelType(sa(sy));
-                isc1[dstx] = IMUL5(isc0[dstx]);
-            } else {
-                isc0[dstx] = isr1 + IMUL6(isr0) + isrp + (isrp / 4);
-                isc1[dstx] = IMUL5(isc0[dstx]);
-            }
-        }
-    }
-    ++sy.y;
+        ++sy.y;
+        evenY = false;
+        srcy = 1;
+    } else {
+        // The band starts further down.  Prime the column state by
+        // running the machine over the two pairs of source rows
+        // above the band, discarding the output rows they produce.
+        std::fill(isc0, isc0 + dst_w + 1, SKIPSMImageZero);
+        std::fill(isc1, isc1 + dst_w + 1, SKIPSMImageZero);
+        std::fill(iscp, iscp + dst_w + 1, SKIPSMImageZero);
+        evenY = true;
+        srcy = 2 * dst_y_begin - 2;
+        sy.y += srcy;
+    }
 
     // Main Rows
     {
-        for (evenY = false, srcy = 1; srcy < src_h; ++srcy, ++sy.y) {
-            if (wraparound) {
-                isr0 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 2, 0)));
-                isr1 = SKIPSMImageZero;
-                isrp = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0))) * 4;
-            } else {
-                isr0 = SKIPSMImagePixelType(sa(sy));
-                isr1 = SKIPSMImageZero;
-                isrp = SKIPSMImagePixelType(sa(sy)) * 4;
-            }
+        for (; srcy < src_y_end; ++srcy, ++sy.y) {
+            reduceRow(wraparound, sy, sa, src_w, ih);
 
             if (evenY) {
-                // Even-numbered row
-
-                // First entry in row
-                sx = sy;
-                isr1 = isr0 + isrp;
-                isr0 = SKIPSMImagePixelType(sa(sx));
-                // isc*[0] are never used
-                ++sx.x;
-                dx = dy;
-
-                // Main entries in row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x) {
-                    SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
-                    if (evenX) {
-                        SKIPSMImagePixelType ip = isc1[dstx] + IMUL6(isc0[dstx]) + iscp[dstx];
-                        isc1[dstx] = isc0[dstx] + iscp[dstx];
-                        isc0[dstx] = isr1 + IMUL6(isr0) + isrp + icurrent;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                        ip += isc0[dstx];
+                // Even-numbered row; it completes output row srcy/2 - 1.
+                reduceColumns(isc1, isc0, iscp, ih, isum, dst_w);
+
+                if (srcy / 2 - 1 >= dst_y_begin) {
+                    for (dstx = 1, dx = dy; dstx < dst_w + 1; ++dstx, ++dx.x) {
+                        SKIPSMImagePixelType ip = isum[dstx];
                         ip /= 256;
                         da.set(DestPixelType(ip), dx);
-                        ++dx.x;
-                    } else {
-                        isrp = icurrent * 4;
-                        ++dstx;
                     }
-                    evenX = !evenX;
+                    ++dy.y;
                 }
-
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-
-                    SKIPSMImagePixelType ip = isc1[dstx] + IMUL6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] = isr1 + IMUL6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
-                            + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)));
-                    } else {
-                        isc0[dstx] = isr1 + IMUL11(isr0);
-                    }
-                    ip += isc0[dstx];
-                    ip /= 256;
-                    da.set(DestPixelType(ip), dx);
-                } else {
-                    // Previous srcx was odd
-                    SKIPSMImagePixelType ip = isc1[dstx] + IMUL6(isc0[dstx]) + iscp[dstx];
-                    isc1[dstx] = isc0[dstx] + iscp[dstx];
-                    if (wraparound) {
-                        isc0[dstx] = isr1 + IMUL6(isr0) + isrp + SKIPSMImagePixelType(sa(sy));
-                    } else {
-                        isc0[dstx] = isr1 + IMUL6(isr0) + isrp + (isrp / 4);
-                    }
-                    ip += isc0[dstx];
-                    ip /= 256;
-                    da.set(DestPixelType(ip), dx);
-                }
-
-                ++dy.y;
             } else {
-                // First entry in odd-numbered row
-                sx = sy;
-                isr1 = isr0 + isrp;
-                isr0 = SKIPSMImagePixelType(sa(sx));
-                // isc*[0] are never used
-                ++sx.x;
-
-                // Main entries in odd-numbered row
-                for (evenX = false, srcx = 1, dstx = 0; srcx < src_w; ++srcx, ++sx.x) {
-                    SKIPSMImagePixelType icurrent(SKIPSMImagePixelType(sa(sx)));
-                    if (evenX) {
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + isrp + icurrent) * 4;
-                        isr1 = isr0 + isrp;
-                        isr0 = icurrent;
-                    } else {
-                        isrp = icurrent * 4;
-                        ++dstx;
-                    }
-                    evenX = !evenX;
-                }
-                // Last entries in row
-                if (!evenX) {
-                    // previous srcx was even
-                    ++dstx;
-                    if (wraparound) {
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + (SKIPSMImagePixelType(sa(sy)) * 4)
-                                      + SKIPSMImagePixelType(sa(sy, vigra::Diff2D(1, 0)))
-                                      ) * 4;
-                    } else {
-                        iscp[dstx] = (isr1 + IMUL11(isr0)) * 4;
-                    }
-                } else {
-                    // previous srcx was odd
-                    if (wraparound) {
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + isrp + SKIPSMImagePixelType(sa(sy))) * 4;
-                    } else {
-                        iscp[dstx] = (isr1 + IMUL6(isr0) + isrp + (isrp / 4)) * 4;
-                    }
+                // Odd-numbered row
+                for (dstx = 1; dstx < dst_w + 1; ++dstx) {
+                    iscp[dstx] = ih[dstx] * 4;
                 }
             }
             evenY = !evenY;
@@ -809,7 +939,7 @@ reduce(bool wraparound,
     }
 
     // Last Rows
-    {
+    if (dst_y_end == dst_h) {
         if (!evenY) {
             // Last srcy was even
             // odd row will set all iscp[] to zero
@@ -838,6 +968,41 @@ reduce(bool wraparound,
     delete [] isc0;
     delete [] isc1;
     delete [] iscp;
+
+    delete [] ih;
+    delete [] isum;
+}
+
+
+/** The Burt & Adelson Reduce operation.
+ *  This version is for images that do not have alpha channels.
+ *  The destination is split into horizontal bands, which are
+ *  reduced in parallel.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor>
+inline void
+reduce(bool wraparound,
+       SrcImageIterator src_upperleft,
+       SrcImageIterator src_lowerright,
+       SrcAccessor sa,
+       DestImageIterator dest_upperleft,
+       DestImageIterator dest_lowerright,
+       DestAccessor da)
+{
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int bands = numberOfPyramidBands(dst_h);
+
+#ifdef OPENMP
+#pragma omp parallel for schedule(static) if (bands > 1)
+#endif
+    for (int band = 0; band < bands; ++band) {
+        reduceBand<SKIPSMImagePixelType>(wraparound,
+                                         src_upperleft, src_lowerright, sa,
+                                         dest_upperleft, dest_lowerright, da,
+                                         band * dst_h / bands, (band + 1) * dst_h / bands);
+    }
 }
 
 
@@ -856,172 +1021,306 @@ reduce(bool wraparound,
 }
 
 
-// SKIPSM update routine used when visiting a pixel in the top two rows
-// and the left two rows.
-#define SKIPSM_EXPAND(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        current = SKIPSMImagePixelType(sa(sx));                     \
-        out00 = sc1a[srcx] + IMUL6(sc0a[srcx]);                     \
-        out10 = sc1b[srcx] + IMUL6(sc0b[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + IMUL6(sr0) + current;                    \
-        sc0b[srcx] = (sr0 + current) * 4;                           \
-        sr1 = sr0;                                                  \
-        sr0 = current;                                              \
-        out00 += sc0a[srcx];                                        \
-        out10 += sc0b[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out11 += sc0b[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out10 /= SKIPSMImagePixelType(SCALE_OUT10);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        out11 /= SKIPSMImagePixelType(SCALE_OUT11);                 \
-        da.set(cf(SKIPSMImagePixelType(da(dx)), out00), dx);        \
-        ++dx.x;                                                     \
-        da.set(cf(SKIPSMImagePixelType(da(dx)), out10), dx);        \
-        ++dx.x;                                                     \
-        da.set(cf(SKIPSMImagePixelType(da(dxx)), out01), dxx);      \
-        ++dxx.x;                                                    \
-        da.set(cf(SKIPSMImagePixelType(da(dxx)), out11), dxx);      \
-        ++dxx.x;                                                    \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra row under the main image body.
-#define SKIPSM_EXPAND_ROW_END(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + IMUL6(sc0a[srcx]);                     \
-        out10 = sc1b[srcx] + IMUL6(sc0b[srcx]);                     \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out10 /= SKIPSMImagePixelType(SCALE_OUT10);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        ++dx.x;                                                     \
-        da.set(cf(da(dx), out10), dx);                              \
-        ++dx.x;                                                     \
-        if (dst_h_even) {                                           \
-            out01 = sc0a[srcx];                                     \
-            out11 = sc0b[srcx];                                     \
-            out01 /= SKIPSMImagePixelType(SCALE_OUT01);             \
-            out11 /= SKIPSMImagePixelType(SCALE_OUT11);             \
-            da.set(cf(da(dxx), out01), dxx);                        \
-            ++dxx.x;                                                \
-            da.set(cf(da(dxx), out11), dxx);                        \
-            ++dxx.x;                                                \
-        }                                                           \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra column to the right
-// of the main image body.
-#define SKIPSM_EXPAND_COLUMN_END(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + IMUL6(sc0a[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out10 = sc1b[srcx] + IMUL6(sc0b[srcx]);                     \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + IMUL6(sr0);                              \
-        sc0b[srcx] = sr0 * 4;                                       \
-        out00 += sc0a[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        da.set(cf(da(dxx), out01), dxx);                            \
-        if (dst_w_even) {                                           \
-            ++dx.x;                                                 \
-            ++dxx.x;                                                \
-            out10 += sc0b[srcx];                                    \
-            out11 += sc0b[srcx];                                    \
-            out10 /= SKIPSMImagePixelType(SCALE_OUT10);             \
-            out11 /= SKIPSMImagePixelType(SCALE_OUT11);             \
-            da.set(cf(da(dx), out10), dx);                          \
-            da.set(cf(da(dxx), out11), dxx);                        \
-        }                                                           \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra column to the right
-// of the main image body, with wraparound boundary conditions.
-// This version is for the case where the dst image has even width.
-#define SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_EVEN(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + IMUL6(sc0a[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out10 = sc1b[srcx] + IMUL6(sc0b[srcx]);                     \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + IMUL6(sr0) + SKIPSMImagePixelType(sa(sy)); \
-        sc0b[srcx] = (sr0 + SKIPSMImagePixelType(sa(sy))) * 4;      \
-        out00 += sc0a[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        da.set(cf(da(dxx), out01), dxx);                            \
-        ++dx.x;                                                     \
-        ++dxx.x;                                                    \
-        out10 += sc0b[srcx];                                        \
-        out11 += sc0b[srcx];                                        \
-        out10 /= SKIPSMImagePixelType(SCALE_OUT10);                 \
-        out11 /= SKIPSMImagePixelType(SCALE_OUT11);                 \
-        da.set(cf(da(dx), out10), dx);                              \
-        da.set(cf(da(dxx), out11), dxx);                            \
-    } while (false)
-
-
-// SKIPSM update routine used for the extra column to the right
-// of the main image body, with wraparound boundary conditions.
-// This version is for the case where the dst image has odd width.
-#define SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_ODD(SCALE_OUT00, SCALE_OUT01) \
-    do {                                                            \
-        out00 = sc1a[srcx] + IMUL6(sc0a[srcx]);                     \
-        out01 = sc0a[srcx];                                         \
-        out10 = sc1b[srcx] + IMUL6(sc0b[srcx]);                     \
-        out11 = sc0b[srcx];                                         \
-        sc1a[srcx] = sc0a[srcx];                                    \
-        sc1b[srcx] = sc0b[srcx];                                    \
-        sc0a[srcx] = sr1 + IMUL6(sr0) + IMUL4(SKIPSMImagePixelType(sa(sy))); \
-        sc0b[srcx] = (sr0 + SKIPSMImagePixelType(sa(sy))) * 4;      \
-        out00 += sc0a[srcx];                                        \
-        out01 += sc0a[srcx];                                        \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        out01 /= SKIPSMImagePixelType(SCALE_OUT01);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        da.set(cf(da(dxx), out01), dxx);                            \
-    } while (false)
-
-
-// SKIPSM update routine for the extra column to the right
-// of the extra row under the main image body.
-#define SKIPSM_EXPAND_ROW_COLUMN_END(SCALE_OUT00, SCALE_OUT10, SCALE_OUT01, SCALE_OUT11) \
-    do {                                                            \
-        out00 = sc1a[srcx] + IMUL6(sc0a[srcx]);                     \
-        out00 /= SKIPSMImagePixelType(SCALE_OUT00);                 \
-        da.set(cf(da(dx), out00), dx);                              \
-        if (dst_w_even) {                                           \
-            out10 = sc1b[srcx] + IMUL6(sc0b[srcx]);                 \
-            out10 /= SKIPSMImagePixelType(SCALE_OUT10);             \
-            ++dx.x;                                                 \
-            da.set(cf(da(dx), out10), dx);                          \
-        }                                                           \
-        if (dst_h_even) {                                           \
-            out01 = sc0a[srcx];                                     \
-            out01 /= SKIPSMImagePixelType(SCALE_OUT01);             \
-            da.set(cf(da(dxx), out01), dxx);                        \
-            if (dst_w_even) {                                       \
-                out11 = sc0b[srcx];                                 \
-                out11 /= SKIPSMImagePixelType(SCALE_OUT11);         \
-                ++dxx.x;                                            \
-                da.set(cf(da(dxx), out11), dxx);                    \
-            }                                                       \
-        }                                                           \
-    } while (false)
+/** Vertical SKIPSM step of expand().  For each column x it computes
+ *
+ *      out0[x] <= c1[x] + 6*c0[x] + h[x]
+ *      out1[x] <= c0[x] + h[x]
+ *
+ *  where c1, c0, and h are the horizontally interpolated source rows
+ *  y-2, y-1, and y, out0 is the unscaled even destination row, and
+ *  out1 the unscaled odd destination row.  As in
+ *  reduceComponentColumns() the columns are independent of each
+ *  other.
+ */
+template <typename ComponentType>
+inline void
+expandComponentColumns(const ComponentType* c1, const ComponentType* c0, const ComponentType* h,
+                       ComponentType* out0, ComponentType* out1, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        out0[i] = c1[i] + c0[i] * ComponentType(6) + h[i];
+        out1[i] = c0[i] + h[i];
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD_DISPATCH
+
+inline void
+expandComponentColumnsSSE2(const vigra::Int32* c1, const vigra::Int32* c0, const vigra::Int32* h,
+                           vigra::Int32* out0, vigra::Int32* out1, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128i vc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1 + i));
+        const __m128i vc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0 + i));
+        const __m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + i),
+                         _mm_add_epi32(_mm_add_epi32(vc1, SKIPSM_MUL6_EPI32(vc0)), vh));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + i), _mm_add_epi32(vc0, vh));
+    }
+    expandComponentColumns<vigra::Int32>(c1 + i, c0 + i, h + i, out0 + i, out1 + i, n - i);
+}
+
+
+inline void
+expandComponentColumnsSSE2(const vigra::Int16* c1, const vigra::Int16* c0, const vigra::Int16* h,
+                           vigra::Int16* out0, vigra::Int16* out1, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i vc1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c1 + i));
+        const __m128i vc0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c0 + i));
+        const __m128i vh = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + i),
+                         _mm_add_epi16(_mm_add_epi16(vc1, SKIPSM_MUL6_EPI16(vc0)), vh));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + i), _mm_add_epi16(vc0, vh));
+    }
+    expandComponentColumns<vigra::Int16>(c1 + i, c0 + i, h + i, out0 + i, out1 + i, n - i);
+}
+
+
+TARGET_AVX2 inline void
+expandComponentColumnsAVX2(const vigra::Int32* c1, const vigra::Int32* c0, const vigra::Int32* h,
+                           vigra::Int32* out0, vigra::Int32* out1, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i vc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1 + i));
+        const __m256i vc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + i));
+        const __m256i vh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out0 + i),
+                            _mm256_add_epi32(_mm256_add_epi32(vc1, SKIPSM_MUL6_EPI32_256(vc0)), vh));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out1 + i), _mm256_add_epi32(vc0, vh));
+    }
+    expandComponentColumnsSSE2(c1 + i, c0 + i, h + i, out0 + i, out1 + i, n - i);
+}
+
+
+TARGET_AVX2 inline void
+expandComponentColumnsAVX2(const vigra::Int16* c1, const vigra::Int16* c0, const vigra::Int16* h,
+                           vigra::Int16* out0, vigra::Int16* out1, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i vc1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c1 + i));
+        const __m256i vc0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c0 + i));
+        const __m256i vh = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out0 + i),
+                            _mm256_add_epi16(_mm256_add_epi16(vc1, SKIPSM_MUL6_EPI16_256(vc0)), vh));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out1 + i), _mm256_add_epi16(vc0, vh));
+    }
+    expandComponentColumnsSSE2(c1 + i, c0 + i, h + i, out0 + i, out1 + i, n - i);
+}
+
+#undef SKIPSM_MUL6_EPI32
+#undef SKIPSM_MUL6_EPI16
+#undef SKIPSM_MUL6_EPI32_256
+#undef SKIPSM_MUL6_EPI16_256
+
+
+inline void
+expandComponentColumns(const vigra::Int32* c1, const vigra::Int32* c0, const vigra::Int32* h,
+                       vigra::Int32* out0, vigra::Int32* out1, int n)
+{
+    if (muopt::cpu_supports_avx2()) {
+        expandComponentColumnsAVX2(c1, c0, h, out0, out1, n);
+    } else {
+        expandComponentColumnsSSE2(c1, c0, h, out0, out1, n);
+    }
+}
+
+
+inline void
+expandComponentColumns(const vigra::Int16* c1, const vigra::Int16* c0, const vigra::Int16* h,
+                       vigra::Int16* out0, vigra::Int16* out1, int n)
+{
+    if (muopt::cpu_supports_avx2()) {
+        expandComponentColumnsAVX2(c1, c0, h, out0, out1, n);
+    } else {
+        expandComponentColumnsSSE2(c1, c0, h, out0, out1, n);
+    }
+}
+
+#endif // HAVE_X86_SIMD_DISPATCH
+
+
+/** Apply expandComponentColumns() to n pixels of rows of scalar or
+ *  RGB pixels. */
+template <typename SKIPSMPixelType>
+inline void
+expandColumns(const SKIPSMPixelType* c1, const SKIPSMPixelType* c0, const SKIPSMPixelType* h,
+              SKIPSMPixelType* out0, SKIPSMPixelType* out1, int n)
+{
+    typedef SKIPSMComponentTraits<SKIPSMPixelType> Traits;
+    typedef typename Traits::ComponentType ComponentType;
+    BOOST_STATIC_ASSERT(sizeof(SKIPSMPixelType) == Traits::components * sizeof(ComponentType));
+
+    expandComponentColumns(reinterpret_cast<const ComponentType*>(c1),
+                           reinterpret_cast<const ComponentType*>(c0),
+                           reinterpret_cast<const ComponentType*>(h),
+                           reinterpret_cast<ComponentType*>(out0),
+                           reinterpret_cast<ComponentType*>(out1),
+                           Traits::components * n);
+}
+
+
+/** Horizontal SKIPSM pass of expand().  Interpolate source row sy
+ *  into the interleaved row h: h[2*x] and h[2*x+1] receive the
+ *  values of the even and odd destination columns of source column
+ *  x, for x = 1, ..., src_w, where src_w is the extra column at the
+ *  end of the row.  Thus h[2], h[3], ... line up with the
+ *  destination row.
+ *
+ *  Only the first row lets a single-column image wrap around in the
+ *  extra column; the other rows see the wrapped pixel in sr1 only.
+ */
+template <typename SKIPSMImagePixelType, typename SrcImageIterator, typename SrcAccessor>
+inline void
+expandRow(bool wraparound, bool dst_w_even, bool first_row,
+          SrcImageIterator sy, SrcAccessor sa, int src_w,
+          SKIPSMImagePixelType* h)
+{
+    SrcImageIterator sx = sy;
+    SKIPSMImagePixelType current;
+    SKIPSMImagePixelType sr0 = SKIPSMImagePixelType(sa(sx));
+    SKIPSMImagePixelType sr1;
+
+    if (wraparound) {
+        sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0)));
+        if (!dst_w_even) {
+            sr1 = IMUL4(sr1);
+        }
+    } else {
+        sr1 = vigra::NumericTraits<SKIPSMImagePixelType>::zero();
+    }
+    // h[0] and h[1] are never used
+    ++sx.x;
+
+    int srcx = 1;
+    for (; srcx < src_w; ++srcx, ++sx.x) {
+        current = SKIPSMImagePixelType(sa(sx));
+        h[2 * srcx] = sr1 + IMUL6(sr0) + current;
+        h[2 * srcx + 1] = (sr0 + current) * 4;
+        sr1 = sr0;
+        sr0 = current;
+    }
+
+    // extra column at end of row
+    if (wraparound && (src_w > 1 || first_row)) {
+        current = SKIPSMImagePixelType(sa(sy));
+        if (dst_w_even) {
+            h[2 * srcx] = sr1 + IMUL6(sr0) + current;
+        } else {
+            h[2 * srcx] = sr1 + IMUL6(sr0) + IMUL4(current);
+        }
+        h[2 * srcx + 1] = (sr0 + current) * 4;
+    } else {
+        h[2 * srcx] = sr1 + IMUL6(sr0);
+        h[2 * srcx + 1] = sr0 * 4;
+    }
+}
+
+
+/** Scale the unscaled values out[0], ..., out[n-1] of destination
+ *  row dx by dividing them by Weight and combine them into the
+ *  row. */
+template <int Weight,
+          typename SKIPSMImagePixelType,
+          typename DestImageIterator, typename DestAccessor,
+          typename CombineFunctor>
+inline void
+expandWriteRun(DestImageIterator dx, DestAccessor da, CombineFunctor cf,
+               const SKIPSMImagePixelType* out, int n)
+{
+    for (int i = 0; i < n; ++i, ++dx.x) {
+        SKIPSMImagePixelType p = out[i];
+        p /= SKIPSMImagePixelType(Weight);
+        da.set(cf(da(dx), p), dx);
+    }
+}
+
+
+/** Scale and write destination rows dy and, if odd_row is true,
+ *  dy + 1 of expand() from the interleaved rows c1, c0, and h, which
+ *  hold the interpolated source rows y-2, y-1, and y; h is null for
+ *  the extra row at the end.  The unscaled values of a chunk of
+ *  EXPAND_CHUNK destination columns are computed with
+ *  expandColumns() and written right away, while they are still in
+ *  the cache.
+ *
+ *  The values of dy are divided by the product of RowWeight0 and
+ *  the weight of their column, those of dy + 1 by the product of
+ *  RowWeight1 and the weight of their column.  The column weight is
+ *  8 for the main columns and given by column_weight[0] for the
+ *  destination columns of source column 1 and by column_weight[1]
+ *  for those of column src_w.  The odd destination column of src_w
+ *  exists only for even dst_w.  The row weights are template
+ *  parameters, so that the divisions of the main columns are by
+ *  constants.
+ */
+template <int RowWeight0, int RowWeight1,
+          typename SKIPSMImagePixelType,
+          typename DestImageIterator, typename DestAccessor,
+          typename CombineFunctor>
+inline void
+expandRowPair(DestImageIterator dy, DestAccessor da, CombineFunctor cf,
+              const SKIPSMImagePixelType* c1, const SKIPSMImagePixelType* c0, const SKIPSMImagePixelType* h,
+              int src_w, const int column_weight[2][2], bool dst_w_even, bool odd_row)
+{
+    const int n = 2 * src_w - (dst_w_even ? 0 : 1);
+    const int first_end = src_w > 1 ? 2 : 0;
+    const int last_begin = 2 * (src_w - 1);
+    DestImageIterator dyy = dy + vigra::Diff2D(0, 1);
+    SKIPSMImagePixelType out0[EXPAND_CHUNK];
+    SKIPSMImagePixelType out1[EXPAND_CHUNK];
+
+    // Interleaved values of destination column j are at index j + 2.
+    c1 += 2;
+    c0 += 2;
+    if (h) {
+        h += 2;
+    }
+
+    for (int j0 = 0; j0 < n; j0 += EXPAND_CHUNK) {
+        const int j1 = std::min(n, j0 + EXPAND_CHUNK);
+
+        if (h) {
+            expandColumns(c1 + j0, c0 + j0, h + j0, out0, out1, j1 - j0);
+        } else {
+            for (int j = j0; j < j1; ++j) {
+                out0[j - j0] = c1[j] + IMUL6(c0[j]);
+                out1[j - j0] = c0[j];
+            }
+        }
+
+        const int main_begin = std::max(j0, first_end);
+        const int main_end = std::max(main_begin, std::min(j1, last_begin));
+        for (int j = j0; j < j1; ++j) {
+            if (j == main_begin && j < main_end) {
+                const int k = main_begin - j0;
+                expandWriteRun<RowWeight0 * 8>(dy + vigra::Diff2D(j, 0), da, cf, out0 + k, main_end - main_begin);
+                if (odd_row) {
+                    expandWriteRun<RowWeight1 * 8>(dyy + vigra::Diff2D(j, 0), da, cf, out1 + k, main_end - main_begin);
+                }
+                j = main_end - 1;
+                continue;
+            }
+
+            const int weight = j < first_end ? column_weight[0][j] : column_weight[1][j - last_begin];
+            const DestImageIterator dx = dy + vigra::Diff2D(j, 0);
+            SKIPSMImagePixelType p = out0[j - j0];
+            p /= SKIPSMImagePixelType(RowWeight0 * weight);
+            da.set(cf(da(dx), p), dx);
+            if (odd_row) {
+                const DestImageIterator dxx = dyy + vigra::Diff2D(j, 0);
+                p = out1[j - j0];
+                p /= SKIPSMImagePixelType(RowWeight1 * weight);
+                da.set(cf(da(dxx), p), dxx);
+            }
+        }
+    }
+}
 
 
 /** The Burt & Adelson Expand operation.
@@ -1084,324 +1383,167 @@ reduce(bool wraparound,
  *  out(-2, -1) <= 4*sc0a[x] + 4*(new sc0a[x])
  *  out(-1, -1) <= 4*sc0b[x] + 4*(new sc0b[x])
  *
+ *  The updates of sr0 and sr1 run along the row, the updates of sc*
+ *  do not.  Therefore, like reduce(), expand() runs them as two
+ *  passes per source row: expandRow() computes the new sc0a and sc0b
+ *  of all columns, then expandColumns() yields the unscaled outputs
+ *  of the whole row.  The a and b values of a column are interleaved,
+ *  so that the rows line up with the destination rows.  The new sc0*
+ *  and the old sc0* and sc1* are three row buffers, and the column
+ *  state advances by rotating them.  The outputs of the odd
+ *  destination row are kept at half their weight, i.e.,
+ *  out(-2, -1) = sc0a[x] + (new sc0a[x]).
+ *
+ *  Each output is normalized by the sum of the filter weights that
+ *  fall inside the image, which is the product of a row weight and
+ *  a column weight.  The row weights of the even and odd destination
+ *  rows are 7 and 2 for source row 1, whose column state lacks the
+ *  row above the image, 8 and 2 for the regular rows, and 7 and 1
+ *  for the extra row at the bottom, or 6 and 1 if the image has a
+ *  single row.  The column weights are set up in expandBand().
+ *
+ *  *************************************************************************************************
+ *  Bands:
+ *
+ *  expandBand() only visits the source rows [src_y_begin, src_y_end), where src_y_begin is
+ *  either zero or at least four.  Source row y writes destination rows 2(y-1) and 2(y-1)+1 and
+ *  depends on the column state of source rows y-2 and y-1 only.  A band that does not start at
+ *  the top visits these two rows first with the output switched off.
+ *
  */
 template <typename SKIPSMImagePixelType,
           typename SrcImageIterator, typename SrcAccessor,
           typename DestImageIterator, typename DestAccessor,
           typename CombineFunctor>
 void
-expand(bool add, bool wraparound,
-       SrcImageIterator src_upperleft,
-       SrcImageIterator src_lowerright,
-       SrcAccessor sa,
-       DestImageIterator dest_upperleft,
-       DestImageIterator dest_lowerright,
-       DestAccessor da,
-       CombineFunctor cf)
+expandBand(bool wraparound,
+           SrcImageIterator src_upperleft,
+           SrcImageIterator src_lowerright,
+           SrcAccessor sa,
+           DestImageIterator dest_upperleft,
+           DestImageIterator dest_lowerright,
+           DestAccessor da,
+           CombineFunctor cf,
+           int src_y_begin, int src_y_end)
 {
-    int src_w = src_lowerright.x - src_upperleft.x;
-    int src_h = src_lowerright.y - src_upperleft.y;
-    int dst_w = dest_lowerright.x - dest_upperleft.x;
-    int dst_h = dest_lowerright.y - dest_upperleft.y;
+    const int src_w = src_lowerright.x - src_upperleft.x;
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    const int dst_w = dest_lowerright.x - dest_upperleft.x;
+    const int dst_h = dest_lowerright.y - dest_upperleft.y;
+
+    vigra_precondition((src_y_begin == 0 || (4 <= src_y_begin && src_y_begin < src_h)) &&
+                       src_y_begin < src_y_end && src_y_end <= src_h,
+                       "invalid band in expand");
 
     const bool dst_w_even = (dst_w & 1) == 0;
     const bool dst_h_even = (dst_h & 1) == 0;
 
-    // SKIPSM state variables
-    SKIPSMImagePixelType current;
-    SKIPSMImagePixelType out00, out10, out01, out11;
-    SKIPSMImagePixelType sr0, sr1;
-    SKIPSMImagePixelType* sc0a = new SKIPSMImagePixelType[src_w + 1];
-    SKIPSMImagePixelType* sc0b = new SKIPSMImagePixelType[src_w + 1];
-    SKIPSMImagePixelType* sc1a = new SKIPSMImagePixelType[src_w + 1];
-    SKIPSMImagePixelType* sc1b = new SKIPSMImagePixelType[src_w + 1];
-
-    // Convenient constants
-    const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
-
-    DestImageIterator dy = dest_upperleft;
-    DestImageIterator dyy = dest_upperleft;
-    DestImageIterator dx = dy;
-    DestImageIterator dxx = dyy;
-    SrcImageIterator sy = src_upperleft;
-    SrcImageIterator sx = sy;
-
-    int srcy = 0;
-    int srcx = 0;
-    //int dsty = 0;
-    //int dstx = 0;
-
-    // First row
-    {
-        // First column
-        srcx = 0;
-        sx = sy;
-        sr0 = SKIPSMImagePixelType(sa(sx));
-        if (wraparound) {
-            sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0)));
-            if (!dst_w_even) {
-                sr1 = IMUL4(sr1);
-            }
-        } else {
-            sr1 = SKIPSMImageZero;
-        }
-        // sc*[0] are irrelevant
-
-        srcx = 1;
-        ++sx.x;
-
-        for (; srcx < src_w; ++srcx, ++sx.x) {
-            current = SKIPSMImagePixelType(sa(sx));
-            sc0a[srcx] = sr1 + IMUL6(sr0) + current;
-            sc0b[srcx] = (sr0 + current) * 4;
-            sc1a[srcx] = SKIPSMImageZero;
-            sc1b[srcx] = SKIPSMImageZero;
-            sr1 = sr0;
-            sr0 = current;
-        }
-
-        // extra column at end of first row
-        if (wraparound) {
-            current = SKIPSMImagePixelType(sa(sy));
-            if (dst_w_even) {
-                sc0a[srcx] = sr1 + IMUL6(sr0) + current;
-                sc0b[srcx] = (sr0 + current) * 4;
-            } else {
-                sc0a[srcx] = sr1 + IMUL6(sr0) + IMUL4(current);
-                // sc*b[srcx] are irrelevant for odd-sized dst images in wraparound mode.
-            }
-        } else {
-            sc0a[srcx] = sr1 + IMUL6(sr0);
-            sc0b[srcx] = sr0 * 4;
-        }
-        sc1a[srcx] = SKIPSMImageZero;
-        sc1b[srcx] = SKIPSMImageZero;
+    // Column weights of the even and odd destination columns of
+    // source column 1 and of the extra column; the main columns
+    // weigh 8.  A single-column image ignores wraparound here.
+    int column_weight[2][2] = {{7, 8}, {7, 4}};
+    if (src_w == 1) {
+        column_weight[1][0] = 6;
+    } else if (wraparound) {
+        column_weight[0][0] = column_weight[1][0] = dst_w_even ? 8 : 11;
+        column_weight[1][1] = 8;
     }
 
-    // dy  = row 0
-    // dyy = row 1
-    ++dyy.y;
-    // sy = row 1
-    srcy = 1;
-    ++sy.y;
-
-    // Second row
-    if (src_h > 1) {
-        // First column
-        srcx = 0;
-        sx = sy;
-        sr0 = SKIPSMImagePixelType(sa(sx));
-        if (wraparound) {
-            sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w - 1, 0)));
-            if (!dst_w_even) {
-                sr1 = IMUL4(sr1);
-            }
-        } else {
-            sr1 = SKIPSMImageZero;
-        }
-        // sc*[0] are irrelevant
-
-        srcx = 1;
-        ++sx.x;
-        dx = dy;
-        dxx = dyy;
-
-        // Second column
-        if (src_w > 1) {
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND(56, 56, 16, 16);
-                } else {
-                    SKIPSM_EXPAND(77, 56, 22, 16);
-                }
-            } else {
-                SKIPSM_EXPAND(49, 56, 14, 16);
-            }
-
-            // Main columns
-            for (srcx = 2, ++sx.x; srcx < src_w; ++srcx, ++sx.x) {
-                SKIPSM_EXPAND(56, 56, 16, 16);
-            }
-
-            // extra column at end of second row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_EVEN(56, 56, 16, 16);
-                } else {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_ODD(77, 22);
-                }
-            } else {
-                SKIPSM_EXPAND_COLUMN_END(49, 28, 14, 8);
-            }
-        } else {
-            // Math works out exactly the same for wraparound and no wraparound when src_w ==1
-            SKIPSM_EXPAND_COLUMN_END(42, 28, 12, 8);
-        }
-    } else {
-        // No Second Row
-        // First Column
-        srcx = 0;
-        sr0 = SKIPSMImageZero;
-        sr1 = SKIPSMImageZero;
-
-        dx = dy;
-        dxx = dyy;
-
-        if (src_w > 1) {
-            // Second Column
-            srcx = 1;
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_END(48, 48, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_END(66, 48, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_END(42, 48, 7, 8);
-            }
+    // The column state consists of the interpolated source rows
+    // y-2 and y-1; source row y is interpolated into the third
+    // buffer.  Advancing the state rotates the buffers.
+    SKIPSMImagePixelType* row[3];
+    for (int i = 0; i < 3; ++i) {
+        row[i] = new SKIPSMImagePixelType[2 * src_w + 2];
+    }
+    SKIPSMImagePixelType* sc1 = row[0];
+    SKIPSMImagePixelType* sc0 = row[1];
+    SKIPSMImagePixelType* h = row[2];
 
-            // Main columns
-            for (srcx = 2; srcx < src_w; ++srcx) {
-                SKIPSM_EXPAND_ROW_END(48, 48, 8, 8);
-            }
+    // Convenient constants
+    const SKIPSMImagePixelType SKIPSMImageZero(vigra::NumericTraits<SKIPSMImagePixelType>::zero());
 
-            // extra column at end of row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(48, 48, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(66, 48, 11, 8);
-                }
+    // Rows above the image are zero.
+    std::fill(sc1, sc1 + 2 * src_w + 2, SKIPSMImageZero);
+    std::fill(sc0, sc0 + 2 * src_w + 2, SKIPSMImageZero);
+
+    // Visit the source rows from row_begin on.  The first row of the
+    // image only sets up the column state.  A band that starts
+    // further down primes the column state with the two source rows
+    // above it, without writing their output rows.
+    const int row_begin = src_y_begin == 0 ? 0 : src_y_begin - 2;
+    const int output_begin = std::max(1, src_y_begin);
+
+    for (int srcy = row_begin; srcy < src_y_end; ++srcy) {
+        expandRow(wraparound, dst_w_even, srcy == 0, src_upperleft + vigra::Diff2D(0, srcy), sa, src_w, h);
+
+        // Source row srcy completes destination rows 2*(srcy-1) and
+        // 2*(srcy-1)+1.
+        if (srcy >= output_begin) {
+            const DestImageIterator dy = dest_upperleft + vigra::Diff2D(0, 2 * (srcy - 1));
+            if (srcy == 1) {
+                expandRowPair<7, 2>(dy, da, cf, sc1, sc0, h, src_w, column_weight, dst_w_even, true);
             } else {
-                SKIPSM_EXPAND_ROW_COLUMN_END(42, 24, 7, 4);
+                expandRowPair<8, 2>(dy, da, cf, sc1, sc0, h, src_w, column_weight, dst_w_even, true);
             }
-        } else {
-            // No Second Column
-            // dst_w, dst_h must be at least 2
-            SKIPSM_EXPAND_ROW_COLUMN_END(36, 24, 6, 4);
         }
 
-        delete [] sc0a;
-        delete [] sc0b;
-        delete [] sc1a;
-        delete [] sc1b;
-
-        return;
+        std::swap(sc1, sc0);
+        std::swap(sc0, h);
     }
 
-    // dy = row 2
-    // dyy = row 3
-    dy.y += 2;
-    dyy.y += 2;
-    // sy = row 2
-    srcy = 2;
-    ++sy.y;
-
-    // Main Rows
-    for (srcy = 2, sx = sy; srcy < src_h; ++srcy, ++sy.y, dy.y += 2, dyy.y += 2) {
-        // First column
-        srcx = 0;
-        sx = sy;
-        sr0 = SKIPSMImagePixelType(sa(sx));
-        if (wraparound) {
-            sr1 = SKIPSMImagePixelType(sa(sy, vigra::Diff2D(src_w-1,0)));
-            if (!dst_w_even) {
-                sr1 = IMUL4(sr1);
-            }
+    // Extra row at end
+    if (src_y_end == src_h) {
+        const DestImageIterator dy = dest_upperleft + vigra::Diff2D(0, 2 * (src_h - 1));
+        const SKIPSMImagePixelType* const none = 0;
+        if (src_h == 1) {
+            expandRowPair<6, 1>(dy, da, cf, sc1, sc0, none, src_w, column_weight, dst_w_even, dst_h_even);
         } else {
-            sr1 = SKIPSMImageZero;
+            expandRowPair<7, 1>(dy, da, cf, sc1, sc0, none, src_w, column_weight, dst_w_even, dst_h_even);
         }
-        // sc*[0] are irrelevant
-
-        srcx = 1;
-        ++sx.x;
-        dx = dy;
-        dxx = dyy;
-
-        // Second column
-        if (src_w > 1) {
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND(64, 64, 16, 16);
-                } else {
-                    SKIPSM_EXPAND(88, 64, 22, 16);
-                }
-            } else {
-                SKIPSM_EXPAND(56, 64, 14, 16);
-            }
-
-            // Main columns
-            for (srcx = 2, ++sx.x; srcx < src_w; ++srcx, ++sx.x) {
-                SKIPSM_EXPAND(64, 64, 16, 16);
-            }
+    }
 
-            // extra column at end of row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_EVEN(64, 64, 16, 16);
-                } else {
-                    SKIPSM_EXPAND_COLUMN_END_WRAPAROUND_ODD(88, 22);
-                }
-            } else {
-                SKIPSM_EXPAND_COLUMN_END(56, 32, 14, 8);
-            }
-        }
-        else {
-            // No second column
-            // dst_w must be at least 2
-            // Math works out exactly the same for wraparound and no wraparound when src_w == 1
-            SKIPSM_EXPAND_COLUMN_END(48, 32, 12, 8);
-        }
+    for (int i = 0; i < 3; ++i) {
+        delete [] row[i];
     }
+}
 
-    // Extra row at end
-    {
-        srcx = 0;
-        sr0 = SKIPSMImageZero;
-        sr1 = SKIPSMImageZero;
-
-        dx = dy;
-        dxx = dyy;
-
-        if (src_w > 1) {
-            // Second Column
-            srcx = 1;
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_END(56, 56, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_END(77, 56, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_END(49, 56, 7, 8);
-            }
 
-            // Main columns
-            for (srcx = 2; srcx < src_w; ++srcx) {
-                SKIPSM_EXPAND_ROW_END(56, 56, 8, 8);
-            }
+/** The Burt & Adelson Expand operation.
+ *  The regular source rows are split into horizontal bands, which
+ *  are expanded in parallel.
+ */
+template <typename SKIPSMImagePixelType,
+          typename SrcImageIterator, typename SrcAccessor,
+          typename DestImageIterator, typename DestAccessor,
+          typename CombineFunctor>
+void
+expand(bool add, bool wraparound,
+       SrcImageIterator src_upperleft,
+       SrcImageIterator src_lowerright,
+       SrcAccessor sa,
+       DestImageIterator dest_upperleft,
+       DestImageIterator dest_lowerright,
+       DestAccessor da,
+       CombineFunctor cf)
+{
+    const int src_h = src_lowerright.y - src_upperleft.y;
+    // Source rows 0 and 1 are special; all others are regular.
+    const int regular_rows = src_h - 2;
+    const int bands = numberOfPyramidBands(regular_rows);
 
-            // extra column at end of row
-            if (wraparound) {
-                if (dst_w_even) {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(56, 56, 8, 8);
-                } else {
-                    SKIPSM_EXPAND_ROW_COLUMN_END(77, 56, 11, 8);
-                }
-            } else {
-                SKIPSM_EXPAND_ROW_COLUMN_END(49, 28, 7, 4);
-            }
-        } else {
-            // No Second Column
-            // dst_w, dst_h must be at least 2
-            SKIPSM_EXPAND_ROW_COLUMN_END(42, 28, 6, 4);
-        }
+#ifdef OPENMP
+#pragma omp parallel for schedule(static) if (bands > 1)
+#endif
+    for (int band = 0; band < bands; ++band) {
+        const int begin = band == 0 ? 0 : 2 + band * regular_rows / bands;
+        const int end = band == bands - 1 ? src_h : 2 + (band + 1) * regular_rows / bands;
+        expandBand<SKIPSMImagePixelType>(wraparound,
+                                         src_upperleft, src_lowerright, sa,
+                                         dest_upperleft, dest_lowerright, da,
+                                         cf,
+                                         begin, end);
     }
-
-    delete [] sc0a;
-    delete [] sc0b;
-    delete [] sc1a;
-    delete [] sc1b;
 }
 
 